@@ -0,0 +1,240 @@
+/****************************************************
+ * Multi-threaded decoder for files storing data in Tagged Spot Format
+ * Written to speed up opening large TSF files in matlab
+ *
+ * The file is memory mapped.  A fast pre-scan hops over the size prefixes
+ * of the spots to find the byte offset of every BLOCKSPOTS-th spot.  The
+ * threads of the shared TSFThreadPool then take whole blocks and decode
+ * them with TSFParser::DecodeSpot into disjoint rows of the (preallocated)
+ * output columns.  No matlab
+ * functions are called from the worker threads.  When a filter is used, 
+ * blocks are decoded into temporary buffers that only hold the accepted 
+ * spots, which are copied into the output once their total nr is known.
+ */
+
+#include <string.h>
+#include "TSFParallelDecoder.h"
+#include "../../tsfutil/TSFTrace.h"
+
+// Nr of spots handed to a thread at a time
+static const uint64_t BLOCKSPOTS = 16384;
+
+
+TSFParallelDecoder::TSFParallelDecoder(const std::string& fileName,
+      uint64_t dataOffset, std::vector<TSFOverlay*> overlays) :
+   file_(fileName),
+   data_(file_.GetData()),
+   size_(file_.GetSize()),
+   dataOffset_(dataOffset),
+   overlays_(overlays),
+   nrSpots_(0),
+   columns_(NULL)
+{
+}
+
+uint64_t TSFParallelDecoder::Scan()
+{
+   blockOffsets_.clear();
+   nrSpots_ = 0;
+   if (data_ == NULL)
+      return 0;
+
+   TSFTraceScope scope("scan", "TSFParallelDecoder");
+
+   const uint8_t* p = data_ + dataOffset_;
+   const uint8_t* end = data_ + size_;
+   while (p < end)
+   {
+      const uint8_t* start = p;
+      const uint8_t* record;
+      uint32_t size;
+      if (!TSFRecords::NextRecord(&p, end, &record, &size) || size == 0)
+         break;
+      if (nrSpots_ % BLOCKSPOTS == 0)
+         blockOffsets_.push_back(start - data_);
+      nrSpots_++;
+   }
+
+   scope.SetSpots(nrSpots_);
+   return nrSpots_;
+}
+
+bool TSFParallelDecoder::GetSpotView(uint64_t spot, TSFSpotView* view)
+{
+   if (spot >= nrSpots_)
+      return false;
+
+   // hop from the start of the block to the spot
+   const uint8_t* p = data_ + blockOffsets_[spot / BLOCKSPOTS];
+   const uint8_t* end = data_ + size_;
+   const uint8_t* record;
+   uint32_t size;
+   for (uint64_t i = 0; i <= spot % BLOCKSPOTS; i++)
+   {
+      if (!TSFRecords::NextRecord(&p, end, &record, &size))
+         return false;
+   }
+   view->Reset(record, size, &overlays_, spot);
+   return true;
+}
+
+bool TSFParallelDecoder::Decode(std::vector<TSFParser::Column>& columns,
+      int nrThreads)
+{
+   columns_ = &columns;
+   lookup_ = TSFParser::BuildLookup(columns);
+   blockValues_.clear();
+   return RunThreads(nrThreads);
+}
+
+bool TSFParallelDecoder::DecodeFiltered(
+      const std::vector<TSFParser::Column>& layout, int nrThreads, 
+      uint64_t* nrAccepted)
+{
+   std::vector<TSFParser::Column> columns(layout);
+   for (unsigned int i = 0; i < columns.size(); i++)
+   {
+      columns[i].asDouble = false;
+      columns[i].stride = 1;
+      columns[i].data = NULL;
+   }
+   columns_ = &columns;
+   lookup_ = TSFParser::BuildLookup(columns);
+   blockValues_.assign(blockOffsets_.size(), 
+         std::vector<std::vector<int32_t> >(columns.size()));
+   blockCounts_.assign(blockOffsets_.size(), 0);
+
+   bool success = RunThreads(nrThreads);
+   columns_ = NULL;
+   if (!success)
+   {
+      blockValues_.clear();
+      return false;
+   }
+
+   *nrAccepted = 0;
+   for (unsigned int b = 0; b < blockCounts_.size(); b++)
+      *nrAccepted += blockCounts_[b];
+   return true;
+}
+
+void TSFParallelDecoder::CopyFiltered(std::vector<TSFParser::Column>& columns)
+{
+   TSFTraceScope scope("copy", "TSFParallelDecoder");
+   uint64_t row = 0;
+   for (unsigned int b = 0; b < blockValues_.size(); b++)
+   {
+      for (unsigned int i = 0; i < columns.size() && i < blockValues_[b].size(); i++)
+      {
+         const std::vector<int32_t>& values = blockValues_[b][i];
+         TSFParser::Column& column = columns[i];
+         if (!column.asDouble)
+         {
+            if (!values.empty())
+               memcpy((int32_t*) column.data + row, &values[0], 
+                     values.size() * sizeof(int32_t));
+            continue;
+         }
+         double* out = (double*) column.data + row * column.stride;
+         for (unsigned int j = 0; j < values.size(); j++)
+         {
+            if (column.isFloat)
+            {
+               float val;
+               memcpy(&val, &values[j], sizeof(val));
+               out[j * column.stride] = val;
+            } else
+               out[j * column.stride] = values[j];
+         }
+      }
+      row += blockCounts_[b];
+      std::vector<std::vector<int32_t> >().swap(blockValues_[b]);
+   }
+   blockValues_.clear();
+   scope.SetSpots(row);
+}
+
+bool TSFParallelDecoder::RunThreads(int nrThreads)
+{
+   return TSFThreadPool::Shared()->ParallelFor(blockOffsets_.size(), this,
+         nrThreads);
+}
+
+bool TSFParallelDecoder::Run(uint64_t block)
+{
+   TSFTraceScope scope("decode", "TSFParallelDecoder");
+   bool filtered = !blockValues_.empty();
+   bool success = filtered ? DecodeBlockFiltered(block) : DecodeBlock(block);
+   if (success && filtered)
+      scope.SetSpots(blockCounts_[block]);
+   else if (success)
+   {
+      uint64_t first = block * BLOCKSPOTS;
+      scope.SetSpots(first + BLOCKSPOTS < nrSpots_ ? 
+            BLOCKSPOTS : nrSpots_ - first);
+   }
+   return success;
+}
+
+bool TSFParallelDecoder::DecodeBlock(size_t block)
+{
+   uint64_t first = block * BLOCKSPOTS;
+   uint64_t last = first + BLOCKSPOTS < nrSpots_ ? first + BLOCKSPOTS : nrSpots_;
+   const uint8_t* p = data_ + blockOffsets_[block];
+   const uint8_t* end = data_ + size_;
+
+   for (uint64_t row = first; row < last; row++)
+   {
+      const uint8_t* record;
+      uint32_t size;
+      if (!TSFRecords::NextRecord(&p, end, &record, &size))
+         return false;
+      if (!TSFParser::DecodeSpot(record, size, *columns_, lookup_, row,
+               overlays_, row))
+         return false;
+   }
+   return true;
+}
+
+bool TSFParallelDecoder::DecodeBlockFiltered(size_t block)
+{
+   uint64_t first = block * BLOCKSPOTS;
+   uint64_t last = first + BLOCKSPOTS < nrSpots_ ? first + BLOCKSPOTS : nrSpots_;
+   const uint8_t* p = data_ + blockOffsets_[block];
+   const uint8_t* end = data_ + size_;
+
+   // each thread decodes into its own copy of the columns
+   std::vector<TSFParser::Column> columns(*columns_);
+   std::vector<std::vector<int32_t> >& values = blockValues_[block];
+   for (unsigned int i = 0; i < columns.size(); i++)
+   {
+      values[i].assign(last - first, 0);
+      columns[i].data = values[i].empty() ? NULL : &values[i][0];
+   }
+
+   uint64_t n = 0;
+   for (uint64_t ordinal = first; ordinal < last; ordinal++)
+   {
+      const uint8_t* record;
+      uint32_t size;
+      bool accepted;
+      if (!TSFRecords::NextRecord(&p, end, &record, &size))
+         return false;
+      if (!TSFParser::DecodeSpot(record, size, columns, lookup_, n, overlays_, 
+               ordinal, &filter_, &accepted))
+         return false;
+      if (accepted)
+         n++;
+   }
+
+   // trim the buffers to the accepted spots
+   for (unsigned int i = 0; i < values.size(); i++)
+      std::vector<int32_t>(values[i].begin(), values[i].begin() + n).swap(values[i]);
+   blockCounts_[block] = n;
+   return true;
+}
+
+int TSFParallelDecoder::GetNrProcessors()
+{
+   return TSFThreadPool::Shared()->GetNrThreads();
+}
@@ -0,0 +1,89 @@
+/****************************************************
+ * Multi-threaded decoder for files storing data in Tagged Spot Format
+ * Written to speed up opening large TSF files in matlab
+ */
+
+#ifndef TSFPARALLELDECODER_H
+#define TSFPARALLELDECODER_H
+
+#include <string>
+#include <vector>
+#include "TSFParser.h"
+#include "../../tsfutil/TSFRecords.h"
+#include "../../tsfutil/TSFThreadPool.h"
+
+class TSFParallelDecoder : public TSFLoopBody
+{
+   public:
+      TSFParallelDecoder(const std::string& fileName, uint64_t dataOffset,
+            std::vector<TSFOverlay*> overlays);
+
+      bool IsOpen() { return data_ != NULL; };
+
+      /**
+       * Walks the size prefixes of all spots (without decoding them) and
+       * records where each block of spots starts.  Returns the nr of spots
+       */
+      uint64_t Scan();
+
+      /**
+       * Decodes all spots found by Scan into columns, which should have room
+       * for all of them.  Each thread decodes whole blocks into disjoint rows
+       * of the columns.  Returns false if a spot could not be decoded
+       */
+      bool Decode(std::vector<TSFParser::Column>& columns, int nrThreads);
+
+      /**
+       * When a filter is set, the nr of spots in the output is not known 
+       * until all spots are decoded.  DecodeFiltered decodes the spots that 
+       * pass the filter into temporary buffers (one per block, trimmed to 
+       * the spots that were accepted), and sets nrAccepted to the nr of 
+       * accepted spots.  Returns false if a spot could not be decoded.
+       * The types of the columns are taken from layout.  CopyFiltered then 
+       * copies the accepted spots, in file order, into columns and releases 
+       * the temporary buffers
+       */
+      void SetFilter(const TSFParser::Filter& filter) { filter_ = filter; };
+      bool DecodeFiltered(const std::vector<TSFParser::Column>& layout,
+            int nrThreads, uint64_t* nrAccepted);
+      void CopyFiltered(std::vector<TSFParser::Column>& columns);
+
+      /**
+       * Points view to spot nr spot (0-based) in the memory mapped file,
+       * without copying or decoding it (see TSFSpotView).  Scan should be 
+       * called first.  Returns false when there is no such spot.  The view
+       * is valid as long as the decoder
+       */
+      bool GetSpotView(uint64_t spot, TSFSpotView* view);
+
+      // nr of threads of the shared TSFThreadPool
+      static int GetNrProcessors();
+
+      // decodes one block, called by the threads of the pool
+      bool Run(uint64_t block);
+
+   private:
+      bool RunThreads(int nrThreads);
+      bool DecodeBlock(size_t block);
+      bool DecodeBlockFiltered(size_t block);
+
+      TSFMappedFile file_;
+      const uint8_t* data_;
+      uint64_t size_;
+      uint64_t dataOffset_;
+      std::vector<TSFOverlay*> overlays_;
+      std::vector<uint64_t> blockOffsets_;
+      uint64_t nrSpots_;
+      TSFParser::Filter filter_;
+
+      // accepted spots of each block when filtering, one vector per column
+      // holding the raw 4 byte values (int32 or float)
+      std::vector<std::vector<std::vector<int32_t> > > blockValues_;
+      std::vector<uint64_t> blockCounts_;
+
+      // state shared with the decode threads
+      std::vector<TSFParser::Column>* columns_;
+      std::vector<int> lookup_;
+};
+
+#endif
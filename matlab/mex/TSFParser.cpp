@@ -8,71 +8,36 @@
  * License: BSD-clause3: http://www.opensource.org/licenses/BSD-3-Clause
  */
 
+#include <algorithm>
 #include <fstream>
+#include <string.h>
 #include "TSFParser.h"
+#include "../../tsfutil/TSFTrace.h"
 #include "../../buildcpp/TSFProto.pb.h"
 #include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/wire_format_lite.h>
+
+using google::protobuf::internal::WireFormatLite;
+
+// Highest field number that can be used in a Spot (including extensions)
+static const int MAXFIELDNUMBER = 2047;
 
 
 TSFParser::TSFParser(std::ifstream* ifs, 
-            std::vector<std::string> requestedFields) :
+            std::vector<std::string> requestedFields,
+            std::vector<TSFOverlay*> overlays) :
+   initialized_(false),
+   firstSpot_(true),
+   decodeFailed_(false),
    requestedFields_(requestedFields),
-   initialized_(false)
+   overlays_(overlays),
+   spotOrdinal_(0),
+   dataOffset_(0)
 {
    if (ifs == 0 || ifs->fail()) {
       return;
    }
 
-   // fill fieldMap_ and fieldFunctionMap_.  
-   fieldMap_["molecule"] = 1;
-   fieldFunctionMap_[1] = &TSF::Spot::has_molecule;
-   fieldMap_["channel"] = 2;
-   fieldFunctionMap_[2] = &TSF::Spot::has_channel;
-   fieldMap_["frame"] = 3;
-   fieldFunctionMap_[3] = &TSF::Spot::has_frame;
-   fieldMap_["slice"] = 4;
-   fieldFunctionMap_[4] = &TSF::Spot::has_slice;
-   fieldMap_["pos"] = 5;
-   fieldFunctionMap_[5] = &TSF::Spot::has_pos;
-   //fieldMap_["location_units"] = 17;
-   //fieldFunctionMap_[17] = &TSF::Spot::has_location_units;
-   fieldMap_["x"] = 7;
-   fieldFunctionMap_[7] = &TSF::Spot::has_x;
-   fieldMap_["y"] = 8;
-   fieldFunctionMap_[8] = &TSF::Spot::has_y;
-   fieldMap_["z"] = 9;
-   fieldFunctionMap_[9] = &TSF::Spot::has_z;
-   fieldMap_["intensity_units"] = 18;
-   fieldFunctionMap_[18] = &TSF::Spot::has_intensity_units;
-   fieldMap_["intensity"] = 10;
-   fieldFunctionMap_[10] = &TSF::Spot::has_intensity;
-   fieldMap_["background"] = 11;
-   fieldFunctionMap_[11] = &TSF::Spot::has_background;
-   fieldMap_["width"] = 12;
-   fieldFunctionMap_[12] = &TSF::Spot::has_width;
-   fieldMap_["a"] = 13;
-   fieldFunctionMap_[13] = &TSF::Spot::has_a;
-   fieldMap_["theta"] = 14;
-   fieldFunctionMap_[14] = &TSF::Spot::has_theta;
-   fieldMap_["flag"] = 6;
-   fieldFunctionMap_[6] = &TSF::Spot::has_flag;
-   fieldMap_["x_original"] = 101;
-   fieldFunctionMap_[101] = &TSF::Spot::has_x_original;
-   fieldMap_["y_original"] = 102;
-   fieldFunctionMap_[102] = &TSF::Spot::has_y_original;
-   fieldMap_["z_original"] = 103;
-   fieldFunctionMap_[103] = &TSF::Spot::has_z_original;
-   fieldMap_["x_precision"] = 104;
-   fieldFunctionMap_[104] = &TSF::Spot::has_x_precision;
-   fieldMap_["y_precision"] = 105;
-   fieldFunctionMap_[105] = &TSF::Spot::has_y_precision;
-   fieldMap_["z_precision"] = 106;
-   fieldFunctionMap_[106] = &TSF::Spot::has_z_precision;
-   fieldMap_["x_position"] = 107;
-   fieldFunctionMap_[107] = &TSF::Spot::has_x_position;
-   fieldMap_["y_position"] = 108;
-   fieldFunctionMap_[108] = &TSF::Spot::has_y_position;
-
    try {
       input_ = new google::protobuf::io::IstreamInputStream(ifs);
       codedInput_ = new google::protobuf::io::CodedInputStream(input_);
@@ -88,9 +53,11 @@ TSFParser::TSFParser(std::ifstream* ifs,
       codedInput_->ReadString(&buffer, mSize);
       if (!spotList_.ParseFromString(buffer))
          return;
+      dataOffset_ = codedInput_->CurrentPosition();
 
-      // Read the first spot into variable spot_
-      NextSpot();
+      // Read the first spot into variable spot_ (a file without spots
+      // has none to hand out)
+      firstSpot_ = NextSpot();
 
       // so that we can check which of the requested fields are present
       checkFields(requestedFields);
@@ -116,122 +83,128 @@ std::vector<std::string> TSFParser::GetFields()
    return fields_;
 }
 
+/**
+ * Table with all singular int32, enum and float fields of the Spot message,
+ * including extensions (such as those in MMLocM.proto) that are linked in.
+ * The table is built from the descriptors generated by protoc, so it stays
+ * in sync with the .proto files.
+ */
+static std::vector<TSFParser::FieldInfo> BuildFieldTable()
+{
+   std::vector<TSFParser::FieldInfo> table;
+   const google::protobuf::Descriptor* sd = TSF::Spot::descriptor();
+   std::vector<const google::protobuf::FieldDescriptor*> fds;
+   for (int i = 0; i < sd->field_count(); i++)
+      fds.push_back(sd->field(i));
+   google::protobuf::DescriptorPool::generated_pool()->FindAllExtensions(sd, &fds);
+
+   for (unsigned int i = 0; i < fds.size(); i++)
+   {
+      const google::protobuf::FieldDescriptor* fd = fds[i];
+      if (fd->is_repeated() || fd->number() > MAXFIELDNUMBER)
+         continue;
+      TSFParser::FieldInfo info;
+      info.fd = fd;
+      info.number = fd->number();
+      info.name = fd->name();
+      switch (fd->cpp_type())
+      {
+         case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+         case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+            info.isFloat = false;
+            break;
+         case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+            info.isFloat = true;
+            break;
+         default:
+            continue;
+      }
+      table.push_back(info);
+   }
+   return table;
+}
+
+/**
+ * The table is built on first use.  The initialization of a local static
+ * is thread safe, so the readers of tsfc and tsfio can be opened from
+ * several threads at once
+ */
+const std::vector<TSFParser::FieldInfo>& TSFParser::GetFieldTable()
+{
+   static const std::vector<FieldInfo> table = BuildFieldTable();
+   return table;
+}
+
+const TSFParser::FieldInfo* TSFParser::FindField(const std::string& name)
+{
+   const std::vector<FieldInfo>& table = GetFieldTable();
+   for (unsigned int i = 0; i < table.size(); i++)
+   {
+      if (table[i].name == name)
+         return &table[i];
+   }
+   return NULL;
+}
+
+/**
+ * Selects the requested fields that are present in the first spot
+ */
 bool TSFParser::checkFields(std::vector<std::string> requestedFields)
 {
+   const google::protobuf::Reflection* sr = spot_.GetReflection();
    std::vector<std::string>::iterator it;
-   std::map<std::string, int>::iterator itm;
-   std::map<int, has_function>::iterator itmf;
 
    for (it=requestedFields.begin(); it < requestedFields.end(); it++)
    {
-      itm = fieldMap_.find(*it);
-      if (itm != fieldMap_.end()) {
-         itmf = fieldFunctionMap_.find(itm->second);
-         if ( itmf != fieldFunctionMap_.end()) {
-            has_function mhf = itmf->second;
-            if ( ((spot_).*mhf)() ) 
-            {
-               fields_.push_back(itm->first);
-               fieldsNumeric_.push_back(itm->second);
-            }
-         }
+      const FieldInfo* info = FindField(*it);
+      if (info != NULL && sr->HasField(spot_, info->fd)) 
+      {
+         fields_.push_back(info->name);
+         fieldsNumeric_.push_back(info->number);
+
+         Column column;
+         column.fieldNumber = info->number;
+         column.isFloat = info->isFloat;
+         column.asDouble = true;
+         column.stride = 1;
+         column.data = NULL;
+         doubleColumns_.push_back(column);
       }
    }
+   doubleLookup_ = BuildLookup(doubleColumns_);
+   return true;
 }
 
 bool TSFParser::GetNextSpot(double* data)
 {
-   if (!initialized_)
+   if (!initialized_ || decodeFailed_)
       return false;
 
-   if (firstSpot_)
-      firstSpot_ = false;
-   else
-      if (!NextSpot())
-         return false;
-
-   std::vector<int>::iterator it;
-
-   uint64_t i = 0;
-   for (it=fieldsNumeric_.begin(); it < fieldsNumeric_.end(); it++)
+   const Filter* filter = filter_.IsActive() ? &filter_ : NULL;
+   bool accepted = false;
+   while (!accepted)
    {
-      // Unelegant to write out the functions, but since the signatures
-      // of the called function are different, I do not think that 
-      // a map of function pointers can be used
-      switch(*it)
+      if (firstSpot_)
+         firstSpot_ = false;
+      else
+         if (!ReadRecord())
+            return false;
+
+      // Fields absent in this spot get their default value (0)
+      for (unsigned int i = 0; i < doubleColumns_.size(); i++)
       {
-         case 1:
-            data[i] = spot_.molecule();
-            break;
-         case 2:
-            data[i] = spot_.channel();
-            break;
-         case 3:
-            data[i] = spot_.frame();
-            break;
-         case 4:
-            data[i] = spot_.slice();
-            break;
-         case 5:
-            data[i] = spot_.pos();
-            break;
-         case 7:
-            data[i] = spot_.x();
-            break;
-         case 8:
-            data[i] = spot_.y();
-            break;
-         case 9:
-            data[i] = spot_.z();
-            break;
-         case 10:
-            data[i] = spot_.intensity();
-            break;
-         case 11:
-            data[i] = spot_.background();
-            break;
-         case 12:
-            data[i] = spot_.width();
-            break;
-         case 13:
-            data[i] = spot_.a();
-            break;
-         case 14:
-            data[i] = spot_.theta();
-            break;
-         case 6:
-            data[i] = spot_.flag();
-            break;
-         case 101:
-            data[i] = spot_.x_original();
-            break;
-         case 102:
-            data[i] = spot_.y_original();
-            break;
-         case 103:
-            data[i] = spot_.z_original();
-            break;
-         case 104:
-            data[i] = spot_.x_precision();
-            break;
-         case 105:
-            data[i] = spot_.y_precision();
-            break;
-         case 106:
-            data[i] = spot_.z_precision();
-            break;
-         case 107:
-            data[i] = spot_.x_position();
-            break;
-         case 108:
-            data[i] = spot_.y_position();
-            break;
+         data[i] = 0.0;
+         doubleColumns_[i].data = data + i;
       }
-      //i+=GetNrSpotsFromSpotList();
-      i++;
 
+      if (!DecodeSpot((const uint8_t*) buffer_.data(), buffer_.size(), 
+            doubleColumns_, doubleLookup_, 0, overlays_, spotOrdinal_ - 1, 
+            filter, &accepted))
+      {
+         decodeFailed_ = true;
+         return false;
+      }
    }
-
    return true;
 }
 
@@ -246,7 +219,69 @@ TSF::Spot TSFParser::GetNextSpot()
    return spot_;
 }
 
+bool TSFParser::NextSpot(TSF::Spot* spot)
+{
+   if (!initialized_)
+      return false;
+
+   if (firstSpot_)
+   {
+      // the first spot was already read by the constructor
+      firstSpot_ = false;
+      spot->Swap(&spot_);
+      return true;
+   }
+
+   if (!ReadRecord())
+      return false;
+   if (!spot->ParseFromString(buffer_))
+      return false;
+
+   for (std::vector<TSFOverlay*>::iterator it = overlays_.begin();
+         it != overlays_.end(); ++it)
+   {
+      (*it)->Apply(spot, spotOrdinal_ - 1);
+   }
+   return true;
+}
+
+bool TSFParser::NextSpotView(TSFSpotView* view)
+{
+   if (!initialized_)
+      return false;
+
+   // the bytes of the first spot are still in buffer_
+   if (firstSpot_)
+      firstSpot_ = false;
+   else
+      if (!ReadRecord())
+         return false;
+
+   view->Reset((const uint8_t*) buffer_.data(), buffer_.size(), &overlays_,
+         spotOrdinal_ - 1);
+   return true;
+}
+
 bool TSFParser::NextSpot()
+{
+   if (!ReadRecord())
+      return false;
+   if (!spot_.ParseFromString(buffer_))
+      return false;
+
+   // Merge values from sidecar overlay files (see TSFOverlay)
+   for (std::vector<TSFOverlay*>::iterator it = overlays_.begin();
+         it != overlays_.end(); ++it)
+   {
+      (*it)->Apply(&spot_, spotOrdinal_ - 1);
+   }
+   return true;
+}
+
+/**
+ * Reads the raw bytes of the next spot into buffer_
+ */
+bool TSFParser::ReadRecord()
 {
    if (!codedInput_->ReadVarint32(&mSize_))
       return false;
@@ -254,8 +289,222 @@ bool TSFParser::NextSpot()
       return false;
    if (!codedInput_->ReadString(&buffer_, mSize_))
       return false; 
-   if (spot_.ParseFromString(buffer_))
+   spotOrdinal_++;
+   return true;
+}
+
+uint64_t TSFParser::GetNextSpots(std::vector<Column>& columns, uint64_t maxSpots)
+{
+   if (!initialized_ || decodeFailed_)
+      return 0;
+
+   TSFTraceScope scope("decode", "TSFParser");
+   std::vector<int> lookup = BuildLookup(columns);
+   const Filter* filter = filter_.IsActive() ? &filter_ : NULL;
+
+   uint64_t n = 0;
+   while (n < maxSpots)
+   {
+      // the first spot was already read by the constructor
+      if (firstSpot_)
+         firstSpot_ = false;
+      else
+         if (!ReadRecord())
+            break;
+      bool accepted = true;
+      if (!DecodeSpot((const uint8_t*) buffer_.data(), buffer_.size(), columns, 
+            lookup, n, overlays_, spotOrdinal_ - 1, filter, &accepted))
+      {
+         decodeFailed_ = true;
+         break;
+      }
+      if (accepted)
+         n++;
+   }
+
+   scope.SetSpots(n);
+   return n;
+}
+
+bool TSFParser::SkipSpots(uint64_t n)
+{
+   if (!initialized_)
+      return false;
+
+   for (uint64_t i = 0; i < n; i++)
+   {
+      if (firstSpot_)
+      {
+         firstSpot_ = false;
+         continue;
+      }
+      if (!codedInput_->ReadVarint32(&mSize_) || mSize_ <= 0)
+         return false;
+      if (!codedInput_->Skip(mSize_))
+         return false;
+      spotOrdinal_++;
+   }
+   return true;
+}
+
+/**
+ * Maps field numbers to columns, so that the decode loop only needs 
+ * a table lookup per field
+ */
+std::vector<int> TSFParser::BuildLookup(const std::vector<Column>& columns)
+{
+   std::vector<int> lookup(MAXFIELDNUMBER + 1, -1);
+   for (unsigned int i = 0; i < columns.size(); i++)
+   {
+      if (columns[i].fieldNumber > 0 && columns[i].fieldNumber <= MAXFIELDNUMBER)
+         lookup[columns[i].fieldNumber] = i;
+   }
+   return lookup;
+}
+
+static inline void StoreInt32(TSFParser::Column& column, uint64_t row, int32_t val)
+{
+   if (column.asDouble)
+      ((double*) column.data)[row * column.stride] = val;
+   else
+      ((int32_t*) column.data)[row] = val;
+}
+
+static inline void StoreFloat(TSFParser::Column& column, uint64_t row, float val)
+{
+   if (column.asDouble)
+      ((double*) column.data)[row * column.stride] = val;
+   else
+      ((float*) column.data)[row] = val;
+}
+
+/**
+ * Walks the wire format of a single spot and stores the values of 
+ * the requested fields in row "row" of the columns
+ */
+bool TSFParser::DecodeSpot(const uint8_t* data, int size, 
+      std::vector<Column>& columns, const std::vector<int>& lookup, 
+      uint64_t row, const std::vector<TSFOverlay*>& overlays, uint64_t ordinal,
+      const Filter* filter, bool* accepted)
+{
+   google::protobuf::io::CodedInputStream ci(data, size);
+
+   // values needed by the filter, whether or not they were requested
+   int32_t frame = 0;
+   int32_t channel = 0;
+   float x = 0.0;
+   float y = 0.0;
+
+   uint32_t tag;
+   while ((tag = ci.ReadTag()) != 0)
+   {
+      int number = WireFormatLite::GetTagFieldNumber(tag);
+      int col = number <= MAXFIELDNUMBER ? lookup[number] : -1;
+      switch (WireFormatLite::GetTagWireType(tag))
+      {
+         case WireFormatLite::WIRETYPE_VARINT:
+            {
+               uint32_t val;
+               if (!ci.ReadVarint32(&val))
+                  return false;
+               if (col >= 0 && !columns[col].isFloat)
+                  StoreInt32(columns[col], row, (int32_t) val);
+               if (number == TSF::Spot::kFrameFieldNumber)
+                  frame = (int32_t) val;
+               else if (number == TSF::Spot::kChannelFieldNumber)
+                  channel = (int32_t) val;
+            }
+            break;
+         case WireFormatLite::WIRETYPE_FIXED32:
+            {
+               uint32_t val;
+               if (!ci.ReadLittleEndian32(&val))
+                  return false;
+               if (col >= 0 && columns[col].isFloat)
+                  StoreFloat(columns[col], row, 
+                        WireFormatLite::DecodeFloat(val));
+               if (number == TSF::Spot::kXFieldNumber)
+                  x = WireFormatLite::DecodeFloat(val);
+               else if (number == TSF::Spot::kYFieldNumber)
+                  y = WireFormatLite::DecodeFloat(val);
+            }
+            break;
+         default:
+            if (!WireFormatLite::SkipField(&ci, tag))
+               return false;
+      }
+   }
+
+   for (std::vector<TSFOverlay*>::const_iterator it = overlays.begin();
+         it != overlays.end(); ++it)
+   {
+      int32_t bits;
+      int number = (*it)->GetFieldNumber();
+      if (!(*it)->GetBits(ordinal, &bits))
+         continue;
+      float val;
+      memcpy(&val, &bits, sizeof(val));
+      int col = lookup[number];
+      if (col >= 0)
+      {
+         if (columns[col].isFloat)
+            StoreFloat(columns[col], row, val);
+         else
+            StoreInt32(columns[col], row, bits);
+      }
+      if (number == TSF::Spot::kFrameFieldNumber)
+         frame = bits;
+      else if (number == TSF::Spot::kChannelFieldNumber)
+         channel = bits;
+      else if (number == TSF::Spot::kXFieldNumber)
+         x = val;
+      else if (number == TSF::Spot::kYFieldNumber)
+         y = val;
+   }
+
+   if (filter != NULL && !filter->Accept(frame, channel, x, y))
+   {
+      // clear the row, so that it can be reused for the next spot
+      for (unsigned int i = 0; i < columns.size(); i++)
+      {
+         if (columns[i].isFloat)
+            StoreFloat(columns[i], row, 0.0);
+         else
+            StoreInt32(columns[i], row, 0);
+      }
+      if (accepted != NULL)
+         *accepted = false;
       return true;
+   }
+
+   if (accepted != NULL)
+      *accepted = true;
+   return true;
+}
+
+bool TSFParser::Filter::Accept(int32_t frame, int32_t channel, float x, 
+      float y) const
+{
+   if (firstFrame > 0 && frame < firstFrame)
+      return false;
+   if (lastFrame > 0 && frame > lastFrame)
+      return false;
+   if (!channels.empty() && 
+         std::find(channels.begin(), channels.end(), channel) == channels.end())
+      return false;
+   if (useBox && (x < minX || x > maxX || y < minY || y > maxY))
+      return false;
+   return true;
+}
+
+bool TSFParser::IsFloatField(int fieldNumber)
+{
+   const std::vector<FieldInfo>& table = GetFieldTable();
+   for (unsigned int i = 0; i < table.size(); i++)
+   {
+      if (table[i].number == fieldNumber)
+         return table[i].isFloat;
+   }
    return false;
 }
 
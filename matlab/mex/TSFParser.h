@@ -8,40 +8,176 @@
  * License: BSD-clause3: http://www.opensource.org/licenses/BSD-3-Clause
  */
 
+#ifndef TSFPARSER_H
+#define TSFPARSER_H
+
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include "../../buildcpp/TSFProto.pb.h"
+#include "../../tsfutil/TSFOverlay.h"
+#include "../../tsfutil/TSFSpotIterator.h"
+#include "../../tsfutil/TSFSpotView.h"
 #include <vector>
 
 class TSFParser
 {
    public:
       TSFParser(std::ifstream* ifs,
-            std::vector<std::string> requestedFields);
+            std::vector<std::string> requestedFields,
+            std::vector<TSFOverlay*> overlays = std::vector<TSFOverlay*>());
       ~TSFParser();
 
       std::vector<std::string> GetFields();
+      std::vector<int> GetFieldNumbers() { return fieldsNumeric_; };
 
       /**
        * Returns data as doubles
        * It is the responsibility of the caller to allocate
        * enough memory in the pointer data such that all fields
        * in map "fields" can be returned
+       * Returns false after the last spot, or when a spot could not be
+       * decoded (see DecodeFailed)
        */
       bool GetNextSpot(double* data);
 
+      /**
+       * Destination for the values of a single field when decoding 
+       * in column-major order.  data points to the location where the
+       * value of the next spot will be written, and should have room for
+       * as many values as are requested.  Values are stored as int32_t,
+       * or as float when isFloat is true.  When asDouble is true, values 
+       * are converted to double and the values of consecutive spots are 
+       * stored stride doubles apart (i.e. in a fields x spots matrix).
+       */
+      struct Column
+      {
+         int fieldNumber;
+         bool isFloat;
+         bool asDouble;
+         uint32_t stride;
+         void* data;
+      };
+
+      /**
+       * Selection of spots applied while decoding.  Spots are only returned
+       * when their frame is within [firstFrame, lastFrame] (0 means no 
+       * limit), their channel is in channels (empty means all channels),
+       * and, when useBox is true, x and y are within the box 
+       */
+      struct Filter : public TSFSpotFilter
+      {
+         Filter() : firstFrame(0), lastFrame(0), useBox(false),
+            minX(0), maxX(0), minY(0), maxY(0) {};
+         bool IsActive() const { return firstFrame > 0 || lastFrame > 0 || 
+            !channels.empty() || useBox; };
+         bool Accept(int32_t frame, int32_t channel, float x, float y) const;
+         bool Accept(const TSF::Spot& spot) const
+         {
+            return Accept(spot.frame(), spot.channel(), spot.x(), spot.y());
+         };
+
+         int32_t firstFrame;
+         int32_t lastFrame;
+         std::vector<int32_t> channels;
+         bool useBox;
+         float minX, maxX, minY, maxY;
+      };
+      void SetFilter(const Filter& filter) { filter_ = filter; };
+
+      /**
+       * Decodes up to maxSpots spots directly from the file into columns,
+       * without constructing Spot messages.  Returns the number of spots 
+       * decoded (spots rejected by the filter are not counted).  Fields that 
+       * are absent in a spot are left untouched.  Stops at a spot that can
+       * not be decoded (see DecodeFailed).
+       * Do not mix with the GetNextSpot functions.
+       */
+      uint64_t GetNextSpots(std::vector<Column>& columns, uint64_t maxSpots);
+      /**
+       * Returns true when GetNextSpots or GetNextSpot(double*) stopped at a
+       * corrupt spot.  No more spots are returned after that
+       */
+      bool DecodeFailed() { return decodeFailed_; };
+      static bool IsFloatField(int fieldNumber);
+
+      /**
+       * Description of a Spot field (or extension) that can be extracted
+       */
+      struct FieldInfo
+      {
+         std::string name;
+         int number;
+         bool isFloat;
+         const google::protobuf::FieldDescriptor* fd;
+      };
+      static const std::vector<FieldInfo>& GetFieldTable();
+      static const FieldInfo* FindField(const std::string& name);
+
+      /**
+       * Building blocks of GetNextSpots, for use by decoders that obtain the 
+       * raw bytes of spots in other ways (see TSFParallelDecoder)
+       * DecodeSpot stores the spot in data/size in row "row" of the columns
+       * and merges overlay values for the given spot ordinal.  When filter 
+       * is not NULL, accepted is set to false for spots that do not pass 
+       * the filter, and the row is reset to 0.  Returns false when the spot
+       * could not be decoded
+       */
+      static std::vector<int> BuildLookup(const std::vector<Column>& columns);
+      static bool DecodeSpot(const uint8_t* data, int size, 
+            std::vector<Column>& columns, const std::vector<int>& lookup, 
+            uint64_t row, const std::vector<TSFOverlay*>& overlays, 
+            uint64_t ordinal, const Filter* filter = NULL, 
+            bool* accepted = NULL);
+      /**
+       * Returns the byte offset of the first spot in the file
+       */
+      uint64_t GetDataOffset() { return dataOffset_; };
+      std::vector<TSFOverlay*> GetOverlays() { return overlays_; };
+
+      /**
+       * Skips the next n spots without decoding them.  Returns false when
+       * the end of the file was reached before n spots were skipped
+       */
+      bool SkipSpots(uint64_t n);
+      /**
+       * Returns the (0-based) ordinal of the spot that will be returned next
+       * (0 for a file without spots)
+       */
+      uint64_t GetPosition() { return firstSpot_ && spotOrdinal_ > 0 ?
+            spotOrdinal_ - 1 : spotOrdinal_; };
+
       TSF::Spot GetNextSpot();
+
+      /**
+       * Reads the next spot into spot, without copying.  Returns false 
+       * after the last spot.  Does not apply the filter.
+       */
+      bool NextSpot(TSF::Spot* spot);
+      /**
+       * The spots that have not been read yet, limited to those accepted
+       * by the filter (see TSFSpotIterator.h)
+       */
+      TSFSpotRange<TSFParser> Spots()
+      {
+         TSFSpotRange<TSFParser> range(this);
+         return filter_.IsActive() ? range.Where(filter_) : range;
+      };
+      /**
+       * Points view to the raw bytes of the next spot, without decoding 
+       * them (see TSFSpotView).  Returns false after the last spot.  Does 
+       * not apply the filter.  The view is valid until the next spot is read.
+       */
+      bool NextSpotView(TSFSpotView* view);
       TSF::SpotList GetSpotList() { return spotList_; };
       uint64_t GetNrSpotsFromSpotList();
 
    private:
       bool NextSpot();
+      bool ReadRecord();
       bool checkFields(std::vector<std::string> requestedFields);
 
       bool initialized_;
       bool firstSpot_;
-      std::map<std::string, int> fieldMap_;
-      typedef bool (TSF::Spot::*has_function)() const;
-      std::map<int, has_function> fieldFunctionMap_;
+      bool decodeFailed_;
       TSF::SpotList spotList_;
       TSF::Spot spot_;
       std::string buffer_;
@@ -49,7 +185,15 @@ class TSFParser
       std::vector<std::string> fields_;
       std::vector<std::string> requestedFields_;
       std::vector<int> fieldsNumeric_;
+      std::vector<Column> doubleColumns_;
+      std::vector<int> doubleLookup_;
+      Filter filter_;
+      std::vector<TSFOverlay*> overlays_;
+      uint64_t spotOrdinal_;
+      uint64_t dataOffset_;
       google::protobuf::io::IstreamInputStream* input_;
       google::protobuf::io::CodedInputStream* codedInput_;
 
 };
+
+#endif
@@ -5,114 +5,644 @@
  *
  * License: BSD-clause3: http://www.opensource.org/licenses/BSD-3-Clause
  *
+ * Build from within matlab with:
+ * mex mextsf.cpp TSFParser.cpp TSFParallelDecoder.cpp ../../tsfutil/TSFUtils.cpp
+ *     ../../tsfutil/TSFOverlay.cpp ../../tsfutil/TSFMetrics.cpp 
+ *     ../../tsfutil/TSFTrace.cpp ../../tsfutil/TSFSpotView.cpp 
+ *     ../../tsfutil/TSFThreadPool.cpp ../../tsfutil/TSFRecords.cpp
+ *     ../../buildcpp/TSFProto.pb.cc 
+ *     -lprotobuf -lpthread
+ * Add ../../buildcpp/MMLocM.pb.cc (see tsfutil/Makefile) to make the MMLocM 
+ * extension fields (intensity_aperture, m_sigma, etc..) available
+ *
  */
 
 #include "mex.h"
 #include <stdint.h>
 #include <vector>
+#include <map>
 #include <fstream>
 #include <sstream>
 #include "TSFParser.h"
+#include "TSFParallelDecoder.h"
 #include "../../buildcpp/TSFProto.pb.h"
 #include <google/protobuf/message.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 
 
 
+// Nr of spots decoded per batch when the total nr of spots is not known
+static const uint64_t BATCHSIZE = 65536;
+// Nr of spots allocated before the output buffers are grown (doubled)
+static const uint64_t INITIALCAPACITY = 262144;
+
+static const std::string ourName = "mextsf";
+
+
 /**
- * Matlab Gateway function for mextsf 
- * Two inputs:
- * filename - path to TSF proto data
- * Array with requested field names - 
- *
- * Two outputs will be provided:
- * Array with field names (not all requested fields may be present)
- * Array with data
+ * State of a file opened with mextsf('open', ...), kept alive between calls
  */
-void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+struct TSFHandle
 {
-   const std::string ourName = "mextsf";
-   char *fileName[1];
-   std::vector<std::string> fieldNames; 
-   mxArray *tmp;
+   std::string fileName;
+   std::vector<std::string> requestedFields;
+   std::vector<std::string> fieldsFound;
+   bool structOutput;
+   TSFParser::Filter filter;
+   std::ifstream* ifs;
+   std::vector<TSFOverlay*> overlays;
+   TSFParser* parser;
+};
 
-   if (nrhs < 2) {
-       mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", 
-             (ourName + " requires two input arguments.").c_str());
+static std::map<int, TSFHandle*> handles;
+static int nextHandle = 1;
+
+
+static std::string getString(const mxArray* arg, const std::string& msg)
+{
+   if (arg == NULL || !mxIsChar(arg)) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", (ourName + ": " + msg).c_str());
    }
-   if (nlhs != 2) {
-      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargout",
-            (ourName + " requires two output arguments.").c_str());
+   char* str = mxArrayToString(arg);
+   std::string result(str);
+   mxFree(str);
+   return result;
+}
+
+static std::vector<std::string> getFieldNames(const mxArray* arg)
+{
+   if(!mxIsCell(arg)) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + ": Field names should be a cell array.").c_str());
    }
 
-   // Get first input: fileName
-   if (!mxIsChar(prhs[0])) {
+   std::vector<std::string> fieldNames;
+   mwSize NStructElems = mxGetNumberOfElements(arg);
+   for (mwSize i = 0; i < NStructElems; i++) {
+      mxArray* tmp = mxGetCell(arg, i);
+      if (tmp != NULL && mxIsChar(tmp)) {
+         fieldNames.push_back(getString(tmp, ""));
+      }
+   }
+   return fieldNames;
+}
+
+static bool getStructOutput(int nrhs, const mxArray *prhs[], int index)
+{
+   if (nrhs <= index)
+      return false;
+   std::string outputMode = getString(prhs[index],
+         "Output mode should be 'matrix' or 'struct'.");
+   if (outputMode == "struct")
+      return true;
+   if (outputMode != "matrix")
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + ": Output mode should be 'matrix' or 'struct'.").c_str());
+   return false;
+}
+
+/**
+ * Reads the optional spot selection, a struct with any of the fields:
+ * frames   - [first last], 1-based and inclusive
+ * channels - vector with the channels to be returned
+ * box      - [xmin xmax ymin ymax], in the units of x and y in the file
+ */
+static TSFParser::Filter getFilter(int nrhs, const mxArray *prhs[], int index)
+{
+   TSFParser::Filter filter;
+   if (nrhs <= index || mxIsEmpty(prhs[index]))
+      return filter;
+   if (!mxIsStruct(prhs[index])) {
       mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
-            (ourName + "First input should be path to input file.").c_str());
+            (ourName + ": Selection should be a struct with fields frames, channels and/or box.").c_str());
    }
-   fileName[0] =  mxArrayToString(prhs[0]);
 
-   std::ifstream ifs (fileName[0]);
+   mxArray* frames = mxGetField(prhs[index], 0, "frames");
+   if (frames != NULL && !mxIsEmpty(frames)) {
+      if (!mxIsDouble(frames) || mxGetNumberOfElements(frames) != 2) {
+         mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+               (ourName + ": frames should be [first last].").c_str());
+      }
+      filter.firstFrame = (int32_t) mxGetPr(frames)[0];
+      filter.lastFrame = (int32_t) mxGetPr(frames)[1];
+   }
 
-   if (ifs == 0 || ifs.fail()) {
-      std::string msg = "Failed to open file.";
-      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", msg.c_str());
+   mxArray* channels = mxGetField(prhs[index], 0, "channels");
+   if (channels != NULL && !mxIsEmpty(channels)) {
+      if (!mxIsDouble(channels)) {
+         mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+               (ourName + ": channels should be a vector of numbers.").c_str());
+      }
+      for (mwSize i = 0; i < mxGetNumberOfElements(channels); i++)
+         filter.channels.push_back((int32_t) mxGetPr(channels)[i]);
    }
 
-   // Get second input: cell array of fieldNames
-   if(!mxIsCell(prhs[1])) {
-      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
-            (ourName + "Second input should be cell array of field names.").c_str());
+   mxArray* box = mxGetField(prhs[index], 0, "box");
+   if (box != NULL && !mxIsEmpty(box)) {
+      if (!mxIsDouble(box) || mxGetNumberOfElements(box) != 4) {
+         mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+               (ourName + ": box should be [xmin xmax ymin ymax].").c_str());
+      }
+      filter.useBox = true;
+      filter.minX = (float) mxGetPr(box)[0];
+      filter.maxX = (float) mxGetPr(box)[1];
+      filter.minY = (float) mxGetPr(box)[2];
+      filter.maxY = (float) mxGetPr(box)[3];
    }
+   return filter;
+}
 
-   mwSize NStructElems = mxGetNumberOfElements(prhs[1]);
-   for (mwSize i = 0; i < NStructElems; i++) {
-      tmp = mxGetFieldByNumber(prhs[1], 0, i);
-      if (tmp != NULL && mxIsChar(tmp)) {
-         fieldNames.push_back(mxArrayToString(tmp));
+static mxArray* createFieldNames(std::vector<std::string>& fieldsFound)
+{
+   mxArray* result = mxCreateCellMatrix(1, fieldsFound.size());
+   for (unsigned int i = 0; i < fieldsFound.size(); i++) {
+      mxSetCell(result, i, mxCreateString(fieldsFound[i].c_str()));
+   }
+   return result;
+}
+
+static void closeHandle(TSFHandle* h)
+{
+   delete h->parser;
+   for (std::vector<TSFOverlay*>::iterator it = h->overlays.begin();
+         it != h->overlays.end(); ++it) {
+      delete *it;
+   }
+   h->overlays.clear();
+   delete h->ifs;
+   h->parser = NULL;
+   h->ifs = NULL;
+}
+
+static void closeAllHandles(void)
+{
+   for (std::map<int, TSFHandle*>::iterator it = handles.begin();
+         it != handles.end(); ++it) {
+      closeHandle(it->second);
+      delete it->second;
+   }
+   handles.clear();
+}
+
+/**
+ * Called when the mex file is cleared, the worker threads should be gone
+ * before its code is unloaded
+ */
+static void cleanUp(void)
+{
+   closeAllHandles();
+   TSFThreadPool::Shutdown();
+}
+
+/**
+ * Opens the file, picks up sidecar overlays (e.g. cluster ids) stored
+ * next to it and creates the parser
+ * Returns false (with everything it opened closed again) when that fails.
+ * Does not raise the error itself: mexErrMsgIdAndTxt does not return, so
+ * the caller first needs to free what it allocated
+ */
+static bool openHandle(TSFHandle* h, std::string* errorId, std::string* error)
+{
+   h->ifs = new std::ifstream(h->fileName.c_str(), std::ios_base::in |
+         std::ios_base::binary);
+   h->parser = NULL;
+   if (h->ifs->fail()) {
+      closeHandle(h);
+      *errorId = "MATLAB:mexcpp:nargin";
+      *error = "Failed to open file.";
+      return false;
+   }
+
+   try {
+      for (std::vector<std::string>::iterator it = h->requestedFields.begin();
+            it != h->requestedFields.end(); ++it) {
+         if (TSFOverlay::Exists(h->fileName, *it))
+            h->overlays.push_back(new TSFOverlay(h->fileName, *it));
       }
+   } catch (TSFException& ex) {
+      closeHandle(h);
+      *errorId = "MATLAB:mexcpp:overlay";
+      *error = ex.getMessage();
+      return false;
    }
 
-   // Create parser object
-   TSFParser tsfP(&ifs, fieldNames);
+   h->parser = new TSFParser(h->ifs, h->requestedFields, h->overlays);
+   h->parser->SetFilter(h->filter);
+   h->fieldsFound = h->parser->GetFields();
+   return true;
+}
+
+static TSFHandle* getHandle(const mxArray* arg)
+{
+   if (arg == NULL || !mxIsNumeric(arg)) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + ": Second input should be a handle returned by open.").c_str());
+   }
+   std::map<int, TSFHandle*>::iterator it = handles.find((int) mxGetScalar(arg));
+   if (it == handles.end()) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:handle",
+            (ourName + ": Invalid or closed handle.").c_str());
+   }
+   return it->second;
+}
 
 
-   // Set first output argument (field names)
-   std::vector<std::string> fieldsFound = tsfP.GetFields();
-   plhs[0] = mxCreateCellMatrix(1, fieldsFound.size());
-   for (int i=0; i < fieldsFound.size(); i++) {
-      char *str[1];
-      str[0] = (char *) malloc(sizeof(fieldsFound[i].c_str()));
-      strcpy(str[0], fieldsFound[i].c_str());
-      mxSetCell(plhs[0], i, mxCreateCharMatrixFromStrings(1, (const char **) str));
+static std::vector<TSFParser::Column> createColumns(TSFParser& tsfP, bool asDouble)
+{
+   std::vector<int> numbers = tsfP.GetFieldNumbers();
+   std::vector<TSFParser::Column> columns(numbers.size());
+   for (unsigned int i = 0; i < numbers.size(); i++) {
+      columns[i].fieldNumber = numbers[i];
+      columns[i].isFloat = TSFParser::IsFloatField(numbers[i]);
+      columns[i].asDouble = asDouble;
+      columns[i].stride = asDouble ? numbers.size() : 1;
+      columns[i].data = NULL;
    }
+   return columns;
+}
 
-   uint64_t nrSpots = tsfP.GetNrSpotsFromSpotList();;
+/**
+ * Creates a 1x1 struct with one typed column vector (int32 or single) per
+ * field, filled directly by the columnar decoder of the parser
+ * Decodes at most maxSpots spots, or the remainder of the file when maxSpots
+ * is 0
+ */
+static mxArray* createColumnStruct(TSFParser& tsfP,
+      std::vector<std::string>& fieldsFound, uint64_t maxSpots)
+{
+   std::vector<const char*> names;
+   for (unsigned int i = 0; i < fieldsFound.size(); i++) {
+      names.push_back(fieldsFound[i].c_str());
+   }
+   std::vector<TSFParser::Column> columns = createColumns(tsfP, false);
+   mxArray* result = mxCreateStructMatrix(1, 1, names.size(),
+         names.size() > 0 ? &names[0] : NULL);
 
-   if (nrSpots > 0) {
-      // nrSpots known in advance, this is most efficient
-      plhs[1] = mxCreateNumericMatrix(fieldsFound.size(), nrSpots, mxDOUBLE_CLASS, mxREAL);
-      double * pointer = mxGetPr(plhs[1]);
-      for (uint64_t i=0; i < nrSpots; i++) {
-         tsfP.GetNextSpot(&pointer[i * fieldsFound.size()]);
+   if (maxSpots > 0) {
+      // decode straight into the Matlab arrays
+      std::vector<mxArray*> arrays;
+      for (unsigned int i = 0; i < columns.size(); i++) {
+         arrays.push_back(mxCreateNumericMatrix(maxSpots, 1,
+               columns[i].isFloat ? mxSINGLE_CLASS : mxINT32_CLASS, mxREAL));
+         columns[i].data = mxGetData(arrays[i]);
+      }
+      uint64_t n = tsfP.GetNextSpots(columns, maxSpots);
+      for (unsigned int i = 0; i < columns.size(); i++) {
+         mxSetM(arrays[i], n);
+         mxSetFieldByNumber(result, 0, i, arrays[i]);
       }
    } else {
-      // nrSpots is not known in advance.  This is less efficient
+      // nrSpots is not known in advance, decode in batches into buffers
+      // that grow geometrically, and hand those to Matlab without copying
+      std::vector<void*> buffers(columns.size());
+      uint64_t capacity = INITIALCAPACITY;
+      for (unsigned int i = 0; i < columns.size(); i++)
+         buffers[i] = mxMalloc(capacity * sizeof(int32_t));
+      uint64_t n = 0;
+      uint64_t read = 0;
+      do {
+         if (n + BATCHSIZE > capacity) {
+            capacity *= 2;
+            for (unsigned int i = 0; i < columns.size(); i++)
+               buffers[i] = mxRealloc(buffers[i], capacity * sizeof(int32_t));
+         }
+         for (unsigned int i = 0; i < columns.size(); i++) {
+            memset((int32_t*) buffers[i] + n, 0, BATCHSIZE * sizeof(int32_t));
+            columns[i].data = (int32_t*) buffers[i] + n;
+         }
+         read = tsfP.GetNextSpots(columns, BATCHSIZE);
+         n += read;
+      } while (read == BATCHSIZE);
+      for (unsigned int i = 0; i < columns.size(); i++) {
+         mxArray* array = mxCreateNumericMatrix(0, 0,
+               columns[i].isFloat ? mxSINGLE_CLASS : mxINT32_CLASS, mxREAL);
+         mxSetData(array, mxRealloc(buffers[i], (n > 0 ? n : 1) * sizeof(int32_t)));
+         mxSetM(array, n);
+         mxSetN(array, 1);
+         mxSetFieldByNumber(result, 0, i, array);
+      }
+   }
+
+   return result;
+}
+
+/**
+ * Creates a fields x nrSpots double matrix
+ * Decodes at most maxSpots spots, or the remainder of the file when maxSpots
+ * is 0
+ */
+static mxArray* createMatrix(TSFParser& tsfP, size_t nrFields, uint64_t maxSpots)
+{
+   if (maxSpots > 0) {
+      // nrSpots known in advance, this is most efficient
+      mxArray* result = mxCreateNumericMatrix(nrFields, maxSpots, mxDOUBLE_CLASS, mxREAL);
+      double * pointer = mxGetPr(result);
       uint64_t counter = 0;
-      std::vector<double*> p;
-      p.reserve(264000);
-      bool success = true;
-      while (success) {
-         p.push_back((double*) mxCalloc(fieldsFound.size(), sizeof(double)));
-         success = tsfP.GetNextSpot(p.back());
+      while (counter < maxSpots && tsfP.GetNextSpot(&pointer[counter * nrFields])) {
          counter++;
       }
-      plhs[1] = mxCreateNumericMatrix(fieldsFound.size(), counter, mxDOUBLE_CLASS, mxREAL);
-      double* output = mxGetPr(plhs[1]);
-      for (uint64_t i=0; i < counter; i++) {
-         memcpy(output + i * fieldsFound.size(), p[i], fieldsFound.size() * sizeof(double));
+      mxSetN(result, counter);
+      return result;
+   }
+
+   // nrSpots is not known in advance.  Grow a single buffer
+   // geometrically and hand it to Matlab without copying
+   size_t rowSize = nrFields > 0 ? nrFields : 1;
+   uint64_t capacity = INITIALCAPACITY;
+   uint64_t counter = 0;
+   double* buffer = (double*) mxMalloc(capacity * rowSize * sizeof(double));
+   while (tsfP.GetNextSpot(buffer + counter * rowSize)) {
+      counter++;
+      if (counter == capacity) {
+         capacity *= 2;
+         buffer = (double*) mxRealloc(buffer, capacity * rowSize * sizeof(double));
+      }
+   }
+   mxArray* result = mxCreateNumericMatrix(0, 0, mxDOUBLE_CLASS, mxREAL);
+   mxSetData(result, mxRealloc(buffer,
+            (counter > 0 ? counter : 1) * rowSize * sizeof(double)));
+   mxSetM(result, nrFields);
+   mxSetN(result, counter);
+   return result;
+}
+
+
+/**
+ * Decodes the whole file using nrThreads threads
+ * Returns NULL when the file could not be decoded this way, in which case 
+ * the serial decoder should be used
+ */
+static mxArray* decodeParallel(TSFHandle& h, int nrThreads)
+{
+   TSFParallelDecoder decoder(h.fileName, h.parser->GetDataOffset(),
+         h.overlays);
+   if (!decoder.IsOpen())
+      return NULL;
+
+   // the pre-scan gives the exact nr of spots, so the output can be 
+   // allocated once, before any decoding takes place
+   uint64_t nrSpots = decoder.Scan();
+   std::vector<TSFParser::Column> columns = createColumns(*h.parser, 
+         !h.structOutput);
+   bool filtered = h.filter.IsActive();
+   if (filtered) {
+      // only the selected spots are kept, and the output is allocated
+      // once their nr is known
+      decoder.SetFilter(h.filter);
+      if (!decoder.DecodeFiltered(columns, nrThreads, &nrSpots))
+         return NULL;
+   }
+   mxArray* result;
+   if (h.structOutput) {
+      std::vector<const char*> names;
+      for (unsigned int i = 0; i < h.fieldsFound.size(); i++) {
+         names.push_back(h.fieldsFound[i].c_str());
+      }
+      result = mxCreateStructMatrix(1, 1, names.size(),
+            names.size() > 0 ? &names[0] : NULL);
+      for (unsigned int i = 0; i < columns.size(); i++) {
+         mxArray* array = mxCreateNumericMatrix(nrSpots, 1,
+               columns[i].isFloat ? mxSINGLE_CLASS : mxINT32_CLASS, mxREAL);
+         columns[i].data = mxGetData(array);
+         mxSetFieldByNumber(result, 0, i, array);
       }
-      // TODO: mirror the array
+   } else {
+      result = mxCreateNumericMatrix(columns.size(), nrSpots, mxDOUBLE_CLASS, mxREAL);
+      for (unsigned int i = 0; i < columns.size(); i++) {
+         columns[i].data = mxGetPr(result) + i;
+      }
+   }
+
+   if (filtered) {
+      decoder.CopyFiltered(columns);
+   } else if (!decoder.Decode(columns, nrThreads)) {
+      mxDestroyArray(result);
+      return NULL;
+   }
+   return result;
+}
+
+
+/**
+ * h = mextsf('open', filename, fields, mode, selection)
+ * Keeps the file open between calls.  Returns a handle and the
+ * field names found in the file.  Reads only return spots in selection
+ */
+static void openCommand(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+   if (nrhs < 3) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + " open requires a file name and field names.").c_str());
+   }
+
+   // the inputs are checked (which can raise errors) before the handle
+   // is allocated
+   std::string fileName = getString(prhs[1], "Second input should be path to input file.");
+   std::vector<std::string> requestedFields = getFieldNames(prhs[2]);
+   bool structOutput = getStructOutput(nrhs, prhs, 3);
+   TSFParser::Filter filter = getFilter(nrhs, prhs, 4);
+
+   TSFHandle* h = new TSFHandle();
+   h->fileName = fileName;
+   h->requestedFields = requestedFields;
+   h->structOutput = structOutput;
+   h->filter = filter;
+   std::string errorId, error;
+   if (!openHandle(h, &errorId, &error)) {
+      delete h;
+      mexErrMsgIdAndTxt(errorId.c_str(), error.c_str());
+   }
+
+   int id = nextHandle++;
+   handles[id] = h;
+
+   plhs[0] = mxCreateDoubleScalar(id);
+   if (nlhs > 1)
+      plhs[1] = createFieldNames(h->fieldsFound);
+}
+
+/**
+ * data = mextsf('read', h, n)
+ * Reads the next n spots (fewer at the end of the file)
+ */
+static void readCommand(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+   if (nrhs < 3) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + " read requires a handle and the nr of spots.").c_str());
+   }
+   TSFHandle* h = getHandle(prhs[1]);
+   double n = mxGetScalar(prhs[2]);
+   if (n < 1) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + " read: nr of spots should be at least 1.").c_str());
+   }
+
+   if (h->structOutput)
+      plhs[0] = createColumnStruct(*h->parser, h->fieldsFound, (uint64_t) n);
+   else
+      plhs[0] = createMatrix(*h->parser, h->fieldsFound.size(), (uint64_t) n);
+   if (h->parser->DecodeFailed()) {
+      mxDestroyArray(plhs[0]);
+      plhs[0] = NULL;
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:decode",
+            (ourName + " read: Failed to decode spot data.").c_str());
+   }
+}
+
+/**
+ * mextsf('seek', h, spot)
+ * Positions the handle such that the next read starts at spot (1-based)
+ * Seeking backwards reopens the file.  Seeking beyond the last spot is an
+ * error (seeking to the spot after the last one is allowed)
+ */
+static void seekCommand(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+   if (nrhs < 3) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + " seek requires a handle and a spot number.").c_str());
+   }
+   TSFHandle* h = getHandle(prhs[1]);
+   double spot = mxGetScalar(prhs[2]);
+   if (spot < 1) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + " seek: spot numbers start at 1.").c_str());
+   }
+   uint64_t target = (uint64_t) spot - 1;
+
+   if (target < h->parser->GetPosition()) {
+      closeHandle(h);
+      std::string errorId, error;
+      if (!openHandle(h, &errorId, &error)) {
+         // the handle can not be used anymore
+         handles.erase((int) mxGetScalar(prhs[1]));
+         delete h;
+         mexErrMsgIdAndTxt(errorId.c_str(), error.c_str());
+      }
+   }
+   if (!h->parser->SkipSpots(target - h->parser->GetPosition())) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + " seek: spot is beyond the last spot.").c_str());
+   }
+}
+
+/**
+ * mextsf('close', h)
+ */
+static void closeCommand(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+   if (nrhs < 2) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+            (ourName + " close requires a handle.").c_str());
+   }
+   TSFHandle* h = getHandle(prhs[1]);
+   handles.erase((int) mxGetScalar(prhs[1]));
+   closeHandle(h);
+   delete h;
+}
+
+
+/**
+ * Matlab Gateway function for mextsf
+ * Two to five inputs:
+ * filename - path to TSF proto data
+ * Array with requested field names -
+ * Optional output mode - 'matrix' (default) or 'struct'
+ * Optional nr of threads used to decode the file - default is the nr of 
+ *    threads of the shared thread pool (the nr of processors, unless the
+ *    environment variable TSF_NUM_THREADS is set when the mex file is 
+ *    loaded), 1 decodes in the calling thread only
+ * Optional selection - struct with any of the fields frames ([first last]),
+ *    channels (vector) and box ([xmin xmax ymin ymax]).  Only spots within
+ *    the selection are returned.  Spots are selected while decoding, so
+ *    memory is only used for the selected spots
+ *
+ * Two outputs will be provided:
+ * Array with field names (not all requested fields may be present)
+ * Data, either as a fields x nrSpots double matrix ('matrix'), or as a
+ * struct with one column vector per field ('struct').  Columns are int32 for
+ * integer fields (frame, channel, molecule, etc..) and single for the others.
+ *
+ * Files that do not fit in memory can be read in parts using a handle:
+ * [h, fields] = mextsf('open', filename, fieldnames, mode, selection)
+ * data = mextsf('read', h, n)  - next n spots, empty at the end of the file
+ * mextsf('seek', h, spot)      - next read starts at spot (1-based)
+ * mextsf('close', h)
+ */
+void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+   mexAtExit(cleanUp);
+
+   if (nrhs >= 1 && mxIsChar(prhs[0])) {
+      std::string command = getString(prhs[0], "");
+      if (command == "open") {
+         openCommand(nlhs, plhs, nrhs, prhs);
+         return;
+      } else if (command == "read") {
+         readCommand(nlhs, plhs, nrhs, prhs);
+         return;
+      } else if (command == "seek") {
+         seekCommand(nlhs, plhs, nrhs, prhs);
+         return;
+      } else if (command == "close") {
+         closeCommand(nlhs, plhs, nrhs, prhs);
+         return;
+      }
+   }
+
+   if (nrhs < 2) {
+       mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+             (ourName + " requires two input arguments.").c_str());
+   }
+   if (nlhs != 2) {
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:nargout",
+            (ourName + " requires two output arguments.").c_str());
+   }
+
+   TSFHandle h;
+   h.fileName = getString(prhs[0], "First input should be path to input file.");
+   h.requestedFields = getFieldNames(prhs[1]);
+   h.structOutput = getStructOutput(nrhs, prhs, 2);
+   int nrThreads = TSFParallelDecoder::GetNrProcessors();
+   if (nrhs > 3) {
+      if (!mxIsNumeric(prhs[3]) || mxGetScalar(prhs[3]) < 1) {
+         mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin",
+               (ourName + ": Nr of threads should be a number >= 1.").c_str());
+      }
+      nrThreads = (int) mxGetScalar(prhs[3]);
+   }
+   h.filter = getFilter(nrhs, prhs, 4);
+   std::string errorId, error;
+   if (!openHandle(&h, &errorId, &error)) {
+      mexErrMsgIdAndTxt(errorId.c_str(), error.c_str());
+   }
+
+   // Set first output argument (field names)
+   plhs[0] = createFieldNames(h.fieldsFound);
+
+   // with a selection the nr of spots returned is not known in advance
+   uint64_t nrSpots = h.filter.IsActive() ? 0 : 
+      h.parser->GetNrSpotsFromSpotList();
+
+   plhs[1] = NULL;
+   if (nrThreads > 1)
+      plhs[1] = decodeParallel(h, nrThreads);
+   if (plhs[1] == NULL) {
+      if (h.structOutput)
+         plhs[1] = createColumnStruct(*h.parser, h.fieldsFound, nrSpots);
+      else
+         plhs[1] = createMatrix(*h.parser, h.fieldsFound.size(), nrSpots);
+   }
+
+   // a corrupt spot makes the parallel decoder give up as well, so both
+   // ways of reading the file end up here
+   bool failed = h.parser->DecodeFailed();
+   closeHandle(&h);
+   if (failed) {
+      mxDestroyArray(plhs[1]);
+      plhs[1] = NULL;
+      mexErrMsgIdAndTxt("MATLAB:mexcpp:decode",
+            (ourName + ": Failed to decode spot data.").c_str());
    }
 
    /* useful to print state of variables
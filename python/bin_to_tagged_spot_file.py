@@ -11,11 +11,18 @@ import struct
 import sys
 
 import google.protobuf.internal.encoder as encoder
+import numpy
 
 import sa_library.datareader as datareader
 import sa_library.readinsight3 as readinsight3
 import TSFProto_pb2
 
+# The C++ writer (see setup.py) is much faster than encoding spots in Python.
+try:
+    import tsfio
+except ImportError:
+    tsfio = None
+
 if (len(sys.argv)!=5):
     print "usage: <dax file> <bin file> <tsf file> <pixel size (nm)>"
     exit()
@@ -30,9 +37,12 @@ def setV(fp, format, value):
 
 pix_to_nm = float(sys.argv[4])
 
-tsf_file = open(sys.argv[3], "wb")
-setV(tsf_file, "I", 0)
-setV(tsf_file, ">Q", 0)
+if tsfio:
+    tsf_writer = tsfio.Writer(sys.argv[3])
+else:
+    tsf_file = open(sys.argv[3], "wb")
+    setV(tsf_file, "I", 0)
+    setV(tsf_file, ">Q", 0)
 
 # Save Spot(s).
 i3_reader = readinsight3.I3Reader(sys.argv[2])
@@ -45,14 +55,37 @@ while (type(i3_block) != type(False)):
 
     print " saving localization", localization_number
 
+    for channel in numpy.unique(i3_block['c']):
+        if not int(channel) in channels:
+            channels.append(int(channel))
+
+    if tsfio:
+        n = len(i3_block)
+        tsf_writer.write({"molecule" : numpy.arange(localization_number, localization_number + n),
+                          "channel" : i3_block['c'],
+                          "frame" : i3_block['fr'],
+                          "slice" : numpy.ones(n),
+                          "pos" : numpy.ones(n),
+                          "x" : i3_block['xc']*pix_to_nm,
+                          "y" : i3_block['yc']*pix_to_nm,
+                          "z" : i3_block['zc'],
+                          "intensity" : i3_block['a'],
+                          "background" : i3_block['bg'],
+                          "width" : i3_block['w'],
+                          "a" : i3_block['ax'],
+                          "theta" : numpy.zeros(n),
+                          "x_original" : i3_block['x']*pix_to_nm,
+                          "y_original" : i3_block['y']*pix_to_nm,
+                          "z_original" : i3_block['z']})
+        localization_number += n
+        i3_block = i3_reader.nextBlock(block_size = 100000, good_only = False)
+        continue
+
     for i in range(len(i3_block)):
         spot = TSFProto_pb2.Spot()
 
         spot.molecule = localization_number
-        channel = int(i3_block['c'][i])
-        if not channel in channels:
-            channels.append(channel)
-        spot.channel = channel
+        spot.channel = int(i3_block['c'][i])
         spot.frame = int(i3_block['fr'][i])
 
         # These are always the same.
@@ -115,6 +148,11 @@ if os.path.exists(sys.argv[1]):
     spot_list.nr_pixels_y = y
     spot_list.nr_frames = l
 
+if tsfio:
+    # nr_spots is set by the writer
+    tsf_writer.close(spot_list)
+    exit()
+
 spot_list_offset = tsf_file.tell() - 12
 
 out = spot_list.SerializeToString()
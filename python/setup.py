@@ -0,0 +1,38 @@
+#!/usr/bin/python
+#
+# Builds the tsfio extension module (fast reading and writing of tsf files
+# from and to NumPy arrays).  Generate the C++ protobuf code first (see
+# ../protobuild), then:
+#
+#   python setup.py build_ext --inplace
+#
+# Add ../buildcpp/MMLocM.pb.cc (see tsfutil/Makefile) to the sources to make
+# the MMLocM extension fields (intensity_aperture, m_sigma, etc..) available.
+#
+
+import numpy
+
+try:
+    from setuptools import setup, Extension
+except ImportError:
+    from distutils.core import setup, Extension
+
+tsfio = Extension("tsfio",
+                  sources = ["tsfio.cpp",
+                             "../matlab/mex/TSFParser.cpp",
+                             "../tsfutil/TSFUtils.cpp",
+                             "../tsfutil/TSFOverlay.cpp",
+                             "../tsfutil/TSFMetrics.cpp",
+                             "../tsfutil/TSFTrace.cpp",
+                             "../tsfutil/TSFSpotView.cpp",
+                             "../tsfutil/TSFRecords.cpp",
+                             "../buildcpp/TSFProto.pb.cc"],
+                  include_dirs = [numpy.get_include()],
+                  libraries = ["protobuf"],
+                  extra_compile_args = ["-O2"])
+
+setup(name = "tsfio",
+      version = "1.0",
+      description = "Fast reading and writing of Tagged Spot Format files",
+      ext_modules = [tsfio])
+
@@ -0,0 +1,743 @@
+/**
+ * Python interface to Tagged Spot Format files
+ *
+ * Spots are decoded in C++ (using the columnar decoder of TSFParser) straight
+ * into NumPy arrays, one array per field, without creating a Python object
+ * per spot.  Writing works the other way around: spots are encoded from
+ * columns of values and written with TSFUtils.  Usage:
+ *
+ *    import tsfio
+ *    header = tsfio.read_header("data.tsf")
+ *    spots = tsfio.read("data.tsf", fields=["x", "y", "frame"],
+ *                       frames=(1, 1000), channels=[1])
+ *    spots["x"]   # numpy.float32 array, one value per spot
+ *
+ *    tsfio.write("out.tsf", spots, header)
+ *    # or, for data that do not fit in memory:
+ *    w = tsfio.Writer("out.tsf")
+ *    w.write(spots)    # as often as needed
+ *    w.close(header)   # header: dict, SpotList message or serialized SpotList
+ *
+ * Build with: python setup.py build_ext --inplace
+ */
+
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../tsfutil/TSFUtils.h"
+#include "../tsfutil/TSFRecords.h"
+#include "../matlab/mex/TSFParser.h"
+
+/**
+ * Selects the fields that will be returned.  Without a list of names, these
+ * are all fields present in the first spot
+ */
+static bool SelectFields(PyObject* names, const uint8_t* p, const uint8_t* end,
+      std::vector<const TSFParser::FieldInfo*>& selected)
+{
+   if (names == NULL || names == Py_None)
+   {
+      const uint8_t* record;
+      uint32_t size;
+      TSF::Spot spot;
+      if (TSFRecords::NextRecord(&p, end, &record, &size))
+         spot.ParseFromArray(record, size);
+      const google::protobuf::Reflection* sr = spot.GetReflection();
+      const std::vector<TSFParser::FieldInfo>& table = TSFParser::GetFieldTable();
+      for (unsigned int i = 0; i < table.size(); i++)
+      {
+         if (sr->HasField(spot, table[i].fd))
+            selected.push_back(&table[i]);
+      }
+      return true;
+   }
+
+   PyObject* seq = PySequence_Fast(names, "fields should be a list of field names");
+   if (seq == NULL)
+      return false;
+   for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++)
+   {
+      PyObject* item = PySequence_Fast_GET_ITEM(seq, i);
+      PyObject* bytes = PyUnicode_Check(item) ? PyUnicode_AsUTF8String(item) :
+         (Py_INCREF(item), item);
+      if (bytes == NULL || !PyBytes_Check(bytes))
+      {
+         Py_XDECREF(bytes);
+         Py_DECREF(seq);
+         PyErr_SetString(PyExc_TypeError, "field names should be strings");
+         return false;
+      }
+      std::string name(PyBytes_AS_STRING(bytes));
+      Py_DECREF(bytes);
+      const TSFParser::FieldInfo* info = TSFParser::FindField(name);
+      if (info == NULL)
+      {
+         Py_DECREF(seq);
+         PyErr_Format(PyExc_ValueError, "Unknown or unsupported field: %s",
+               name.c_str());
+         return false;
+      }
+      selected.push_back(info);
+   }
+   Py_DECREF(seq);
+   return true;
+}
+
+static bool GetFilter(PyObject* frames, PyObject* channels,
+      TSFParser::Filter* filter)
+{
+   if (frames != NULL && frames != Py_None)
+   {
+      int first, last;
+      PyObject* tuple = PySequence_Tuple(frames);
+      if (tuple == NULL)
+         return false;
+      bool ok = PyArg_ParseTuple(tuple, "ii;frames should be (first, last)",
+            &first, &last) != 0;
+      Py_DECREF(tuple);
+      if (!ok)
+         return false;
+      filter->firstFrame = first;
+      filter->lastFrame = last;
+   }
+   if (channels != NULL && channels != Py_None)
+   {
+      PyObject* seq = PySequence_Fast(channels, "channels should be a list of numbers");
+      if (seq == NULL)
+         return false;
+      for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++)
+      {
+         long channel = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+         if (channel == -1 && PyErr_Occurred())
+         {
+            Py_DECREF(seq);
+            return false;
+         }
+         filter->channels.push_back((int32_t) channel);
+      }
+      Py_DECREF(seq);
+   }
+   return true;
+}
+
+
+PyDoc_STRVAR(read_doc,
+"read(filename, fields=None, frames=None, channels=None)\n\n"
+"Returns a dict with one NumPy array per field (int32 for integer fields\n"
+"such as frame and channel, float32 for the others).  fields selects the\n"
+"fields to return (default: all fields present in the first spot), frames\n"
+"is an inclusive (first, last) range and channels a list of channels.\n"
+"Sidecar overlays (e.g. data.tsf.cluster.ovl) are applied.");
+
+static PyObject* tsfio_read(PyObject* self, PyObject* args, PyObject* kwds)
+{
+   static const char* kwlist[] = {"filename", "fields", "frames", "channels", NULL};
+   const char* fileName;
+   PyObject* names = NULL;
+   PyObject* frames = NULL;
+   PyObject* channels = NULL;
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|OOO", (char**) kwlist,
+            &fileName, &names, &frames, &channels))
+      return NULL;
+
+   TSFParser::Filter filter;
+   if (!GetFilter(frames, channels, &filter))
+      return NULL;
+
+   TSF::SpotList sl;
+   uint64_t offset;
+   try {
+      offset = TSFRecords::ReadHeader(fileName, &sl);
+   } catch (TSFException& ex) {
+      PyErr_SetString(PyExc_IOError, ex.getMessage().c_str());
+      return NULL;
+   }
+
+   TSFMappedFile file(fileName);
+   if (!file.IsOpen() || TSFRecords::SPOTSSTART + offset > file.GetSize())
+   {
+      PyErr_SetString(PyExc_IOError, "Failed to map the spot data of the file");
+      return NULL;
+   }
+   const uint8_t* begin = file.GetData() + TSFRecords::SPOTSSTART;
+   const uint8_t* end = begin + offset;
+
+   std::vector<const TSFParser::FieldInfo*> selected;
+   if (!SelectFields(names, begin, end, selected))
+      return NULL;
+
+   // count the spots, so that the arrays can be allocated once
+   npy_intp nrSpots = TSFRecords::CountRecords(begin, end);
+
+   std::vector<TSFOverlay*> overlays;
+   PyObject* result = PyDict_New();
+   std::vector<PyArrayObject*> arrays;
+   std::vector<TSFParser::Column> columns(selected.size());
+   try {
+      for (unsigned int i = 0; i < selected.size(); i++)
+      {
+         if (TSFOverlay::Exists(fileName, selected[i]->name))
+            overlays.push_back(new TSFOverlay(fileName, selected[i]->name));
+      }
+   } catch (TSFException& ex) {
+      for (unsigned int i = 0; i < overlays.size(); i++)
+         delete overlays[i];
+      Py_DECREF(result);
+      PyErr_SetString(PyExc_IOError, ex.getMessage().c_str());
+      return NULL;
+   }
+
+   for (unsigned int i = 0; i < selected.size(); i++)
+   {
+      PyArrayObject* array = (PyArrayObject*) PyArray_ZEROS(1, &nrSpots,
+            selected[i]->isFloat ? NPY_FLOAT32 : NPY_INT32, 0);
+      if (array == NULL)
+         break;
+      // the dict owns the array from here on
+      PyDict_SetItemString(result, selected[i]->name.c_str(), (PyObject*) array);
+      Py_DECREF(array);
+      arrays.push_back(array);
+      columns[i].fieldNumber = selected[i]->number;
+      columns[i].isFloat = selected[i]->isFloat;
+      columns[i].asDouble = false;
+      columns[i].stride = 1;
+      columns[i].data = PyArray_DATA(array);
+   }
+   if (arrays.size() != selected.size())
+   {
+      for (unsigned int i = 0; i < overlays.size(); i++)
+         delete overlays[i];
+      Py_DECREF(result);
+      return PyErr_NoMemory();
+   }
+
+   std::vector<int> lookup = TSFParser::BuildLookup(columns);
+   bool filtered = filter.IsActive();
+   npy_intp n = 0;
+   bool success = true;
+
+   Py_BEGIN_ALLOW_THREADS
+   const uint8_t* p = begin;
+   for (npy_intp ordinal = 0; ordinal < nrSpots; ordinal++)
+   {
+      const uint8_t* record;
+      uint32_t size;
+      bool accepted;
+      if (!TSFRecords::NextRecord(&p, end, &record, &size) ||
+            !TSFParser::DecodeSpot(record, size, columns, lookup, n, overlays,
+               ordinal, filtered ? &filter : NULL, &accepted))
+      {
+         success = false;
+         break;
+      }
+      if (accepted)
+         n++;
+   }
+   Py_END_ALLOW_THREADS
+
+   for (unsigned int i = 0; i < overlays.size(); i++)
+      delete overlays[i];
+
+   if (!success)
+   {
+      Py_DECREF(result);
+      PyErr_SetString(PyExc_IOError, "Failed to decode spot data");
+      return NULL;
+   }
+
+   if (n < nrSpots)
+   {
+      // shrink the arrays to the spots that passed the filter
+      PyArray_Dims dims = {&n, 1};
+      for (unsigned int i = 0; i < arrays.size(); i++)
+      {
+         PyObject* r = PyArray_Resize(arrays[i], &dims, 0, NPY_CORDER);
+         if (r == NULL)
+         {
+            Py_DECREF(result);
+            return NULL;
+         }
+         Py_DECREF(r);
+      }
+   }
+
+   return result;
+}
+
+
+PyDoc_STRVAR(read_header_doc,
+"read_header(filename)\n\n"
+"Returns the fields set in the SpotList of the file as a dict.  Enums are\n"
+"returned by name, repeated and message fields are not included.");
+
+static PyObject* tsfio_read_header(PyObject* self, PyObject* args)
+{
+   const char* fileName;
+   if (!PyArg_ParseTuple(args, "s", &fileName))
+      return NULL;
+
+   TSF::SpotList sl;
+   try {
+      TSFRecords::ReadHeader(fileName, &sl);
+   } catch (TSFException& ex) {
+      PyErr_SetString(PyExc_IOError, ex.getMessage().c_str());
+      return NULL;
+   }
+
+   PyObject* result = PyDict_New();
+   const google::protobuf::Descriptor* sld = sl.GetDescriptor();
+   const google::protobuf::Reflection* slr = sl.GetReflection();
+   for (int i = 0; i < sld->field_count(); i++)
+   {
+      const google::protobuf::FieldDescriptor* fd = sld->field(i);
+      if (fd->is_repeated() || !slr->HasField(sl, fd))
+         continue;
+      PyObject* val = NULL;
+      switch (fd->cpp_type())
+      {
+         case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+            val = PyLong_FromLong(slr->GetInt32(sl, fd));
+            break;
+         case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
+            val = PyLong_FromLongLong(slr->GetInt64(sl, fd));
+            break;
+         case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
+            val = PyLong_FromUnsignedLong(slr->GetUInt32(sl, fd));
+            break;
+         case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+            val = PyLong_FromUnsignedLongLong(slr->GetUInt64(sl, fd));
+            break;
+         case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+            val = PyFloat_FromDouble(slr->GetFloat(sl, fd));
+            break;
+         case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+            val = PyFloat_FromDouble(slr->GetDouble(sl, fd));
+            break;
+         case google::protobuf::FieldDescriptor::CPPTYPE_BOOL:
+            val = PyBool_FromLong(slr->GetBool(sl, fd));
+            break;
+         case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+            val = PyUnicode_FromString(slr->GetEnum(sl, fd)->name().c_str());
+            break;
+         case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+            val = PyUnicode_FromString(slr->GetString(sl, fd).c_str());
+            break;
+         default:
+            break;
+      }
+      if (val != NULL)
+      {
+         PyDict_SetItemString(result, fd->name().c_str(), val);
+         Py_DECREF(val);
+      }
+   }
+   return result;
+}
+
+
+/**
+ * The arrays hold the values of the columns, and are released together
+ */
+static void ReleaseColumns(std::vector<TSFRecords::Column>& columns,
+      std::vector<PyArrayObject*>& arrays)
+{
+   for (unsigned int i = 0; i < arrays.size(); i++)
+      Py_DECREF(arrays[i]);
+   arrays.clear();
+   columns.clear();
+}
+
+/**
+ * Converts a dict of field name -> array-like into contiguous int32 or
+ * float32 arrays of equal length.  All required Spot fields need to be
+ * present, except for molecule, which defaults to the ordinal of the spot
+ */
+static bool GetWriteColumns(PyObject* spots,
+      std::vector<TSFRecords::Column>& columns,
+      std::vector<PyArrayObject*>& arrays, npy_intp* nrSpots)
+{
+   if (!PyDict_Check(spots))
+   {
+      PyErr_SetString(PyExc_TypeError, "spots should be a dict of field name: array");
+      return false;
+   }
+
+   *nrSpots = -1;
+   PyObject* key;
+   PyObject* value;
+   Py_ssize_t pos = 0;
+   while (PyDict_Next(spots, &pos, &key, &value))
+   {
+      PyObject* bytes = PyUnicode_Check(key) ? PyUnicode_AsUTF8String(key) :
+         (Py_INCREF(key), key);
+      if (bytes == NULL || !PyBytes_Check(bytes))
+      {
+         Py_XDECREF(bytes);
+         ReleaseColumns(columns, arrays);
+         PyErr_SetString(PyExc_TypeError, "field names should be strings");
+         return false;
+      }
+      std::string name(PyBytes_AS_STRING(bytes));
+      Py_DECREF(bytes);
+      const TSFParser::FieldInfo* info = TSFParser::FindField(name);
+      if (info == NULL)
+      {
+         ReleaseColumns(columns, arrays);
+         PyErr_Format(PyExc_ValueError, "Unknown or unsupported field: %s",
+               name.c_str());
+         return false;
+      }
+
+      PyArrayObject* array = (PyArrayObject*) PyArray_FROMANY(value,
+            info->isFloat ? NPY_FLOAT32 : NPY_INT32, 1, 1,
+            NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+      if (array == NULL)
+      {
+         ReleaseColumns(columns, arrays);
+         return false;
+      }
+      arrays.push_back(array);
+      TSFRecords::Column column;
+      column.number = info->number;
+      column.isFloat = info->isFloat;
+      column.data = PyArray_DATA(array);
+      columns.push_back(column);
+
+      npy_intp n = PyArray_DIM(array, 0);
+      if (*nrSpots >= 0 && n != *nrSpots)
+      {
+         ReleaseColumns(columns, arrays);
+         PyErr_Format(PyExc_ValueError, "Field %s has a different length than the other fields",
+               name.c_str());
+         return false;
+      }
+      *nrSpots = n;
+   }
+
+   std::string missing;
+   if (!TSFRecords::CompleteColumns(columns, &missing))
+   {
+      ReleaseColumns(columns, arrays);
+      PyErr_Format(PyExc_ValueError, "Required field %s is missing",
+            missing.c_str());
+      return false;
+   }
+   if (*nrSpots < 0)
+      *nrSpots = 0;
+   return true;
+}
+
+/**
+ * Fills sl from a dict (field name: value), a SpotList message (anything
+ * with a SerializeToString method) or a serialized SpotList
+ */
+static bool GetSpotList(PyObject* header, TSF::SpotList* sl)
+{
+   if (header == NULL || header == Py_None)
+   {
+   } else if (PyDict_Check(header))
+   {
+      const google::protobuf::Descriptor* sld = sl->GetDescriptor();
+      const google::protobuf::Reflection* slr = sl->GetReflection();
+      PyObject* key;
+      PyObject* value;
+      Py_ssize_t pos = 0;
+      while (PyDict_Next(header, &pos, &key, &value))
+      {
+         PyObject* keyBytes = PyUnicode_Check(key) ? PyUnicode_AsUTF8String(key) :
+            (Py_INCREF(key), key);
+         PyObject* str = PyBool_Check(value) ? 
+            PyBytes_FromString(value == Py_True ? "1" : "0") : PyObject_Str(value);
+         PyObject* valBytes = str != NULL && PyUnicode_Check(str) ? 
+            PyUnicode_AsUTF8String(str) : (Py_XINCREF(str), str);
+         Py_XDECREF(str);
+         if (keyBytes == NULL || valBytes == NULL || !PyBytes_Check(keyBytes) ||
+               !PyBytes_Check(valBytes))
+         {
+            Py_XDECREF(keyBytes);
+            Py_XDECREF(valBytes);
+            if (!PyErr_Occurred())
+               PyErr_SetString(PyExc_TypeError, "header keys should be strings");
+            return false;
+         }
+         const google::protobuf::FieldDescriptor* fd = 
+            sld->FindFieldByName(PyBytes_AS_STRING(keyBytes));
+         if (fd == NULL || fd->is_repeated() || 
+               fd->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE)
+         {
+            PyErr_Format(PyExc_ValueError, "Unknown or unsupported header field: %s",
+                  PyBytes_AS_STRING(keyBytes));
+            Py_DECREF(keyBytes);
+            Py_DECREF(valBytes);
+            return false;
+         }
+         try {
+            TSFUtils::InsertByReflection(slr, sl, fd, PyBytes_AS_STRING(valBytes));
+         } catch (TSFException& ex) {
+            Py_DECREF(keyBytes);
+            Py_DECREF(valBytes);
+            PyErr_SetString(PyExc_ValueError, ex.getMessage().c_str());
+            return false;
+         }
+         Py_DECREF(keyBytes);
+         Py_DECREF(valBytes);
+      }
+   } else
+   {
+      PyObject* bytes;
+      if (PyBytes_Check(header))
+      {
+         Py_INCREF(header);
+         bytes = header;
+      } else 
+         bytes = PyObject_CallMethod(header, (char*) "SerializeToString", NULL);
+      if (bytes == NULL || !PyBytes_Check(bytes))
+      {
+         Py_XDECREF(bytes);
+         if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_TypeError, "header should be a dict or a SpotList");
+         return false;
+      }
+      bool ok = sl->ParseFromArray(PyBytes_AS_STRING(bytes), PyBytes_GET_SIZE(bytes));
+      Py_DECREF(bytes);
+      if (!ok)
+      {
+         PyErr_SetString(PyExc_ValueError, "Failed to parse the SpotList");
+         return false;
+      }
+   }
+
+   if (!sl->has_application_id())
+      sl->set_application_id(1);
+   return true;
+}
+
+
+typedef struct {
+   PyObject_HEAD
+   std::fstream* fs;
+   TSFUtils* tsf;
+   int64_t nrSpots;
+} WriterObject;
+
+static void Writer_release(WriterObject* self)
+{
+   delete self->tsf;
+   self->tsf = NULL;
+   delete self->fs;
+   self->fs = NULL;
+}
+
+static int Writer_init(WriterObject* self, PyObject* args, PyObject* kwds)
+{
+   static const char* kwlist[] = {"filename", NULL};
+   const char* fileName;
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", (char**) kwlist, &fileName))
+      return -1;
+
+   Writer_release(self);
+   self->nrSpots = 0;
+   self->fs = new std::fstream(fileName, std::ios_base::in | std::ios_base::out |
+         std::ios_base::trunc | std::ios_base::binary);
+   try {
+      self->tsf = new TSFUtils(self->fs, TSFUtils::WRITE);
+   } catch (TSFException& ex) {
+      Writer_release(self);
+      PyErr_SetString(PyExc_IOError, ex.getMessage().c_str());
+      return -1;
+   }
+   return 0;
+}
+
+static void Writer_dealloc(WriterObject* self)
+{
+   // without close(), the file has no SpotList and will not be readable
+   Writer_release(self);
+   Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+PyDoc_STRVAR(Writer_write_doc,
+"write(spots)\n\n"
+"Appends spots, given as a dict of field name: array (all of equal length).\n"
+"molecule defaults to the ordinal of the spot in the file.");
+
+static PyObject* Writer_write(WriterObject* self, PyObject* args)
+{
+   PyObject* spots;
+   if (!PyArg_ParseTuple(args, "O", &spots))
+      return NULL;
+   if (self->tsf == NULL)
+   {
+      PyErr_SetString(PyExc_ValueError, "Writer is closed");
+      return NULL;
+   }
+
+   std::vector<TSFRecords::Column> columns;
+   std::vector<PyArrayObject*> arrays;
+   npy_intp nrSpots;
+   if (!GetWriteColumns(spots, columns, arrays, &nrSpots))
+      return NULL;
+
+   std::vector<uint8_t> buf(columns.size() * TSFRecords::MAXFIELDBYTES + 1);
+   std::string error;
+   Py_BEGIN_ALLOW_THREADS
+   try {
+      for (npy_intp i = 0; i < nrSpots; i++)
+      {
+         uint32_t size = TSFRecords::EncodeSpot(columns, i, self->nrSpots + i,
+               &buf[0]);
+         self->tsf->WriteSpotBinary(&buf[0], size);
+      }
+   } catch (TSFException& ex) {
+      error = ex.getMessage();
+   }
+   Py_END_ALLOW_THREADS
+   ReleaseColumns(columns, arrays);
+
+   if (!error.empty())
+   {
+      PyErr_SetString(PyExc_IOError, error.c_str());
+      return NULL;
+   }
+   self->nrSpots += nrSpots;
+   Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Writer_close_doc,
+"close(header=None)\n\n"
+"Writes the SpotList, with nr_spots set to the nr of spots written, and\n"
+"closes the file.  header is a dict (as returned by read_header), a\n"
+"TSFProto_pb2.SpotList or a serialized SpotList.");
+
+static PyObject* Writer_close(WriterObject* self, PyObject* args, PyObject* kwds)
+{
+   static const char* kwlist[] = {"header", NULL};
+   PyObject* header = NULL;
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", (char**) kwlist, &header))
+      return NULL;
+   if (self->tsf == NULL)
+   {
+      PyErr_SetString(PyExc_ValueError, "Writer is closed");
+      return NULL;
+   }
+
+   TSF::SpotList sl;
+   if (!GetSpotList(header, &sl))
+      return NULL;
+   sl.set_nr_spots(self->nrSpots);
+
+   try {
+      self->tsf->WriteHeaderBinary(&sl);
+   } catch (TSFException& ex) {
+      Writer_release(self);
+      PyErr_SetString(PyExc_IOError, ex.getMessage().c_str());
+      return NULL;
+   }
+   self->fs->close();
+   Writer_release(self);
+   Py_RETURN_NONE;
+}
+
+static PyMethodDef Writer_methods[] = {
+   {"write", (PyCFunction) Writer_write, METH_VARARGS, Writer_write_doc},
+   {"close", (PyCFunction) Writer_close, METH_VARARGS | METH_KEYWORDS, Writer_close_doc},
+   {NULL, NULL, 0, NULL}
+};
+
+PyDoc_STRVAR(Writer_doc,
+"Writer(filename)\n\n"
+"Writes a tsf file from columns of values.  Call write() as often as\n"
+"needed, followed by close().");
+
+static PyTypeObject WriterType = {
+   PyVarObject_HEAD_INIT(NULL, 0)
+   "tsfio.Writer",              /* tp_name */
+   sizeof(WriterObject),        /* tp_basicsize */
+};
+
+
+PyDoc_STRVAR(write_doc,
+"write(filename, spots, header=None)\n\n"
+"Writes spots (a dict of field name: array) and header to a new tsf file.\n"
+"See Writer for files that are too large to be written in one go.");
+
+static PyObject* tsfio_write(PyObject* self, PyObject* args, PyObject* kwds)
+{
+   static const char* kwlist[] = {"filename", "spots", "header", NULL};
+   const char* fileName;
+   PyObject* spots;
+   PyObject* header = NULL;
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "sO|O", (char**) kwlist,
+            &fileName, &spots, &header))
+      return NULL;
+
+   PyObject* writer = PyObject_CallFunction((PyObject*) &WriterType, 
+         (char*) "s", fileName);
+   if (writer == NULL)
+      return NULL;
+   PyObject* r = PyObject_CallMethod(writer, (char*) "write", (char*) "(O)", spots);
+   if (r != NULL)
+   {
+      Py_DECREF(r);
+      r = header != NULL ? 
+         PyObject_CallMethod(writer, (char*) "close", (char*) "(O)", header) :
+         PyObject_CallMethod(writer, (char*) "close", NULL);
+   }
+   Py_DECREF(writer);
+   return r;
+}
+
+
+static PyMethodDef tsfioMethods[] = {
+   {"read", (PyCFunction) tsfio_read, METH_VARARGS | METH_KEYWORDS, read_doc},
+   {"read_header", tsfio_read_header, METH_VARARGS, read_header_doc},
+   {"write", (PyCFunction) tsfio_write, METH_VARARGS | METH_KEYWORDS, write_doc},
+   {NULL, NULL, 0, NULL}
+};
+
+PyDoc_STRVAR(module_doc, "Fast reading and writing of Tagged Spot Format (.tsf) files");
+
+static bool InitWriterType()
+{
+   WriterType.tp_flags = Py_TPFLAGS_DEFAULT;
+   WriterType.tp_doc = Writer_doc;
+   WriterType.tp_methods = Writer_methods;
+   WriterType.tp_init = (initproc) Writer_init;
+   WriterType.tp_dealloc = (destructor) Writer_dealloc;
+   WriterType.tp_new = PyType_GenericNew;
+   return PyType_Ready(&WriterType) == 0;
+}
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef tsfioModule = {
+   PyModuleDef_HEAD_INIT, "tsfio", module_doc, -1, tsfioMethods
+};
+
+PyMODINIT_FUNC PyInit_tsfio(void)
+{
+   import_array();
+   if (!InitWriterType())
+      return NULL;
+   PyObject* module = PyModule_Create(&tsfioModule);
+   if (module == NULL)
+      return NULL;
+   Py_INCREF(&WriterType);
+   PyModule_AddObject(module, "Writer", (PyObject*) &WriterType);
+   return module;
+}
+#else
+PyMODINIT_FUNC inittsfio(void)
+{
+   PyObject* module = Py_InitModule3("tsfio", tsfioMethods, module_doc);
+   import_array();
+   if (module == NULL || !InitWriterType())
+      return;
+   Py_INCREF(&WriterType);
+   PyModule_AddObject(module, "Writer", (PyObject*) &WriterType);
+}
+#endif
@@ -0,0 +1,236 @@
+/**
+ * Reads batches of spots from a TSFUtils in a background thread
+ *
+ * The batches form a ring.  The background thread fills the next empty
+ * batch with GetSpotsBinary and the caller holds on to the batch it was
+ * given until it asks for the next one, at which point it is handed back
+ * to the background thread.  The Spot messages of a batch are reused, so
+ * that no memory is allocated once all batches have been filled.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "TSFBatchReader.h"
+#include "TSFTrace.h"
+
+
+TSFBatchReader::TSFBatchReader(TSFUtils* source, uint32_t batchSize,
+      int depth) throw (TSFException) :
+   source_(source),
+   batchSize_(batchSize > 0 ? batchSize : 1),
+   batches_(depth > 0 ? depth : 1),
+   readIndex_(0),
+   writeIndex_(0),
+   nrFull_(0),
+   holding_(false),
+   done_(false),
+   stop_(false),
+   failed_(false),
+   spotIndex_(0),
+   spotCount_(0),
+   current_(NULL),
+   signaled_(false)
+{
+   if (pipe(readyPipe_) != 0)
+      throw TSFException("Failed to create the pipe of TSFBatchReader");
+   fcntl(readyPipe_[0], F_SETFL, O_NONBLOCK);
+   fcntl(readyPipe_[1], F_SETFL, O_NONBLOCK);
+
+   pthread_mutex_init(&mutex_, NULL);
+   pthread_cond_init(&filled_, NULL);
+   pthread_cond_init(&emptied_, NULL);
+   if (pthread_create(&thread_, NULL, PrefetchThread, this) != 0)
+   {
+      close(readyPipe_[0]);
+      close(readyPipe_[1]);
+      pthread_cond_destroy(&emptied_);
+      pthread_cond_destroy(&filled_);
+      pthread_mutex_destroy(&mutex_);
+      throw TSFException("Failed to start the thread of TSFBatchReader");
+   }
+}
+
+TSFBatchReader::~TSFBatchReader()
+{
+   pthread_mutex_lock(&mutex_);
+   stop_ = true;
+   pthread_cond_signal(&emptied_);
+   pthread_mutex_unlock(&mutex_);
+   pthread_join(thread_, NULL);
+
+   close(readyPipe_[0]);
+   close(readyPipe_[1]);
+   pthread_cond_destroy(&emptied_);
+   pthread_cond_destroy(&filled_);
+   pthread_mutex_destroy(&mutex_);
+}
+
+void* TSFBatchReader::PrefetchThread(void* arg)
+{
+   TSFTrace::SetThreadName("prefetch");
+   ((TSFBatchReader*) arg)->Prefetch();
+   return NULL;
+}
+
+void TSFBatchReader::Prefetch()
+{
+   pthread_mutex_lock(&mutex_);
+   while (true)
+   {
+      while (!stop_ && nrFull_ + (holding_ ? 1 : 0) >= batches_.size())
+         pthread_cond_wait(&emptied_, &mutex_);
+      if (stop_)
+         break;
+
+      // the batch at writeIndex_ is neither full nor held by the caller
+      Batch& batch = batches_[writeIndex_];
+      pthread_mutex_unlock(&mutex_);
+      uint32_t n = 0;
+      std::string error;
+      bool failed = false;
+      try {
+         n = source_->GetSpotsBinary(batch.spots, batchSize_);
+      } catch (TSFException& ex) {
+         error = ex.getMessage();
+         failed = true;
+      }
+      pthread_mutex_lock(&mutex_);
+
+      if (failed)
+      {
+         failed_ = true;
+         error_ = error;
+      }
+      else if (n == 0)
+         done_ = true;
+      else
+      {
+         batch.n = n;
+         writeIndex_ = (writeIndex_ + 1) % batches_.size();
+         nrFull_++;
+      }
+      UpdateReadyFd();
+      pthread_cond_signal(&filled_);
+      if (failed_ || done_)
+         break;
+   }
+   pthread_mutex_unlock(&mutex_);
+}
+
+/**
+ * The following functions should be called with mutex_ held
+ */
+bool TSFBatchReader::IsReady()
+{
+   return nrFull_ > 0 || done_ || failed_;
+}
+
+void TSFBatchReader::UpdateReadyFd()
+{
+   bool ready = IsReady();
+   if (ready && !signaled_)
+   {
+      char c = 0;
+      if (write(readyPipe_[1], &c, 1) == 1)
+         signaled_ = true;
+   }
+   else if (!ready && signaled_)
+   {
+      char c;
+      if (read(readyPipe_[0], &c, 1) == 1)
+         signaled_ = false;
+   }
+}
+
+/**
+ * Hands the batch held by the caller back to the background thread
+ */
+void TSFBatchReader::Release()
+{
+   if (!holding_)
+      return;
+   holding_ = false;
+   current_ = NULL;
+   pthread_cond_signal(&emptied_);
+}
+
+void TSFBatchReader::Take(const std::vector<TSF::Spot>** spots, uint32_t* n)
+{
+   if (nrFull_ > 0)
+   {
+      Batch& batch = batches_[readIndex_];
+      readIndex_ = (readIndex_ + 1) % batches_.size();
+      nrFull_--;
+      holding_ = true;
+      current_ = &batch.spots;
+      *spots = &batch.spots;
+      *n = batch.n;
+   }
+   else
+   {
+      // done_, the last batch was taken
+      *spots = NULL;
+      *n = 0;
+   }
+   UpdateReadyFd();
+}
+
+uint32_t TSFBatchReader::Next(const std::vector<TSF::Spot>** spots)
+   throw (TSFException)
+{
+   pthread_mutex_lock(&mutex_);
+   Release();
+   while (!IsReady())
+      pthread_cond_wait(&filled_, &mutex_);
+   if (nrFull_ == 0 && failed_)
+   {
+      std::string error = error_;
+      pthread_mutex_unlock(&mutex_);
+      throw TSFException(error);
+   }
+   uint32_t n;
+   Take(spots, &n);
+   pthread_mutex_unlock(&mutex_);
+   return n;
+}
+
+bool TSFBatchReader::TryNext(const std::vector<TSF::Spot>** spots,
+      uint32_t* n) throw (TSFException)
+{
+   pthread_mutex_lock(&mutex_);
+   Release();
+   if (!IsReady())
+   {
+      pthread_mutex_unlock(&mutex_);
+      return false;
+   }
+   if (nrFull_ == 0 && failed_)
+   {
+      std::string error = error_;
+      pthread_mutex_unlock(&mutex_);
+      throw TSFException(error);
+   }
+   Take(spots, n);
+   pthread_mutex_unlock(&mutex_);
+   return true;
+}
+
+/**
+ * Swaps the next spot of the held batch into spot, moving on to the next
+ * batch when needed (the batch is parsed again when it is refilled, so the
+ * old contents of spot do no harm).  Returns false after the last spot.
+ */
+bool TSFBatchReader::NextSpot(TSF::Spot* spot) throw (TSFException)
+{
+   if (current_ == NULL || spotIndex_ >= spotCount_)
+   {
+      const std::vector<TSF::Spot>* spots;
+      spotCount_ = Next(&spots);
+      spotIndex_ = 0;
+      if (spotCount_ == 0)
+         return false;
+   }
+   spot->Swap(&(*current_)[spotIndex_++]);
+   return true;
+}
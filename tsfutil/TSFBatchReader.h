@@ -0,0 +1,115 @@
+/**
+ * Reads batches of spots from a TSFUtils in a background thread, so that
+ * reading and decoding the next batch overlaps with the processing of the
+ * current one
+ *
+ *    TSFBatchReader reader(tsfIn, 10000);
+ *    const std::vector<TSF::Spot>* spots;
+ *    uint32_t n;
+ *    while ((n = reader.Next(&spots)) > 0)
+ *       for (uint32_t i = 0; i < n; i++)
+ *          sum += (*spots)[i].x();
+ *
+ * Event loops (and coroutine schedulers built on them) can wait for
+ * GetReadyFd to become readable and then call TryNext, instead of blocking
+ * a thread in Next.
+ */
+
+#ifndef TSFBATCHREADER_H
+#define TSFBATCHREADER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../buildcpp/TSFProto.pb.h"
+#include "TSFException.h"
+#include "TSFUtils.h"
+#include "TSFSpotIterator.h"
+
+
+class TSFBatchReader
+{
+   public:
+      /**
+       * Starts reading from source, whose GetHeaderBinary should already
+       * have been called.  Up to depth batches of batchSize spots are read
+       * ahead.  The source is read from the background thread only, and
+       * should not be used by the caller until the reader is destroyed
+       */
+      TSFBatchReader(TSFUtils* source, uint32_t batchSize, int depth = 2)
+         throw (TSFException);
+      ~TSFBatchReader();
+
+      /**
+       * Waits for the next batch, sets spots to it and returns its nr of
+       * spots, or 0 after the last batch.  The batch stays valid until the
+       * next call to Next or TryNext.  Errors of the background thread are
+       * thrown here
+       */
+      uint32_t Next(const std::vector<TSF::Spot>** spots) throw (TSFException);
+
+      /**
+       * Like Next, but does not wait.  Returns false when the next batch is
+       * not ready yet, in which case spots and n are not set
+       */
+      bool TryNext(const std::vector<TSF::Spot>** spots, uint32_t* n)
+         throw (TSFException);
+
+      /**
+       * File descriptor that is readable while a call to TryNext would
+       * return true (i.e. a batch, the end of the spots or an error is
+       * available).  Owned by the reader
+       */
+      int GetReadyFd() { return readyPipe_[0]; };
+
+      /**
+       * Spot by spot access to the batches, see TSFSpotIterator.h.  Do not
+       * mix with Next and TryNext
+       */
+      bool NextSpot(TSF::Spot* spot) throw (TSFException);
+      TSFSpotRange<TSFBatchReader> Spots()
+      {
+         return TSFSpotRange<TSFBatchReader>(this);
+      };
+
+   private:
+      struct Batch
+      {
+         std::vector<TSF::Spot> spots;
+         uint32_t n;
+      };
+
+      static void* PrefetchThread(void* arg);
+      void Prefetch();
+      bool IsReady();
+      void Release();
+      void Take(const std::vector<TSF::Spot>** spots, uint32_t* n);
+      void UpdateReadyFd();
+
+      TSFUtils* source_;
+      uint32_t batchSize_;
+      std::vector<Batch> batches_;
+      // batches are filled and consumed in ring order
+      size_t readIndex_;
+      size_t writeIndex_;
+      size_t nrFull_;
+      bool holding_;
+      bool done_;
+      bool stop_;
+      bool failed_;
+      std::string error_;
+      // position in the held batch for NextSpot
+      uint32_t spotIndex_;
+      uint32_t spotCount_;
+      std::vector<TSF::Spot>* current_;
+      // one byte is in the pipe while the reader is ready
+      int readyPipe_[2];
+      bool signaled_;
+      pthread_t thread_;
+      pthread_mutex_t mutex_;
+      pthread_cond_t filled_;
+      pthread_cond_t emptied_;
+};
+
+#endif
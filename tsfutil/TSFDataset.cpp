@@ -0,0 +1,367 @@
+/**
+ * A set of tsf files that is read as a single collection of spots
+ *
+ * When a file is opened, its SpotList is read with TSFUtils, and a fast
+ * pass over the size prefixes of its spots counts them and records the
+ * byte offset of every BLOCKSPOTS-th spot.  The blocks are the units of
+ * work of Scan and make random access by ordinal cheap.
+ */
+
+#include <algorithm>
+#include <dirent.h>
+#include <glob.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "TSFDataset.h"
+#include "TSFRollingWriter.h"
+#include "TSFThreadPool.h"
+#include "TSFTrace.h"
+#include "TSFUtils.h"
+
+// Nr of spots in a block
+static const uint64_t BLOCKSPOTS = 16384;
+
+static bool EndsWith(const std::string& s, const std::string& suffix)
+{
+   return s.size() >= suffix.size() &&
+      s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+TSFDataset::TSFDataset() :
+   nrSpots_(0),
+   readFile_(0),
+   readOffset_(TSFRecords::SPOTSSTART),
+   readOrdinal_(0)
+{
+}
+
+TSFDataset::~TSFDataset()
+{
+   for (unsigned int i = 0; i < files_.size(); i++)
+   {
+      delete files_[i]->map;
+      for (unsigned int j = 0; j < files_[i]->overlays.size(); j++)
+         delete files_[i]->overlays[j];
+      delete files_[i];
+   }
+}
+
+TSFDataset* TSFDataset::Open(const std::string& path) throw (TSFException)
+{
+   std::vector<std::string> fileNames;
+   struct stat st;
+   if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+   {
+      DIR* dir = opendir(path.c_str());
+      if (dir == NULL)
+         throw TSFException("Failed to open directory " + path);
+      struct dirent* entry;
+      while ((entry = readdir(dir)) != NULL)
+      {
+         std::string name = entry->d_name;
+         if (EndsWith(name, ".tsf"))
+            fileNames.push_back(path + "/" + name);
+      }
+      closedir(dir);
+      std::sort(fileNames.begin(), fileNames.end());
+   }
+   else if (EndsWith(path, ".manifest"))
+   {
+      // parts written by TSFRollingWriter, in the order of the manifest
+      TSFRollingWriter::ReadManifest(path, &fileNames);
+   }
+   else
+   {
+      // glob sorts the names
+      glob_t matches;
+      if (glob(path.c_str(), 0, NULL, &matches) == 0)
+      {
+         for (size_t i = 0; i < matches.gl_pathc; i++)
+            fileNames.push_back(matches.gl_pathv[i]);
+      }
+      globfree(&matches);
+   }
+   if (fileNames.empty())
+      throw TSFException("No tsf files found at " + path);
+
+   TSFDataset* dataset = new TSFDataset();
+   try {
+      for (unsigned int i = 0; i < fileNames.size(); i++)
+         dataset->AddFile(fileNames[i]);
+   } catch (TSFException&) {
+      delete dataset;
+      throw;
+   }
+   return dataset;
+}
+
+void TSFDataset::AddFile(const std::string& fileName) throw (TSFException)
+{
+   File* file = new File();
+   file->name = fileName;
+   file->nrSpots = 0;
+   file->firstOrdinal = nrSpots_;
+   file->map = NULL;
+   file->data = NULL;
+   file->spotsEnd = 0;
+   files_.push_back(file);
+
+   // the SpotList, and where it starts
+   try {
+      file->spotsEnd = TSFRecords::SPOTSSTART +
+         TSFRecords::ReadHeader(fileName, &file->spotList);
+   } catch (TSFException& ex) {
+      throw TSFException(fileName + ": " + ex.getMessage());
+   }
+   TSFOverlay::OpenAll(fileName, &file->overlays);
+
+   file->map = new TSFMappedFile(fileName);
+   if (!file->map->IsOpen() || file->map->GetSize() < file->spotsEnd)
+      throw TSFException("Failed to map " + fileName);
+   file->data = file->map->GetData();
+
+   TSFTraceScope scope("scan", "TSFDataset");
+   const uint8_t* p = file->data + TSFRecords::SPOTSSTART;
+   const uint8_t* end = file->data + file->spotsEnd;
+   while (p < end)
+   {
+      const uint8_t* start = p;
+      const uint8_t* record;
+      uint32_t size;
+      if (!TSFRecords::NextRecord(&p, end, &record, &size))
+         throw TSFException("Failed to read Spot in " + fileName);
+      if (file->nrSpots % BLOCKSPOTS == 0)
+         file->blockOffsets.push_back(start - file->data);
+      file->nrSpots++;
+   }
+   scope.SetSpots(file->nrSpots);
+   nrSpots_ += file->nrSpots;
+}
+
+void TSFDataset::GetSpotList(TSF::SpotList* sl)
+{
+   sl->CopyFrom(files_[0]->spotList);
+   for (unsigned int i = 1; i < files_.size(); i++)
+      TSFUtils::MergeSpotList(sl, files_[i]->spotList);
+   sl->set_nr_spots(nrSpots_);
+}
+
+bool TSFDataset::Locate(uint64_t ordinal, size_t* file, uint64_t* ordinalInFile)
+{
+   if (ordinal >= nrSpots_)
+      return false;
+   // the last file that starts at or before ordinal, and is not empty
+   size_t lo = 0;
+   size_t hi = files_.size();
+   while (hi - lo > 1)
+   {
+      size_t mid = (lo + hi) / 2;
+      if (files_[mid]->firstOrdinal <= ordinal)
+         lo = mid;
+      else
+         hi = mid;
+   }
+   while (files_[lo]->nrSpots == 0 ||
+         ordinal - files_[lo]->firstOrdinal >= files_[lo]->nrSpots)
+      lo++;
+   *file = lo;
+   *ordinalInFile = ordinal - files_[lo]->firstOrdinal;
+   return true;
+}
+
+bool TSFDataset::GetSpotView(uint64_t ordinal, TSFSpotView* view)
+{
+   size_t f;
+   uint64_t spot;
+   if (!Locate(ordinal, &f, &spot))
+      return false;
+
+   // hop from the start of the block to the spot
+   File* file = files_[f];
+   const uint8_t* p = file->data + file->blockOffsets[spot / BLOCKSPOTS];
+   const uint8_t* end = file->data + file->spotsEnd;
+   const uint8_t* record;
+   uint32_t size;
+   for (uint64_t i = 0; i <= spot % BLOCKSPOTS; i++)
+   {
+      if (!TSFRecords::NextRecord(&p, end, &record, &size))
+         return false;
+   }
+   view->Reset(record, size, &file->overlays, spot);
+   return true;
+}
+
+bool TSFDataset::NextSpotView(TSFSpotView* view)
+{
+   while (readFile_ < files_.size())
+   {
+      File* file = files_[readFile_];
+      if (readOffset_ < file->spotsEnd)
+      {
+         const uint8_t* p = file->data + readOffset_;
+         const uint8_t* record;
+         uint32_t size;
+         if (!TSFRecords::NextRecord(&p, file->data + file->spotsEnd,
+                  &record, &size))
+            return false;
+         readOffset_ = p - file->data;
+         view->Reset(record, size, &file->overlays,
+               readOrdinal_ - file->firstOrdinal);
+         readOrdinal_++;
+         return true;
+      }
+      readFile_++;
+      readOffset_ = TSFRecords::SPOTSSTART;
+   }
+   return false;
+}
+
+bool TSFDataset::NextSpot(TSF::Spot* spot) throw (TSFException)
+{
+   TSFSpotView view;
+   if (!NextSpotView(&view))
+      return false;
+   if (!view.ToSpot(spot))
+      throw TSFException("Failed to decode Spot in " + files_[readFile_]->name);
+   return true;
+}
+
+void TSFDataset::Rewind()
+{
+   readFile_ = 0;
+   readOffset_ = TSFRecords::SPOTSSTART;
+   readOrdinal_ = 0;
+}
+
+
+/**
+ * Hands the units of work of one Scan to the threads of the pool
+ *
+ * Decoding needs a buffer of BLOCKSPOTS spots.  A unit takes one from a
+ * list of free buffers and returns it when done, so that each thread
+ * reuses the same buffer (and the memory of the fields of its spots)
+ * instead of allocating one per unit
+ */
+class TSFDatasetScan : public TSFLoopBody
+{
+   public:
+      TSFDatasetScan(TSFDataset* dataset, TSFDatasetVisitor* visitor,
+            TSFDataset::ScanUnit unit) :
+         dataset_(dataset),
+         visitor_(visitor),
+         unit_(unit)
+      {
+         pthread_mutex_init(&mutex_, NULL);
+         for (size_t f = 0; f < dataset_->files_.size(); f++)
+         {
+            size_t nrBlocks = dataset_->files_[f]->blockOffsets.size();
+            for (size_t b = 0; b < nrBlocks; b++)
+            {
+               if (unit_ == TSFDataset::FILES && b > 0)
+                  break;
+               files_.push_back(f);
+               blocks_.push_back(b);
+            }
+         }
+      };
+
+      ~TSFDatasetScan()
+      {
+         for (size_t i = 0; i < buffers_.size(); i++)
+            delete buffers_[i];
+         pthread_mutex_destroy(&mutex_);
+      };
+
+      uint64_t GetNrUnits() { return files_.size(); };
+
+      bool Run(uint64_t unit)
+      {
+         std::vector<TSF::Spot>* spots = GetBuffer();
+         size_t file = files_[unit];
+         size_t nrBlocks = dataset_->files_[file]->blockOffsets.size();
+         size_t first = blocks_[unit];
+         size_t last = unit_ == TSFDataset::FILES ? nrBlocks : first + 1;
+         bool success = true;
+         for (size_t block = first; block < last && success; block++)
+            success = dataset_->ScanBlock(visitor_, file, block, *spots);
+         ReleaseBuffer(spots);
+         return success;
+      };
+
+   private:
+      std::vector<TSF::Spot>* GetBuffer()
+      {
+         std::vector<TSF::Spot>* spots = NULL;
+         pthread_mutex_lock(&mutex_);
+         if (!free_.empty())
+         {
+            spots = free_.back();
+            free_.pop_back();
+         }
+         pthread_mutex_unlock(&mutex_);
+         if (spots != NULL)
+            return spots;
+
+         spots = new std::vector<TSF::Spot>(BLOCKSPOTS);
+         pthread_mutex_lock(&mutex_);
+         buffers_.push_back(spots);
+         pthread_mutex_unlock(&mutex_);
+         return spots;
+      };
+
+      void ReleaseBuffer(std::vector<TSF::Spot>* spots)
+      {
+         pthread_mutex_lock(&mutex_);
+         free_.push_back(spots);
+         pthread_mutex_unlock(&mutex_);
+      };
+
+      TSFDataset* dataset_;
+      TSFDatasetVisitor* visitor_;
+      TSFDataset::ScanUnit unit_;
+      std::vector<size_t> files_;
+      std::vector<size_t> blocks_;
+      // all buffers, and those not in use by a thread
+      std::vector<std::vector<TSF::Spot>*> buffers_;
+      std::vector<std::vector<TSF::Spot>*> free_;
+      pthread_mutex_t mutex_;
+};
+
+bool TSFDataset::Scan(TSFDatasetVisitor* visitor, ScanUnit unit,
+      int maxThreads)
+{
+   TSFDatasetScan scan(this, visitor, unit);
+   return TSFThreadPool::Shared()->ParallelFor(scan.GetNrUnits(), &scan,
+         maxThreads);
+}
+
+bool TSFDataset::ScanBlock(TSFDatasetVisitor* visitor, size_t f,
+      size_t block, std::vector<TSF::Spot>& spots)
+{
+   File* file = files_[f];
+   uint64_t first = block * BLOCKSPOTS;
+   uint32_t n = first + BLOCKSPOTS < file->nrSpots ?
+      BLOCKSPOTS : file->nrSpots - first;
+   {
+      TSFTraceScope scope("decode", "TSFDataset");
+      scope.SetSpots(n);
+      const uint8_t* p = file->data + file->blockOffsets[block];
+      const uint8_t* end = file->data + file->spotsEnd;
+      for (uint32_t i = 0; i < n; i++)
+      {
+         const uint8_t* record;
+         uint32_t size;
+         if (!TSFRecords::NextRecord(&p, end, &record, &size) ||
+               !spots[i].ParseFromArray(record, size))
+            return false;
+         for (unsigned int j = 0; j < file->overlays.size(); j++)
+            file->overlays[j]->Apply(&spots[i], first + i);
+      }
+   }
+   TSFTraceScope scope("visit", "TSFDataset");
+   scope.SetSpots(n);
+   return visitor->Visit(f, file->firstOrdinal + first, spots, n);
+}
@@ -0,0 +1,143 @@
+/**
+ * A set of tsf files (e.g. one per position or time segment of a long
+ * acquisition) that is read as a single collection of spots
+ */
+
+#ifndef TSFDATASET_H
+#define TSFDATASET_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../buildcpp/TSFProto.pb.h"
+#include "TSFException.h"
+#include "TSFOverlay.h"
+#include "TSFRecords.h"
+#include "TSFSpotIterator.h"
+#include "TSFSpotView.h"
+
+
+/**
+ * Receives the spots of a TSFDataset during a parallel scan
+ */
+class TSFDatasetVisitor
+{
+   public:
+      virtual ~TSFDatasetVisitor() {};
+
+      /**
+       * spots[0] - spots[n - 1] are consecutive spots of file nr file, the
+       * first of which has (dataset wide) ordinal firstOrdinal.  Called by
+       * the threads of the TSFThreadPool, at the same time for different
+       * blocks of spots.  Return false to stop the scan
+       */
+      virtual bool Visit(size_t file, uint64_t firstOrdinal,
+            std::vector<TSF::Spot>& spots, uint32_t n) = 0;
+};
+
+/**
+ * The files are memory mapped, and their spots are numbered consecutively
+ * in the order of the files (sorted by name), which gives every spot a
+ * dataset wide ordinal.  Spots can be read in that order (NextSpot, Spots),
+ * by ordinal (GetSpotView), or by all threads of the TSFThreadPool at once
+ * (Scan).  The sidecar overlays (see TSFOverlay) of each file are applied.
+ */
+class TSFDataset
+{
+   public:
+      enum ScanUnit {
+         // every file is visited by a single thread, in order
+         FILES = 0,
+         // blocks of a file can be visited by different threads
+         BLOCKS = 1
+      };
+
+      /**
+       * Opens all .tsf files in a directory, or all files matching a glob
+       * pattern (e.g. "/data/run1/pos*.tsf"), or the parts listed in a
+       * manifest of TSFRollingWriter (a path ending in ".manifest"), or a
+       * single file.  Reads the SpotList of each file, counts its spots and
+       * opens its sidecar overlays.
+       */
+      static TSFDataset* Open(const std::string& path) throw (TSFException);
+      ~TSFDataset();
+
+      size_t GetNrFiles() { return files_.size(); };
+      const std::string& GetFileName(size_t file) { return files_[file]->name; };
+      const TSF::SpotList& GetFileSpotList(size_t file) { return files_[file]->spotList; };
+      uint64_t GetFileNrSpots(size_t file) { return files_[file]->nrSpots; };
+      // ordinal of the first spot of file
+      uint64_t GetFirstOrdinal(size_t file) { return files_[file]->firstOrdinal; };
+
+      uint64_t GetNrSpots() { return nrSpots_; };
+
+      /**
+       * SpotList describing the whole dataset: that of the first file, with
+       * nr_spots set to the total nr of spots, nr_frames, nr_pos, nr_slices
+       * and nr_channels to their maximum over all files, and the
+       * fluorophore types of all files (one per id)
+       */
+      void GetSpotList(TSF::SpotList* sl);
+
+      /**
+       * Finds the file of the spot with the given ordinal, and the ordinal
+       * of the spot within that file.  Returns false when there is no such
+       * spot
+       */
+      bool Locate(uint64_t ordinal, size_t* file, uint64_t* ordinalInFile);
+
+      /**
+       * Points view to the spot with the given ordinal, see TSFSpotView.
+       * Returns false when there is no such spot
+       */
+      bool GetSpotView(uint64_t ordinal, TSFSpotView* view);
+
+      /**
+       * Reads the spots of all files in order, see TSFSpotIterator.h
+       */
+      bool NextSpot(TSF::Spot* spot) throw (TSFException);
+      bool NextSpotView(TSFSpotView* view);
+      TSFSpotRange<TSFDataset> Spots() { return TSFSpotRange<TSFDataset>(this); };
+      // NextSpot, NextSpotView and Spots start again from the first spot
+      void Rewind();
+
+      /**
+       * Decodes all spots on the threads of the TSFThreadPool (at most
+       * maxThreads of them, 0 for all) and hands them to visitor.  Returns
+       * false when a spot could not be decoded or visitor returned false
+       */
+      bool Scan(TSFDatasetVisitor* visitor, ScanUnit unit = BLOCKS,
+            int maxThreads = 0);
+
+   private:
+      struct File
+      {
+         std::string name;
+         TSF::SpotList spotList;
+         uint64_t nrSpots;
+         uint64_t firstOrdinal;
+         // the memory mapped file, spots are in data[12] - data[spotsEnd]
+         TSFMappedFile* map;
+         const uint8_t* data;
+         uint64_t spotsEnd;
+         // offset in data of every BLOCKSPOTS-th spot
+         std::vector<uint64_t> blockOffsets;
+         std::vector<TSFOverlay*> overlays;
+      };
+
+      TSFDataset();
+      void AddFile(const std::string& fileName) throw (TSFException);
+
+      friend class TSFDatasetScan;
+      bool ScanBlock(TSFDatasetVisitor* visitor, size_t file, size_t block,
+            std::vector<TSF::Spot>& spots);
+
+      std::vector<File*> files_;
+      uint64_t nrSpots_;
+      // position of NextSpot
+      size_t readFile_;
+      uint64_t readOffset_;
+      uint64_t readOrdinal_;
+};
+
+#endif
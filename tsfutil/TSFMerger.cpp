@@ -0,0 +1,163 @@
+/**
+ * Merges the spots of several tsf files that are sorted by frame into a
+ * single stream of spots sorted by frame
+ */
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+#include "TSFMerger.h"
+
+
+bool TSFMerger::Later::operator()(size_t a, size_t b) const
+{
+   int32_t frameA = (*inputs)[a]->frame;
+   int32_t frameB = (*inputs)[b]->frame;
+   if (frameA != frameB)
+      return frameA > frameB;
+   return a > b;
+}
+
+TSFMerger::TSFMerger(const std::vector<std::string>& fileNames,
+      TSFMetrics* metrics) throw (TSFException) :
+   last_(0),
+   pending_(false),
+   spotsRead_(0),
+   maxFrame_(0)
+{
+   later_.inputs = &inputs_;
+   try {
+      for (size_t i = 0; i < fileNames.size(); i++)
+      {
+         Input* input = new Input();
+         input->fileName = fileNames[i];
+         input->tsfIn = NULL;
+         input->frame = std::numeric_limits<int32_t>::min();
+         inputs_.push_back(input);
+
+         input->fs.open(fileNames[i].c_str(), std::ios_base::in |
+               std::ios_base::binary);
+         if (!input->fs.is_open())
+            throw TSFException("Failed to open " + fileNames[i]);
+         input->tsfIn = new TSFUtils(&input->fs, TSFUtils::READ, metrics);
+         try {
+            input->tsfIn->GetHeaderBinary(&input->spotList);
+            input->tsfIn->AddOverlays(fileNames[i]);
+         } catch (TSFException& ex) {
+            throw TSFException(fileNames[i] + ": " + ex.getMessage());
+         }
+         if (Advance(i))
+            heap_.push_back(i);
+      }
+   } catch (TSFException&) {
+      for (size_t i = 0; i < inputs_.size(); i++)
+      {
+         delete inputs_[i]->tsfIn;
+         delete inputs_[i];
+      }
+      throw;
+   }
+   if (inputs_.empty())
+      throw TSFException("No files to merge");
+   std::make_heap(heap_.begin(), heap_.end(), later_);
+}
+
+TSFMerger::~TSFMerger()
+{
+   for (size_t i = 0; i < inputs_.size(); i++)
+   {
+      delete inputs_[i]->tsfIn;
+      inputs_[i]->fs.close();
+      delete inputs_[i];
+   }
+}
+
+/**
+ * Reads the next spot of an input, and returns false when it has none left
+ */
+bool TSFMerger::Advance(size_t index) throw (TSFException)
+{
+   Input* input = inputs_[index];
+   if (!input->tsfIn->NextSpotView(&input->view))
+      return false;
+
+   int32_t frame = input->view.frame();
+   if (frame < input->frame)
+   {
+      std::ostringstream msg;
+      msg << input->fileName << " is not sorted by frame (frame " << frame
+         << " follows frame " << input->frame << ")";
+      throw TSFException(msg.str());
+   }
+   input->frame = frame;
+   return true;
+}
+
+bool TSFMerger::NextSpotView(TSFSpotView* view) throw (TSFException)
+{
+   // the spot handed out last is no longer needed
+   if (pending_)
+   {
+      pending_ = false;
+      if (Advance(last_))
+      {
+         heap_.push_back(last_);
+         std::push_heap(heap_.begin(), heap_.end(), later_);
+      }
+   }
+   if (heap_.empty())
+      return false;
+
+   std::pop_heap(heap_.begin(), heap_.end(), later_);
+   last_ = heap_.back();
+   heap_.pop_back();
+   pending_ = true;
+
+   const TSFSpotView& current = inputs_[last_]->view;
+   view->Reset(current.GetData(), current.GetSize(), current.GetOverlays(),
+         current.GetOrdinal());
+   spotsRead_++;
+   maxFrame_ = std::max(maxFrame_, inputs_[last_]->frame);
+   channels_.insert(current.channel());
+   return true;
+}
+
+bool TSFMerger::NextSpot(TSF::Spot* spot) throw (TSFException)
+{
+   if (!NextSpotView(&spotView_))
+      return false;
+   if (!spotView_.ToSpot(spot))
+      throw TSFException("Failed to parse spot of " + inputs_[last_]->fileName);
+   return true;
+}
+
+uint64_t TSFMerger::Merge(TSFUtils* tsfOut) throw (TSFException)
+{
+   uint64_t n = 0;
+   std::string record;
+   const uint8_t* data;
+   uint32_t size;
+   while (NextSpotView(&spotView_))
+   {
+      spotView_.GetRecord(&record, &data, &size);
+      tsfOut->WriteSpotBinary(data, size);
+      n++;
+   }
+   return n;
+}
+
+void TSFMerger::GetSpotList(TSF::SpotList* sl)
+{
+   sl->CopyFrom(inputs_[0]->spotList);
+   for (size_t i = 1; i < inputs_.size(); i++)
+      TSFUtils::MergeSpotList(sl, inputs_[i]->spotList);
+
+   if (pending_ || !heap_.empty())
+      return;
+   sl->set_nr_spots(spotsRead_);
+   if (maxFrame_ > sl->nr_frames())
+      sl->set_nr_frames(maxFrame_);
+   if ((int32_t) channels_.size() > sl->nr_channels())
+      sl->set_nr_channels(channels_.size());
+}
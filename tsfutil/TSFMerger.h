@@ -0,0 +1,112 @@
+/**
+ * Merges the spots of several tsf files that are sorted by frame into a
+ * single stream of spots sorted by frame
+ */
+
+#ifndef TSFMERGER_H
+#define TSFMERGER_H
+
+#include <fstream>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../buildcpp/TSFProto.pb.h"
+#include "TSFException.h"
+#include "TSFMetrics.h"
+#include "TSFSpotIterator.h"
+#include "TSFSpotView.h"
+#include "TSFUtils.h"
+
+
+/**
+ * Every input file is read with its own TSFUtils, one spot at a time, and
+ * the current spot of each input is kept in a heap ordered by frame, so
+ * that memory use does not depend on the size of the inputs.  Spots of the
+ * same frame come out in the order of the inputs, and within an input in
+ * the order of the file.  Spots are passed on in their original wire
+ * format, without being decoded.  The sidecar overlays of the inputs (see
+ * TSFOverlay) are applied to the views, and TSFSpotView::GetRecord appends
+ * their values to the records.  An input that is not sorted by frame is
+ * reported with a TSFException.
+ *
+ *    TSFMerger merger(fileNames);
+ *    TSFSpotView view;
+ *    std::string record;
+ *    const uint8_t* data;
+ *    uint32_t size;
+ *    while (merger.NextSpotView(&view))
+ *    {
+ *       view.GetRecord(&record, &data, &size);
+ *       tsfOut->WriteSpotBinary(data, size);
+ *    }
+ *    merger.GetSpotList(&sl);
+ *    tsfOut->WriteHeaderBinary(&sl);
+ */
+class TSFMerger
+{
+   public:
+      TSFMerger(const std::vector<std::string>& fileNames,
+            TSFMetrics* metrics = NULL) throw (TSFException);
+      ~TSFMerger();
+
+      /**
+       * SpotList describing the merged spots: that of the first input,
+       * combined with those of the others (see TSFUtils::MergeSpotList).
+       * Once all spots were read, nr_spots is the nr of spots read, and
+       * nr_frames and nr_channels are at least the highest frame and the
+       * nr of different channels of the spots
+       */
+      void GetSpotList(TSF::SpotList* sl);
+
+      /**
+       * Points view to the next spot.  The view is valid until the next
+       * call to NextSpotView or NextSpot.  Returns false after the last spot
+       */
+      bool NextSpotView(TSFSpotView* view) throw (TSFException);
+      bool NextSpot(TSF::Spot* spot) throw (TSFException);
+      // see TSFSpotIterator.h
+      TSFSpotRange<TSFMerger> Spots() { return TSFSpotRange<TSFMerger>(this); };
+
+      /**
+       * Writes all remaining spots to tsfOut (which should be in WRITE
+       * mode), and returns the nr of spots written.  The SpotList still
+       * needs to be written
+       */
+      uint64_t Merge(TSFUtils* tsfOut) throw (TSFException);
+
+   private:
+      struct Input
+      {
+         std::string fileName;
+         std::fstream fs;
+         TSFUtils* tsfIn;
+         TSF::SpotList spotList;
+         TSFSpotView view;
+         int32_t frame;
+      };
+
+      // orders the heap so that the input with the lowest frame is on top
+      struct Later
+      {
+         const std::vector<Input*>* inputs;
+         bool operator()(size_t a, size_t b) const;
+      };
+
+      bool Advance(size_t input) throw (TSFException);
+
+      std::vector<Input*> inputs_;
+      // indices of the inputs that have a current spot
+      std::vector<size_t> heap_;
+      Later later_;
+      // input of the spot that was handed out last, still to be advanced
+      size_t last_;
+      bool pending_;
+      uint64_t spotsRead_;
+      int32_t maxFrame_;
+      std::set<int32_t> channels_;
+      // used by NextSpot and Merge
+      TSFSpotView spotView_;
+};
+
+#endif
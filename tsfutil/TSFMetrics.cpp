@@ -0,0 +1,203 @@
+/**
+ * Counters and timers for the read and write paths of TSFUtils
+ *
+ * Time is measured with the monotonic clock, which costs a few tens of ns
+ * per measurement.  TSFUtils therefore only takes measurements when it was
+ * given a TSFMetrics instance.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <iomanip>
+
+#include "TSFMetrics.h"
+
+
+TSFMetrics::TSFMetrics()
+{
+   Reset();
+}
+
+void TSFMetrics::Reset()
+{
+   for (int i = 0; i < NRSTAGES; i++)
+      time_[i] = 0;
+   bytesRead_ = 0;
+   bytesWritten_ = 0;
+   spotsDecoded_ = 0;
+   spotsEncoded_ = 0;
+   nrWrites_ = 0;
+   memset(latency_, 0, sizeof(latency_));
+}
+
+void TSFMetrics::Add(const TSFMetrics& other)
+{
+   for (int i = 0; i < NRSTAGES; i++)
+      time_[i] += other.time_[i];
+   bytesRead_ += other.bytesRead_;
+   bytesWritten_ += other.bytesWritten_;
+   spotsDecoded_ += other.spotsDecoded_;
+   spotsEncoded_ += other.spotsEncoded_;
+   nrWrites_ += other.nrWrites_;
+   for (int i = 0; i < NRBUCKETS; i++)
+      latency_[i] += other.latency_[i];
+}
+
+uint64_t TSFMetrics::Now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void TSFMetrics::AddWriteLatency(uint64_t ns)
+{
+   latency_[Bucket(ns)]++;
+   nrWrites_++;
+}
+
+/**
+ * Values below 8 have their own bucket, above that every power of 2 is
+ * divided in 8 buckets based on the 3 bits following the highest set bit
+ */
+int TSFMetrics::Bucket(uint64_t ns)
+{
+   if (ns < 8)
+      return (int) ns;
+   int msb = 3;
+   while ((ns >> (msb + 1)) != 0)
+      msb++;
+   return (msb - 2) * 8 + (int) ((ns >> (msb - 3)) & 7);
+}
+
+/**
+ * Center of the range of values that fall in the bucket
+ */
+uint64_t TSFMetrics::BucketValue(int bucket)
+{
+   if (bucket < 8)
+      return bucket;
+   int msb = bucket / 8 + 2;
+   uint64_t width = 1ULL << (msb - 3);
+   return (8 + (bucket % 8)) * width + width / 2;
+}
+
+uint64_t TSFMetrics::GetWriteLatency(double fraction) const
+{
+   if (nrWrites_ == 0)
+      return 0;
+   uint64_t target = (uint64_t) (fraction * nrWrites_ + 0.5);
+   if (target < 1)
+      target = 1;
+   uint64_t count = 0;
+   for (int i = 0; i < NRBUCKETS; i++)
+   {
+      count += latency_[i];
+      if (count >= target)
+         return BucketValue(i);
+   }
+   return BucketValue(NRBUCKETS - 1);
+}
+
+const char* TSFMetrics::StageName(Stage stage)
+{
+   switch (stage)
+   {
+      case READ: return "read";
+      case PARSE: return "parse";
+      case SERIALIZE: return "serialize";
+      case WRITE: return "write";
+      default: return "unknown";
+   }
+}
+
+void TSFMetrics::Print(std::ostream& os, uint64_t wallTime) const
+{
+   std::ios::fmtflags flags = os.flags();
+   std::streamsize precision = os.precision();
+   os << std::fixed << std::setprecision(3);
+
+   os << "Bytes read:       " << bytesRead_ << "\n";
+   os << "Bytes written:    " << bytesWritten_ << "\n";
+   os << "Spots decoded:    " << spotsDecoded_ << "\n";
+   os << "Spots encoded:    " << spotsEncoded_ << "\n";
+   for (int i = 0; i < NRSTAGES; i++)
+   {
+      os << "Time " << std::left << std::setw(12)
+         << (std::string(StageName((Stage) i)) + ":") << std::right
+         << time_[i] / 1.0e9 << " s";
+      if (wallTime > 0)
+         os << " (" << std::setprecision(1) << 100.0 * time_[i] / wallTime
+            << "%)" << std::setprecision(3);
+      os << "\n";
+   }
+   if (wallTime > 0)
+   {
+      os << "Wall time:        " << wallTime / 1.0e9 << " s\n";
+      double seconds = wallTime / 1.0e9;
+      os << "Read throughput:  " << bytesRead_ / seconds / 1.0e6 << " MB/s, "
+         << spotsDecoded_ / seconds << " spots/s\n";
+      os << "Write throughput: " << bytesWritten_ / seconds / 1.0e6 << " MB/s, "
+         << spotsEncoded_ / seconds << " spots/s\n";
+   }
+   if (nrWrites_ > 0)
+   {
+      os << "Write latency:    p50 " << GetWriteLatency(0.5) << " ns, p99 "
+         << GetWriteLatency(0.99) << " ns\n";
+   }
+
+   os.flags(flags);
+   os.precision(precision);
+}
+
+
+bool TSFTimedInputStream::Next(const void** data, int* size)
+{
+   uint64_t start = TSFMetrics::Now();
+   bool result = input_->Next(data, size);
+   metrics_->AddTime(TSFMetrics::READ, TSFMetrics::Now() - start);
+   if (result)
+      metrics_->AddBytesRead(*size);
+   return result;
+}
+
+void TSFTimedInputStream::BackUp(int count)
+{
+   input_->BackUp(count);
+   metrics_->AddBytesRead(-count);
+}
+
+bool TSFTimedInputStream::Skip(int count)
+{
+   uint64_t start = TSFMetrics::Now();
+   google::protobuf::int64 before = input_->ByteCount();
+   bool result = input_->Skip(count);
+   metrics_->AddTime(TSFMetrics::READ, TSFMetrics::Now() - start);
+   metrics_->AddBytesRead(input_->ByteCount() - before);
+   return result;
+}
+
+
+TSFTimedOutputStream::~TSFTimedOutputStream()
+{
+   // the wrapped stream writes what is left in its buffer when deleted
+   uint64_t start = TSFMetrics::Now();
+   delete output_;
+   metrics_->AddTime(TSFMetrics::WRITE, TSFMetrics::Now() - start);
+}
+
+bool TSFTimedOutputStream::Next(void** data, int* size)
+{
+   uint64_t start = TSFMetrics::Now();
+   bool result = output_->Next(data, size);
+   metrics_->AddTime(TSFMetrics::WRITE, TSFMetrics::Now() - start);
+   if (result)
+      metrics_->AddBytesWritten(*size);
+   return result;
+}
+
+void TSFTimedOutputStream::BackUp(int count)
+{
+   output_->BackUp(count);
+   metrics_->AddBytesWritten(-count);
+}
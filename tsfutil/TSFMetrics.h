@@ -0,0 +1,125 @@
+/**
+ * Counters and timers for the read and write paths of TSFUtils
+ */
+
+#ifndef TSFMETRICS_H
+#define TSFMETRICS_H
+
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <iostream>
+#include <stdint.h>
+
+
+/**
+ * Collects the nr of bytes and spots that pass through one or more TSFUtils
+ * instances, the time spent in each stage (reading from the file, parsing,
+ * serializing and writing to the file), and a histogram of the time it takes
+ * to write a single spot.  Pass an instance to the TSFUtils constructor (and
+ * to the static text functions) to enable collection, the same instance can
+ * be shared by a reader and a writer.  Not thread safe, threads should
+ * collect into their own instance and Add it to the shared one.
+ */
+class TSFMetrics
+{
+   public:
+      enum Stage {
+         READ = 0,
+         PARSE = 1,
+         SERIALIZE = 2,
+         WRITE = 3,
+         NRSTAGES = 4
+      };
+
+      TSFMetrics();
+
+      void Reset();
+
+      // monotonic time in ns
+      static uint64_t Now();
+
+      void AddTime(Stage stage, uint64_t ns) { time_[stage] += ns; };
+      void AddBytesRead(int64_t bytes) { bytesRead_ += bytes; };
+      void AddBytesWritten(int64_t bytes) { bytesWritten_ += bytes; };
+      void AddSpotDecoded() { spotsDecoded_++; };
+      void AddSpotEncoded() { spotsEncoded_++; };
+      void AddWriteLatency(uint64_t ns);
+      /**
+       * Adds all values of other, e.g. collected by another thread.  Times
+       * of stages that ran in parallel become the sum of their threads
+       */
+      void Add(const TSFMetrics& other);
+
+      uint64_t GetTime(Stage stage) const { return time_[stage]; };
+      int64_t GetBytesRead() const { return bytesRead_; };
+      int64_t GetBytesWritten() const { return bytesWritten_; };
+      uint64_t GetSpotsDecoded() const { return spotsDecoded_; };
+      uint64_t GetSpotsEncoded() const { return spotsEncoded_; };
+
+      /**
+       * Per spot write latency (ns) below which the given fraction (0 - 1)
+       * of the writes fell, e.g. 0.99 for p99.  Accurate to about 10%
+       */
+      uint64_t GetWriteLatency(double fraction) const;
+
+      /**
+       * Prints all values.  When wallTime (ns) is given, the time of each
+       * stage is also shown as a fraction of it
+       */
+      void Print(std::ostream& os, uint64_t wallTime = 0) const;
+
+      static const char* StageName(Stage stage);
+
+   private:
+      // log-linear histogram: 8 buckets per power of 2
+      static const int NRBUCKETS = 496;
+      static int Bucket(uint64_t ns);
+      static uint64_t BucketValue(int bucket);
+
+      uint64_t time_[NRSTAGES];
+      int64_t bytesRead_;
+      int64_t bytesWritten_;
+      uint64_t spotsDecoded_;
+      uint64_t spotsEncoded_;
+      uint64_t nrWrites_;
+      uint64_t latency_[NRBUCKETS];
+};
+
+
+/**
+ * Stream wrappers that account the time spent in, and the bytes passed
+ * through, the underlying (file) stream.  Take ownership of that stream.
+ */
+class TSFTimedInputStream : public google::protobuf::io::ZeroCopyInputStream
+{
+   public:
+      TSFTimedInputStream(google::protobuf::io::ZeroCopyInputStream* input,
+            TSFMetrics* metrics) : input_(input), metrics_(metrics) {};
+      ~TSFTimedInputStream() { delete input_; };
+
+      bool Next(const void** data, int* size);
+      void BackUp(int count);
+      bool Skip(int count);
+      google::protobuf::int64 ByteCount() const { return input_->ByteCount(); };
+
+   private:
+      google::protobuf::io::ZeroCopyInputStream* input_;
+      TSFMetrics* metrics_;
+};
+
+class TSFTimedOutputStream : public google::protobuf::io::ZeroCopyOutputStream
+{
+   public:
+      TSFTimedOutputStream(google::protobuf::io::ZeroCopyOutputStream* output,
+            TSFMetrics* metrics) : output_(output), metrics_(metrics) {};
+      ~TSFTimedOutputStream();
+
+      bool Next(void** data, int* size);
+      void BackUp(int count);
+      google::protobuf::int64 ByteCount() const { return output_->ByteCount(); };
+
+   private:
+      google::protobuf::io::ZeroCopyOutputStream* output_;
+      TSFMetrics* metrics_;
+};
+
+#endif
@@ -0,0 +1,203 @@
+/**
+ * Sidecar column files that overlay a single per-spot field of a tsf file
+ *
+ * Analysis steps such as clustering and tracking only change one or two 
+ * integer fields of each spot.  Rather than rewriting the whole tsf file, 
+ * the new values can be stored in a small sidecar file next to the tsf file,
+ * keyed by the ordinal of the spot (0-based, in file order).  Readers 
+ * (TSFUtils::GetSpotBinary, TSFParser) merge the overlay into each spot as it 
+ * is read.  Spots for which no value was set keep their original value.
+ *
+ * The sidecar is named <tsf file>.<field name>.ovl and consists of:
+ *   int32  magic number (0)
+ *   int32  field number in the Spot message
+ *   int64  number of values (n)
+ *   n x 4 bytes values (int32 or float, depending on the field)
+ *   (n + 7) / 8 bytes bitmap indicating which values were set
+ * All numbers are big endian, as in the tsf header.
+ *
+ * Only singular int32 and float fields are supported.
+ */
+
+#include <fstream>
+#include <string.h>
+
+#include "TSFOverlay.h"
+#include "TSFUtils.h"
+
+
+TSFOverlay::TSFOverlay(const std::string& tsfFileName, 
+      const std::string& fieldName) throw (TSFException) :
+   fileName_(SidecarName(tsfFileName, fieldName)),
+   fieldName_(fieldName)
+{
+   fd_ = TSF::Spot::descriptor()->FindFieldByName(fieldName);
+   if (fd_ == NULL)
+      throw TSFException("Overlay field " + fieldName + " is not a Spot field");
+   if (fd_->is_repeated() || 
+         (fd_->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_INT32 &&
+          fd_->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_FLOAT))
+      throw TSFException("Only int32 and float fields can be overlayed");
+
+   if (Exists(tsfFileName, fieldName))
+      Load();
+}
+
+TSFOverlay::~TSFOverlay()
+{
+}
+
+std::string TSFOverlay::SidecarName(const std::string& tsfFileName, 
+      const std::string& fieldName)
+{
+   return tsfFileName + "." + fieldName + ".ovl";
+}
+
+bool TSFOverlay::Exists(const std::string& tsfFileName, 
+      const std::string& fieldName)
+{
+   std::ifstream ifs(SidecarName(tsfFileName, fieldName).c_str());
+   return ifs.good();
+}
+
+void TSFOverlay::OpenAll(const std::string& tsfFileName,
+      std::vector<TSFOverlay*>* overlays) throw (TSFException)
+{
+   const google::protobuf::Descriptor* sd = TSF::Spot::descriptor();
+   for (int i = 0; i < sd->field_count(); i++)
+   {
+      const google::protobuf::FieldDescriptor* fd = sd->field(i);
+      if (fd->is_repeated() || 
+            (fd->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_INT32 &&
+             fd->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_FLOAT))
+         continue;
+      if (Exists(tsfFileName, fd->name()))
+         overlays->push_back(new TSFOverlay(tsfFileName, fd->name()));
+   }
+}
+
+void TSFOverlay::Load() throw (TSFException)
+{
+   std::ifstream ifs(fileName_.c_str(), std::ios_base::in | std::ios_base::binary);
+   if (!ifs.good())
+      throw TSFException("Failed to open overlay file " + fileName_);
+
+   if (TSFUtils::ReadInt32(&ifs) != 0)
+      throw TSFException("Magic number is not 0, is this an overlay file?");
+   if (TSFUtils::ReadInt32(&ifs) != fd_->number())
+      throw TSFException("Overlay file " + fileName_ + " belongs to a different field");
+   int64_t n = TSFUtils::ReadInt64(&ifs);
+   if (!ifs.good() || n < 0)
+      throw TSFException("Failed to read overlay header");
+
+   values_.resize(n);
+   if (n > 0)
+      ifs.read((char*) &values_[0], n * sizeof(int32_t));
+   if (!TSFUtils::IsBigEndian())
+   {
+      for (int64_t i = 0; i < n; i++)
+         values_[i] = TSFUtils::SwapInt32(values_[i]);
+   }
+
+   std::vector<char> bitmap((n + 7) / 8);
+   if (n > 0)
+      ifs.read(&bitmap[0], bitmap.size());
+   if (!ifs.good())
+      throw TSFException("Overlay file " + fileName_ + " is truncated");
+
+   isSet_.resize(n);
+   for (int64_t i = 0; i < n; i++)
+      isSet_[i] = (bitmap[i / 8] >> (i % 8)) & 1;
+}
+
+/**
+ * Writes the overlay to its sidecar file, replacing an existing one
+ */
+void TSFOverlay::Save() throw (TSFException)
+{
+   std::ofstream ofs(fileName_.c_str(), std::ios_base::out | 
+         std::ios_base::trunc | std::ios_base::binary);
+   if (!ofs.good())
+      throw TSFException("Failed to open overlay file " + fileName_);
+
+   TSFUtils::int32char tmp;
+   tmp.i = 0;
+   ofs.write(tmp.ch, 4);
+   tmp.i = TSFUtils::IsBigEndian() ? fd_->number() : 
+      TSFUtils::SwapInt32(fd_->number());
+   ofs.write(tmp.ch, 4);
+   TSFUtils::WriteInt64(&ofs, values_.size());
+
+   std::vector<int32_t> out(values_);
+   if (!TSFUtils::IsBigEndian())
+   {
+      for (size_t i = 0; i < out.size(); i++)
+         out[i] = TSFUtils::SwapInt32(out[i]);
+   }
+   if (out.size() > 0)
+      ofs.write((const char*) &out[0], out.size() * sizeof(int32_t));
+
+   std::vector<char> bitmap((isSet_.size() + 7) / 8, 0);
+   for (size_t i = 0; i < isSet_.size(); i++)
+   {
+      if (isSet_[i])
+         bitmap[i / 8] |= 1 << (i % 8);
+   }
+   if (bitmap.size() > 0)
+      ofs.write(&bitmap[0], bitmap.size());
+
+   if (!ofs.good())
+      throw TSFException("Failed to write overlay file " + fileName_);
+}
+
+void TSFOverlay::SetInt32(uint64_t ordinal, int32_t val)
+{
+   if (ordinal >= values_.size())
+   {
+      values_.resize(ordinal + 1, 0);
+      isSet_.resize(ordinal + 1, false);
+   }
+   values_[ordinal] = val;
+   isSet_[ordinal] = true;
+}
+
+void TSFOverlay::SetFloat(uint64_t ordinal, float val)
+{
+   int32_t bits;
+   memcpy(&bits, &val, sizeof(bits));
+   SetInt32(ordinal, bits);
+}
+
+/**
+ * Replaces the field in spot with the overlay value for the given ordinal
+ * Spots outside of the overlay, or without a value set, are left alone
+ */
+void TSFOverlay::Apply(TSF::Spot* spot, uint64_t ordinal)
+{
+   if (ordinal >= values_.size() || !isSet_[ordinal])
+      return;
+
+   const google::protobuf::Reflection* sr = spot->GetReflection();
+   if (fd_->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_INT32)
+   {
+      sr->SetInt32(spot, fd_, values_[ordinal]);
+   } else
+   {
+      float val;
+      memcpy(&val, &values_[ordinal], sizeof(val));
+      sr->SetFloat(spot, fd_, val);
+   }
+}
+
+/**
+ * Copies the raw 4 bytes of the overlay value for the given ordinal into bits
+ * (an int32 or the bit pattern of a float, depending on the field)
+ * Returns false when no value was set for this ordinal
+ */
+bool TSFOverlay::GetBits(uint64_t ordinal, int32_t* bits)
+{
+   if (ordinal >= values_.size() || !isSet_[ordinal])
+      return false;
+   *bits = values_[ordinal];
+   return true;
+}
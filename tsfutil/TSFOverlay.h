@@ -0,0 +1,55 @@
+/**
+ * Sidecar column files that overlay a single per-spot field of a tsf file
+ */
+
+#ifndef TSFOVERLAY_H
+#define TSFOVERLAY_H
+
+#include <string>
+#include <vector>
+#include "../buildcpp/TSFProto.pb.h"
+#include "TSFException.h"
+
+
+class TSFOverlay
+{
+   public:
+      TSFOverlay(const std::string& tsfFileName, const std::string& fieldName)
+         throw (TSFException);
+      ~TSFOverlay();
+
+      static std::string SidecarName(const std::string& tsfFileName, 
+            const std::string& fieldName);
+      static bool Exists(const std::string& tsfFileName, 
+            const std::string& fieldName);
+      /**
+       * Opens the sidecars of all Spot fields that exist next to
+       * tsfFileName and adds them to overlays.  The caller owns them
+       */
+      static void OpenAll(const std::string& tsfFileName,
+            std::vector<TSFOverlay*>* overlays) throw (TSFException);
+
+      void Save() throw (TSFException);
+
+      void SetInt32(uint64_t ordinal, int32_t val);
+      void SetFloat(uint64_t ordinal, float val);
+      uint64_t Size() { return values_.size(); };
+      std::string GetFieldName() { return fieldName_; };
+
+      void Apply(TSF::Spot* spot, uint64_t ordinal);
+      bool GetBits(uint64_t ordinal, int32_t* bits);
+      int GetFieldNumber() { return fd_->number(); };
+      bool IsFloat() { return fd_->cpp_type() == 
+         google::protobuf::FieldDescriptor::CPPTYPE_FLOAT; };
+
+   private:
+      void Load() throw (TSFException);
+
+      std::string fileName_;
+      std::string fieldName_;
+      const google::protobuf::FieldDescriptor* fd_;
+      std::vector<int32_t> values_;
+      std::vector<bool> isSet_;
+};
+
+#endif
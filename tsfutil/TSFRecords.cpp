@@ -0,0 +1,129 @@
+/**
+ * Access to the spots of tsf files as raw records, see TSFRecords.h
+ */
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TSFRecords.h"
+#include "TSFUtils.h"
+#include <google/protobuf/wire_format_lite.h>
+
+using google::protobuf::internal::WireFormatLite;
+
+const uint64_t TSFRecords::SPOTSSTART;
+const int TSFRecords::MAXFIELDBYTES;
+
+
+TSFMappedFile::TSFMappedFile(const std::string& fileName) :
+   data_(NULL),
+   size_(0)
+{
+   int fd = open(fileName.c_str(), O_RDONLY);
+   if (fd < 0)
+      return;
+   struct stat st;
+   if (fstat(fd, &st) == 0 && st.st_size > 0)
+   {
+      void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED)
+      {
+         data_ = (const uint8_t*) map;
+         size_ = st.st_size;
+         madvise(map, size_, MADV_SEQUENTIAL);
+      }
+   }
+   // the mapping stays valid after closing the file
+   close(fd);
+}
+
+TSFMappedFile::~TSFMappedFile()
+{
+   if (data_ != NULL)
+      munmap((void*) data_, size_);
+}
+
+
+uint64_t TSFRecords::ReadHeader(const std::string& fileName,
+      TSF::SpotList* sl) throw (TSFException)
+{
+   std::fstream fs(fileName.c_str(), std::ios_base::in | std::ios_base::binary);
+   if (!fs.is_open())
+      throw TSFException("Failed to open " + fileName);
+   {
+      TSFUtils reader(&fs, TSFUtils::READ);
+      reader.GetHeaderBinary(sl);
+   }
+   fs.clear();
+   fs.seekg(4, std::ios_base::beg);
+   return TSFUtils::ReadInt64(&fs);
+}
+
+uint64_t TSFRecords::CountRecords(const uint8_t* p, const uint8_t* end)
+{
+   uint64_t n = 0;
+   const uint8_t* record;
+   uint32_t size;
+   while (NextRecord(&p, end, &record, &size))
+      n++;
+   return n;
+}
+
+static bool CompareColumns(const TSFRecords::Column& a,
+      const TSFRecords::Column& b)
+{
+   return a.number < b.number;
+}
+
+bool TSFRecords::CompleteColumns(std::vector<Column>& columns,
+      std::string* missing)
+{
+   const google::protobuf::Descriptor* sd = TSF::Spot::descriptor();
+   for (int f = 0; f < sd->field_count(); f++)
+   {
+      const google::protobuf::FieldDescriptor* fd = sd->field(f);
+      if (!fd->is_required())
+         continue;
+      bool found = false;
+      for (unsigned int c = 0; c < columns.size() && !found; c++)
+         found = columns[c].number == fd->number();
+      if (found)
+         continue;
+      if (fd->number() != TSF::Spot::kMoleculeFieldNumber)
+      {
+         *missing = fd->name();
+         return false;
+      }
+      Column column;
+      column.number = fd->number();
+      column.isFloat = false;
+      column.data = NULL;
+      columns.push_back(column);
+   }
+   std::sort(columns.begin(), columns.end(), CompareColumns);
+   return true;
+}
+
+uint32_t TSFRecords::EncodeSpot(const std::vector<Column>& columns,
+      uint64_t i, int64_t ordinal, uint8_t* buf)
+{
+   uint8_t* p = buf;
+   for (unsigned int c = 0; c < columns.size(); c++)
+   {
+      const Column& column = columns[c];
+      if (column.data == NULL)
+         p = WireFormatLite::WriteInt32ToArray(column.number,
+               (int32_t) ordinal, p);
+      else if (column.isFloat)
+         p = WireFormatLite::WriteFloatToArray(column.number,
+               ((const float*) column.data)[i], p);
+      else
+         p = WireFormatLite::WriteInt32ToArray(column.number,
+               ((const int32_t*) column.data)[i], p);
+   }
+   return p - buf;
+}
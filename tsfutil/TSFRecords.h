@@ -0,0 +1,126 @@
+/**
+ * Access to the spots of tsf files as raw records: memory mapping a file,
+ * walking the size prefixed spots without decoding them, and encoding
+ * spots from columns of values
+ *
+ * Shared by the readers and writers that bypass TSFUtils for speed (tsfc,
+ * TSFDataset, the tsfio Python module and the TSFParallelDecoder of mextsf)
+ */
+
+#ifndef TSFRECORDS_H
+#define TSFRECORDS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../buildcpp/TSFProto.pb.h"
+#include "TSFException.h"
+
+
+/**
+ * Read-only memory map of a whole file.  The mapping stays valid until the
+ * TSFMappedFile is destroyed
+ */
+class TSFMappedFile
+{
+   public:
+      // IsOpen is false when the file could not be mapped (or is empty)
+      TSFMappedFile(const std::string& fileName);
+      ~TSFMappedFile();
+
+      bool IsOpen() { return data_ != NULL; };
+      const uint8_t* GetData() { return data_; };
+      uint64_t GetSize() { return size_; };
+
+   private:
+      TSFMappedFile(const TSFMappedFile&);
+      TSFMappedFile& operator=(const TSFMappedFile&);
+
+      const uint8_t* data_;
+      uint64_t size_;
+};
+
+class TSFRecords
+{
+   public:
+      // Offset of the first spot in a tsf file (after the magic nr and offset)
+      static const uint64_t SPOTSSTART = 12;
+      // Nr of bytes needed to encode a single field: a two byte tag (field
+      // numbers are at most 2047) and a value of up to 10 bytes
+      static const int MAXFIELDBYTES = 12;
+
+      /**
+       * Reads the SpotList of a tsf file, and returns the offset of the
+       * SpotList relative to the first spot (i.e. the size of the spot data)
+       */
+      static uint64_t ReadHeader(const std::string& fileName,
+            TSF::SpotList* sl) throw (TSFException);
+
+      static inline bool ReadVarint32(const uint8_t** p, const uint8_t* end,
+            uint32_t* val)
+      {
+         uint32_t result = 0;
+         for (int shift = 0; shift < 35 && *p < end; shift += 7)
+         {
+            uint8_t b = *(*p)++;
+            result |= (uint32_t) (b & 0x7F) << shift;
+            if ((b & 0x80) == 0)
+            {
+               *val = result;
+               return true;
+            }
+         }
+         return false;
+      };
+
+      /**
+       * Reads the size prefix of the spot at p, points record to the spot
+       * and moves p past it.  Returns false when there is no complete spot
+       * between p and end
+       */
+      static inline bool NextRecord(const uint8_t** p, const uint8_t* end,
+            const uint8_t** record, uint32_t* size)
+      {
+         const uint8_t* q = *p;
+         if (!ReadVarint32(&q, end, size) || *size > (uint64_t) (end - q))
+            return false;
+         *record = q;
+         *p = q + *size;
+         return true;
+      };
+
+      // nr of complete spots between p and end
+      static uint64_t CountRecords(const uint8_t* p, const uint8_t* end);
+
+      /**
+       * Source of the values of a single field when encoding spots.  data
+       * holds int32_t values (integer and enum fields) or float values
+       * (isFloat).  NULL data (only used for molecule) encodes the ordinal
+       * of the spot
+       */
+      struct Column
+      {
+         int number;
+         bool isFloat;
+         const void* data;
+      };
+
+      /**
+       * Adds a molecule column when there is none, and sorts the columns by
+       * field number, the order in which they are encoded.  Returns false,
+       * with missing set to its name, when another required Spot field
+       * has no column
+       */
+      static bool CompleteColumns(std::vector<Column>& columns,
+            std::string* missing);
+
+      /**
+       * Encodes spot i of the (completed) columns into buf, which should
+       * have room for columns.size() * MAXFIELDBYTES bytes.  ordinal is
+       * used for molecule when not given.  Returns the nr of bytes used
+       */
+      static uint32_t EncodeSpot(const std::vector<Column>& columns,
+            uint64_t i, int64_t ordinal, uint8_t* buf);
+};
+
+#endif
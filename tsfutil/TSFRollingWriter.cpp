@@ -0,0 +1,230 @@
+/**
+ * Writes spots to a series of tsf files (parts) that each hold a limited
+ * nr of bytes or frames, and a manifest that lists the parts
+ *
+ * Each part is written by its own TSFUtils instance.  The manifest is
+ * written to a temporary file that is then renamed, so that a process
+ * watching the manifest never sees a partially written one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "TSFRollingWriter.h"
+#include "TSFTrace.h"
+#include <google/protobuf/io/coded_stream.h>
+
+// Size of the magic number and header offset at the start of a tsf file
+static const uint64_t SPOTSSTART = 12;
+
+
+TSFRollingWriter::TSFRollingWriter(const std::string& fileName,
+      const TSF::SpotList& sl, uint64_t maxBytes, int32_t maxFrames,
+      TSFMetrics* metrics) throw (TSFException) :
+   maxBytes_(maxBytes),
+   maxFrames_(maxFrames),
+   metrics_(metrics),
+   part_(NULL),
+   closed_(false),
+   lastFrame_(0),
+   lastHasFrame_(false)
+{
+   std::string base = fileName;
+   if (base.size() > 4 && base.compare(base.size() - 4, 4, ".tsf") == 0)
+      base.erase(base.size() - 4);
+   size_t slash = base.rfind('/');
+   if (slash != std::string::npos)
+   {
+      directory_ = base.substr(0, slash + 1);
+      baseName_ = base.substr(slash + 1);
+   }
+   else
+      baseName_ = base;
+   if (baseName_.empty())
+      throw TSFException("No file name given for the parts of " + fileName);
+   manifestName_ = base + ".manifest";
+   spotList_.CopyFrom(sl);
+}
+
+TSFRollingWriter::~TSFRollingWriter()
+{
+   delete part_;
+   if (fs_.is_open())
+      fs_.close();
+}
+
+void TSFRollingWriter::WriteSpotBinary(TSF::Spot* spot) throw (TSFException)
+{
+   uint64_t start = metrics_ != NULL ? TSFMetrics::Now() : 0;
+   spot->SerializeToString(&record_);
+   if (metrics_ != NULL)
+      metrics_->AddTime(TSFMetrics::SERIALIZE, TSFMetrics::Now() - start);
+   Write((const uint8_t*) record_.data(), record_.size(), spot->has_frame(),
+         spot->frame());
+}
+
+void TSFRollingWriter::WriteSpotBinary(const uint8_t* data, uint32_t size)
+      throw (TSFException)
+{
+   TSFSpotView view(data, size);
+   int32_t frame = 0;
+   bool hasFrame = view.GetInt32(TSF::Spot::kFrameFieldNumber, &frame);
+   Write(data, size, hasFrame, frame);
+}
+
+void TSFRollingWriter::WriteSpotsBinary(std::vector<TSF::Spot>& spots,
+      uint32_t nrSpots) throw (TSFException)
+{
+   if (nrSpots > spots.size())
+      nrSpots = spots.size();
+   TSFTraceScope scope("write", "TSFRollingWriter");
+   scope.SetSpots(nrSpots);
+   for (uint32_t i = 0; i < nrSpots; i++)
+      WriteSpotBinary(&spots[i]);
+}
+
+void TSFRollingWriter::Write(const uint8_t* data, uint32_t size,
+      bool hasFrame, int32_t frame) throw (TSFException)
+{
+   if (closed_)
+      throw TSFException("Can not write spots after Close");
+
+   if (part_ != NULL)
+   {
+      Part& current = parts_.back();
+      bool newFrame = !hasFrame || !lastHasFrame_ || frame != lastFrame_;
+      bool full = maxFrames_ > 0 && hasFrame &&
+            (int64_t) frame - current.firstFrame >= maxFrames_;
+      if (!full)
+         full = maxBytes_ > 0 && newFrame && current.bytes >= maxBytes_;
+      if (full)
+         FinishPart();
+   }
+   if (part_ == NULL)
+      StartPart(hasFrame ? frame : 0);
+
+   part_->WriteSpotBinary(data, size);
+   Part& current = parts_.back();
+   current.nrSpots++;
+   current.bytes += google::protobuf::io::CodedOutputStream::VarintSize32(size)
+      + size;
+   if (hasFrame)
+      current.lastFrame = frame;
+   lastFrame_ = frame;
+   lastHasFrame_ = hasFrame;
+}
+
+void TSFRollingWriter::StartPart(int32_t frame) throw (TSFException)
+{
+   char number[16];
+   snprintf(number, sizeof(number), "_%04u", (unsigned int) parts_.size());
+   Part part;
+   part.fileName = baseName_ + number + ".tsf";
+   part.nrSpots = 0;
+   part.firstFrame = frame;
+   part.lastFrame = frame;
+   part.bytes = SPOTSSTART;
+
+   std::string path = directory_ + part.fileName;
+   fs_.open(path.c_str(), std::ios_base::in | std::ios_base::out |
+         std::ios_base::trunc | std::ios_base::binary);
+   if (!fs_.is_open())
+      throw TSFException("Failed to open " + path);
+   part_ = new TSFUtils(&fs_, TSFUtils::WRITE, metrics_);
+   parts_.push_back(part);
+}
+
+void TSFRollingWriter::FinishPart() throw (TSFException)
+{
+   TSFTraceScope scope("finish part", "TSFRollingWriter");
+   Part& part = parts_.back();
+   scope.SetSpots(part.nrSpots);
+
+   TSF::SpotList sl;
+   sl.CopyFrom(spotList_);
+   sl.set_nr_spots(part.nrSpots);
+   part_->WriteHeaderBinary(&sl);
+   delete part_;
+   part_ = NULL;
+
+   fs_.seekp(0, std::ios_base::end);
+   part.bytes = fs_.tellp();
+   bool good = fs_.good();
+   fs_.close();
+   if (!good)
+      throw TSFException("Failed to write " + directory_ + part.fileName);
+
+   WriteManifest(false);
+}
+
+void TSFRollingWriter::Close() throw (TSFException)
+{
+   if (closed_)
+      return;
+   if (part_ != NULL)
+      FinishPart();
+   WriteManifest(true);
+   closed_ = true;
+}
+
+void TSFRollingWriter::WriteManifest(bool complete) throw (TSFException)
+{
+   std::string tmpName = manifestName_ + ".tmp";
+   std::ofstream ofs;
+   ofs.open(tmpName.c_str(), std::ios_base::out | std::ios_base::trunc);
+   if (!ofs.is_open())
+      throw TSFException("Failed to open " + tmpName);
+
+   // only finished parts are listed
+   size_t nrParts = parts_.size() - (part_ != NULL ? 1 : 0);
+   ofs << "parts: " << nrParts << "\n";
+   ofs << "complete: " << (complete ? 1 : 0) << "\n";
+   ofs << "file\tnr_spots\tfirst_frame\tlast_frame\tbytes\n";
+   for (size_t i = 0; i < nrParts; i++)
+   {
+      const Part& part = parts_[i];
+      ofs << part.fileName << "\t" << part.nrSpots << "\t" << part.firstFrame
+         << "\t" << part.lastFrame << "\t" << part.bytes << "\n";
+   }
+   ofs.close();
+   if (ofs.fail())
+      throw TSFException("Failed to write " + tmpName);
+   if (rename(tmpName.c_str(), manifestName_.c_str()) != 0)
+      throw TSFException("Failed to write " + manifestName_);
+}
+
+bool TSFRollingWriter::ReadManifest(const std::string& manifestName,
+      std::vector<std::string>* fileNames) throw (TSFException)
+{
+   std::ifstream ifs;
+   ifs.open(manifestName.c_str(), std::ios_base::in);
+   if (!ifs.is_open())
+      throw TSFException("Failed to open " + manifestName);
+
+   std::string directory;
+   size_t slash = manifestName.rfind('/');
+   if (slash != std::string::npos)
+      directory = manifestName.substr(0, slash + 1);
+
+   bool complete = false;
+   bool table = false;
+   std::string line;
+   while (std::getline(ifs, line))
+   {
+      if (line.empty())
+         continue;
+      if (!table)
+      {
+         if (line.compare(0, 10, "complete: ") == 0)
+            complete = atoi(line.c_str() + 10) != 0;
+         else if (line.compare(0, 5, "file\t") == 0)
+            table = true;
+         continue;
+      }
+      std::string name = line.substr(0, line.find('\t'));
+      fileNames->push_back(name[0] == '/' ? name : directory + name);
+   }
+   if (!table)
+      throw TSFException(manifestName + " is not a tsf manifest");
+   return complete;
+}
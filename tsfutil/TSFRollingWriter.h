@@ -0,0 +1,116 @@
+/**
+ * Writes spots to a series of tsf files (parts) that each hold a limited
+ * nr of bytes or frames, and a manifest that lists the parts
+ */
+
+#ifndef TSFROLLINGWRITER_H
+#define TSFROLLINGWRITER_H
+
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../buildcpp/TSFProto.pb.h"
+#include "TSFException.h"
+#include "TSFMetrics.h"
+#include "TSFUtils.h"
+
+
+/**
+ * For fileName "/data/run1.tsf", the parts are "/data/run1_0000.tsf",
+ * "/data/run1_0001.tsf", etc., and the manifest is "/data/run1.manifest".
+ * A part is finished (its SpotList written and its file closed) as soon as
+ * the next one is started, and the manifest is then rewritten, so that the
+ * parts listed in the manifest can be processed while spots are still
+ * being written.  The manifest is a text file:
+ *
+ *    parts: 2
+ *    complete: 0
+ *    file	nr_spots	first_frame	last_frame	bytes
+ *    run1_0000.tsf	1200311	1	500	40172618
+ *    run1_0001.tsf	1187002	501	1000	39712035
+ *
+ * with tab separated columns and the names of the parts relative to the
+ * directory of the manifest.  complete is set to 1 by Close.
+ *
+ * A new part is started before a spot whose frame lies maxFrames or more
+ * beyond the first frame of the current part, or before the first spot of
+ * a new frame once the current part holds maxBytes or more.  Spots of one
+ * frame therefore always end up in the same part (spots without a frame
+ * each count as a frame of their own), and frames are expected to be
+ * written in increasing order.  A limit of 0 is not used.
+ *
+ * Every part gets the SpotList given to the constructor or to SetSpotList,
+ * with nr_spots set to the nr of spots of the part.
+ */
+class TSFRollingWriter
+{
+   public:
+      struct Part
+      {
+         std::string fileName;
+         uint64_t nrSpots;
+         int32_t firstFrame;
+         int32_t lastFrame;
+         uint64_t bytes;
+      };
+
+      TSFRollingWriter(const std::string& fileName, const TSF::SpotList& sl,
+            uint64_t maxBytes, int32_t maxFrames, TSFMetrics* metrics = NULL)
+         throw (TSFException);
+      ~TSFRollingWriter();
+
+      // SpotList for the parts that are finished from now on
+      void SetSpotList(const TSF::SpotList& sl) { spotList_.CopyFrom(sl); };
+
+      void WriteSpotBinary(TSF::Spot* spot) throw (TSFException);
+      // data should hold a valid Spot in protobuf wire format
+      void WriteSpotBinary(const uint8_t* data, uint32_t size)
+         throw (TSFException);
+      void WriteSpotsBinary(std::vector<TSF::Spot>& spots, uint32_t nrSpots)
+         throw (TSFException);
+
+      /**
+       * Finishes the last part and marks the manifest complete (without
+       * parts when no spots were written, since a tsf file can not be
+       * empty).  Without a call to Close, the last part is left without
+       * SpotList
+       */
+      void Close() throw (TSFException);
+
+      const std::vector<Part>& GetParts() { return parts_; };
+      const std::string& GetManifestName() { return manifestName_; };
+
+      /**
+       * Reads a manifest written by TSFRollingWriter.  Fills fileNames with
+       * the paths of the parts and returns whether the set is complete
+       */
+      static bool ReadManifest(const std::string& manifestName,
+            std::vector<std::string>* fileNames) throw (TSFException);
+
+   private:
+      void Write(const uint8_t* data, uint32_t size, bool hasFrame,
+            int32_t frame) throw (TSFException);
+      void StartPart(int32_t frame) throw (TSFException);
+      void FinishPart() throw (TSFException);
+      void WriteManifest(bool complete) throw (TSFException);
+
+      std::string directory_;
+      std::string baseName_;
+      std::string manifestName_;
+      TSF::SpotList spotList_;
+      uint64_t maxBytes_;
+      int32_t maxFrames_;
+      TSFMetrics* metrics_;
+
+      std::vector<Part> parts_;
+      std::fstream fs_;
+      TSFUtils* part_;
+      bool closed_;
+      // frame of the last spot written to the current part
+      int32_t lastFrame_;
+      bool lastHasFrame_;
+      std::string record_;
+};
+
+#endif
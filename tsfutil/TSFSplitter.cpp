@@ -0,0 +1,201 @@
+/**
+ * Writes spots to one tsf file (shard) per channel, position, slice and/or
+ * range of frames, in a single pass over the input
+ *
+ * Each shard is written by its own TSFUtils instance.  Spots given in wire
+ * format are routed using a TSFSpotView, so that they are not decoded.
+ */
+
+#include <stdio.h>
+
+#include "TSFSplitter.h"
+#include "TSFTrace.h"
+
+
+bool TSFSplitter::ShardKey::operator<(const ShardKey& other) const
+{
+   for (int i = 0; i < 4; i++)
+   {
+      if (values[i] != other.values[i])
+         return values[i] < other.values[i];
+   }
+   return false;
+}
+
+bool TSFSplitter::ShardKey::operator==(const ShardKey& other) const
+{
+   for (int i = 0; i < 4; i++)
+   {
+      if (values[i] != other.values[i])
+         return false;
+   }
+   return true;
+}
+
+
+TSFSplitter::TSFSplitter(const std::string& fileName, const TSF::SpotList& sl,
+      int keys, int32_t framesPerShard, TSFMetrics* metrics)
+      throw (TSFException) :
+   keys_(keys),
+   framesPerShard_(framesPerShard),
+   metrics_(metrics),
+   lastShard_(0),
+   closed_(false)
+{
+   if ((keys_ & (CHANNEL | POS | SLICE | FRAMES)) == 0)
+      throw TSFException("No fields given to split the spots by");
+   if ((keys_ & FRAMES) && framesPerShard_ < 1)
+      throw TSFException("The nr of frames per shard should be at least 1");
+
+   base_ = fileName;
+   if (base_.size() > 4 && base_.compare(base_.size() - 4, 4, ".tsf") == 0)
+      base_.erase(base_.size() - 4);
+   spotList_.CopyFrom(sl);
+}
+
+TSFSplitter::~TSFSplitter()
+{
+   for (size_t i = 0; i < outputs_.size(); i++)
+   {
+      delete outputs_[i]->tsfOut;
+      if (outputs_[i]->fs.is_open())
+         outputs_[i]->fs.close();
+      delete outputs_[i];
+   }
+}
+
+void TSFSplitter::WriteSpotBinary(TSF::Spot* spot) throw (TSFException)
+{
+   uint64_t start = metrics_ != NULL ? TSFMetrics::Now() : 0;
+   spot->SerializeToString(&record_);
+   if (metrics_ != NULL)
+      metrics_->AddTime(TSFMetrics::SERIALIZE, TSFMetrics::Now() - start);
+   Write((const uint8_t*) record_.data(), record_.size(), spot->channel(),
+         spot->pos(), spot->slice(), spot->frame());
+}
+
+void TSFSplitter::WriteSpotBinary(const uint8_t* data, uint32_t size)
+      throw (TSFException)
+{
+   view_.Reset(data, size);
+   Write(data, size, view_.channel(), view_.pos(), view_.slice(),
+         view_.frame());
+}
+
+void TSFSplitter::WriteSpotsBinary(std::vector<TSF::Spot>& spots,
+      uint32_t nrSpots) throw (TSFException)
+{
+   if (nrSpots > spots.size())
+      nrSpots = spots.size();
+   TSFTraceScope scope("write", "TSFSplitter");
+   scope.SetSpots(nrSpots);
+   for (uint32_t i = 0; i < nrSpots; i++)
+      WriteSpotBinary(&spots[i]);
+}
+
+void TSFSplitter::Write(const uint8_t* data, uint32_t size, int32_t channel,
+      int32_t pos, int32_t slice, int32_t frame) throw (TSFException)
+{
+   if (closed_)
+      throw TSFException("Can not write spots after Close");
+
+   ShardKey key;
+   key.values[0] = (keys_ & CHANNEL) ? channel : 0;
+   key.values[1] = (keys_ & POS) ? pos : 0;
+   key.values[2] = (keys_ & SLICE) ? slice : 0;
+   // frames are 1-based
+   key.values[3] = (keys_ & FRAMES) ?
+      ((frame - 1) / framesPerShard_) * framesPerShard_ + 1 : 0;
+
+   size_t shard;
+   if (!shards_.empty() && key == lastKey_)
+      shard = lastShard_;
+   else
+   {
+      std::map<ShardKey, size_t>::iterator it = index_.find(key);
+      shard = it != index_.end() ? it->second : AddShard(key);
+      lastKey_ = key;
+      lastShard_ = shard;
+   }
+
+   outputs_[shard]->tsfOut->WriteSpotBinary(data, size);
+   shards_[shard].nrSpots++;
+}
+
+size_t TSFSplitter::AddShard(const ShardKey& key) throw (TSFException)
+{
+   Shard shard;
+   shard.fileName = base_;
+   shard.nrSpots = 0;
+   shard.channel = key.values[0];
+   shard.pos = key.values[1];
+   shard.slice = key.values[2];
+   shard.frame = key.values[3];
+
+   char part[32];
+   if (keys_ & CHANNEL)
+   {
+      snprintf(part, sizeof(part), "_ch%d", shard.channel);
+      shard.fileName += part;
+   }
+   if (keys_ & POS)
+   {
+      snprintf(part, sizeof(part), "_pos%d", shard.pos);
+      shard.fileName += part;
+   }
+   if (keys_ & SLICE)
+   {
+      snprintf(part, sizeof(part), "_slice%d", shard.slice);
+      shard.fileName += part;
+   }
+   if (keys_ & FRAMES)
+   {
+      snprintf(part, sizeof(part), "_frame%d", shard.frame);
+      shard.fileName += part;
+   }
+   shard.fileName += ".tsf";
+
+   Output* output = new Output();
+   output->tsfOut = NULL;
+   outputs_.push_back(output);
+   output->fs.open(shard.fileName.c_str(), std::ios_base::in |
+         std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+   if (!output->fs.is_open())
+      throw TSFException("Failed to open " + shard.fileName);
+   output->tsfOut = new TSFUtils(&output->fs, TSFUtils::WRITE, metrics_);
+
+   shards_.push_back(shard);
+   index_[key] = shards_.size() - 1;
+   return shards_.size() - 1;
+}
+
+void TSFSplitter::Close() throw (TSFException)
+{
+   if (closed_)
+      return;
+   closed_ = true;
+
+   TSFTraceScope scope("close", "TSFSplitter");
+   for (size_t i = 0; i < shards_.size(); i++)
+   {
+      TSF::SpotList sl;
+      sl.CopyFrom(spotList_);
+      sl.set_nr_spots(shards_[i].nrSpots);
+      if (keys_ & CHANNEL)
+         sl.set_nr_channels(1);
+      if (keys_ & POS)
+         sl.set_nr_pos(1);
+      if (keys_ & SLICE)
+         sl.set_nr_slices(1);
+
+      Output* output = outputs_[i];
+      output->tsfOut->WriteHeaderBinary(&sl);
+      delete output->tsfOut;
+      output->tsfOut = NULL;
+
+      bool good = output->fs.good();
+      output->fs.close();
+      if (!good)
+         throw TSFException("Failed to write " + shards_[i].fileName);
+   }
+}
@@ -0,0 +1,117 @@
+/**
+ * Writes spots to one tsf file (shard) per channel, position, slice and/or
+ * range of frames, in a single pass over the input
+ */
+
+#ifndef TSFSPLITTER_H
+#define TSFSPLITTER_H
+
+#include <fstream>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../buildcpp/TSFProto.pb.h"
+#include "TSFException.h"
+#include "TSFMetrics.h"
+#include "TSFSpotView.h"
+#include "TSFUtils.h"
+
+
+/**
+ * keys is a combination (or) of CHANNEL, POS, SLICE and FRAMES.  Every
+ * combination of values of these fields gets its own shard, which is
+ * created when its first spot arrives.  For fileName "/data/run1.tsf" and
+ * keys CHANNEL | POS, the spots of channel 2 at position 5 go to
+ * "/data/run1_ch2_pos5.tsf".  With FRAMES, frames are grouped in ranges of
+ * framesPerShard frames (1 - framesPerShard, framesPerShard + 1 - ...),
+ * and the first frame of the range is added to the name ("_frame501").
+ * Absent pos or slice fields count as 0.
+ *
+ * Every shard gets the SpotList given to the constructor or to SetSpotList,
+ * with nr_spots set to the nr of spots of the shard, and nr_channels,
+ * nr_pos and nr_slices set to 1 when the shards are split by that field.
+ * The order of the spots within a shard is that of the input.  All shards
+ * are kept open until Close, so that the nr of shards is limited by the
+ * nr of files a process can open.
+ */
+class TSFSplitter
+{
+   public:
+      enum Key {
+         CHANNEL = 1,
+         POS = 2,
+         SLICE = 4,
+         FRAMES = 8
+      };
+
+      struct Shard
+      {
+         std::string fileName;
+         uint64_t nrSpots;
+         int32_t channel;
+         int32_t pos;
+         int32_t slice;
+         // first frame of the range of frames, with FRAMES
+         int32_t frame;
+      };
+
+      TSFSplitter(const std::string& fileName, const TSF::SpotList& sl,
+            int keys, int32_t framesPerShard = 0, TSFMetrics* metrics = NULL)
+         throw (TSFException);
+      ~TSFSplitter();
+
+      // SpotList for the shards, used by Close
+      void SetSpotList(const TSF::SpotList& sl) { spotList_.CopyFrom(sl); };
+
+      void WriteSpotBinary(TSF::Spot* spot) throw (TSFException);
+      // data should hold a valid Spot in protobuf wire format
+      void WriteSpotBinary(const uint8_t* data, uint32_t size)
+         throw (TSFException);
+      void WriteSpotsBinary(std::vector<TSF::Spot>& spots, uint32_t nrSpots)
+         throw (TSFException);
+
+      /**
+       * Writes the SpotList of every shard and closes the shards
+       */
+      void Close() throw (TSFException);
+
+      // the shards, in the order in which they were created
+      const std::vector<Shard>& GetShards() { return shards_; };
+
+   private:
+      struct ShardKey
+      {
+         int32_t values[4];
+         bool operator<(const ShardKey& other) const;
+         bool operator==(const ShardKey& other) const;
+      };
+
+      struct Output
+      {
+         std::fstream fs;
+         TSFUtils* tsfOut;
+      };
+
+      void Write(const uint8_t* data, uint32_t size, int32_t channel,
+            int32_t pos, int32_t slice, int32_t frame) throw (TSFException);
+      size_t AddShard(const ShardKey& key) throw (TSFException);
+
+      std::string base_;
+      TSF::SpotList spotList_;
+      int keys_;
+      int32_t framesPerShard_;
+      TSFMetrics* metrics_;
+
+      std::vector<Shard> shards_;
+      std::vector<Output*> outputs_;
+      std::map<ShardKey, size_t> index_;
+      // consecutive spots often go to the same shard
+      ShardKey lastKey_;
+      size_t lastShard_;
+      bool closed_;
+      TSFSpotView view_;
+      std::string record_;
+};
+
+#endif
@@ -0,0 +1,138 @@
+/**
+ * Iteration over the spots of a tsf file with standard input iterators
+ *
+ *    TSFSpotRange<TSFUtils> spots = tsfIn->Spots();
+ *    for (TSFSpotRange<TSFUtils>::iterator it = spots.begin();
+ *          it != spots.end(); ++it)
+ *       sum += it->x();
+ *
+ * or, in C++11, for (const TSF::Spot& spot : tsfIn->Spots()).
+ */
+
+#ifndef TSFSPOTITERATOR_H
+#define TSFSPOTITERATOR_H
+
+#include <cstddef>
+#include <iterator>
+#include <vector>
+#include "../buildcpp/TSFProto.pb.h"
+
+
+/**
+ * Selection of spots, to be used with TSFSpotRange::Where
+ */
+class TSFSpotFilter
+{
+   public:
+      virtual ~TSFSpotFilter() {};
+      virtual bool Accept(const TSF::Spot& spot) const = 0;
+};
+
+template <class Source> class TSFSpotIterator;
+
+/**
+ * The spots that remain in a reader (Source), optionally limited to those
+ * accepted by one or more filters.  Source should have a member
+ * bool NextSpot(TSF::Spot* spot) that reads the next spot into spot and
+ * returns false after the last spot.
+ * A single Spot message, owned by the range, is reused for all spots, and
+ * is overwritten whenever an iterator is incremented.  Since the reader
+ * moves forward while iterating, leaving the loop early (break) leaves the
+ * reader positioned after the last spot that was seen, and only a single
+ * pass over the spots is possible.  The range should outlive its iterators.
+ */
+template <class Source>
+class TSFSpotRange
+{
+   public:
+      typedef TSFSpotIterator<Source> iterator;
+      typedef TSFSpotIterator<Source> const_iterator;
+
+      explicit TSFSpotRange(Source* source) : source_(source) {};
+
+      /**
+       * Returns a range that in addition only contains spots accepted by
+       * filter, which should outlive the range
+       */
+      TSFSpotRange Where(const TSFSpotFilter& filter) const
+      {
+         TSFSpotRange range(*this);
+         range.filters_.push_back(&filter);
+         return range;
+      };
+
+      iterator begin() { return iterator(this); };
+      iterator end() { return iterator(); };
+
+      bool Next()
+      {
+         while (source_->NextSpot(&spot_))
+         {
+            bool accepted = true;
+            for (size_t i = 0; i < filters_.size() && accepted; i++)
+               accepted = filters_[i]->Accept(spot_);
+            if (accepted)
+               return true;
+         }
+         return false;
+      };
+
+      const TSF::Spot& Current() const { return spot_; };
+
+   private:
+      Source* source_;
+      TSF::Spot spot_;
+      std::vector<const TSFSpotFilter*> filters_;
+};
+
+/**
+ * Input iterator over a TSFSpotRange.  A default constructed iterator marks
+ * the end of the range.
+ */
+template <class Source>
+class TSFSpotIterator
+{
+   public:
+      typedef std::input_iterator_tag iterator_category;
+      typedef TSF::Spot value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef const TSF::Spot* pointer;
+      typedef const TSF::Spot& reference;
+
+      TSFSpotIterator() : range_(NULL) {};
+      explicit TSFSpotIterator(TSFSpotRange<Source>* range) : range_(range)
+      {
+         if (!range_->Next())
+            range_ = NULL;
+      };
+
+      reference operator*() const { return range_->Current(); };
+      pointer operator->() const { return &range_->Current(); };
+
+      TSFSpotIterator& operator++()
+      {
+         if (!range_->Next())
+            range_ = NULL;
+         return *this;
+      };
+      TSFSpotIterator operator++(int)
+      {
+         TSFSpotIterator previous(*this);
+         ++*this;
+         return previous;
+      };
+
+      bool operator==(const TSFSpotIterator& other) const
+      {
+         return range_ == other.range_;
+      };
+      bool operator!=(const TSFSpotIterator& other) const
+      {
+         return range_ != other.range_;
+      };
+
+   private:
+      TSFSpotRange<Source>* range_;
+};
+
+#endif
@@ -0,0 +1,274 @@
+/**
+ * Read-only view of a single spot in protobuf wire format, that decodes
+ * fields when they are accessed
+ *
+ * Protocol buffers do not guarantee the order of fields, and allow a field
+ * to occur more than once (in which case the last value counts), so all
+ * tags of a spot are walked before any value can be returned.  This is
+ * done once per spot, for all fields at the same time.
+ */
+
+#include <string.h>
+
+#include "TSFSpotView.h"
+#include <google/protobuf/wire_format_lite.h>
+
+using google::protobuf::internal::WireFormatLite;
+
+
+static inline bool ReadVarint64(const uint8_t** p, const uint8_t* end,
+      uint64_t* val)
+{
+   uint64_t result = 0;
+   for (int shift = 0; shift < 70 && *p < end; shift += 7)
+   {
+      uint8_t b = *(*p)++;
+      result |= (uint64_t) (b & 0x7F) << shift;
+      if ((b & 0x80) == 0)
+      {
+         *val = result;
+         return true;
+      }
+   }
+   return false;
+}
+
+static inline uint32_t ReadFixed32(const uint8_t* p)
+{
+   return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) |
+      ((uint32_t) p[3] << 24);
+}
+
+
+TSFSpotView::TSFSpotView() :
+   data_(NULL),
+   size_(0),
+   overlays_(NULL),
+   ordinal_(0),
+   indexed_(false),
+   generation_(1)
+{
+   memset(stamps_, 0, sizeof(stamps_));
+}
+
+TSFSpotView::TSFSpotView(const uint8_t* data, uint32_t size) :
+   data_(data),
+   size_(size),
+   overlays_(NULL),
+   ordinal_(0),
+   indexed_(false),
+   generation_(1)
+{
+   memset(stamps_, 0, sizeof(stamps_));
+}
+
+void TSFSpotView::Reset(const uint8_t* data, uint32_t size,
+      const std::vector<TSFOverlay*>* overlays, uint64_t ordinal)
+{
+   data_ = data;
+   size_ = size;
+   overlays_ = overlays;
+   ordinal_ = ordinal;
+   indexed_ = false;
+   if (++generation_ == 0)
+   {
+      memset(stamps_, 0, sizeof(stamps_));
+      generation_ = 1;
+   }
+}
+
+/**
+ * Walks the tags of the spot.  With a negative fieldNumber, the location of
+ * every field below MAXINDEXED is stored in the index, otherwise the value 
+ * of the given field is returned in bits.  Stops at the first malformed tag
+ * or value.
+ */
+void TSFSpotView::Walk(int fieldNumber, uint32_t* bits, bool* found) const
+{
+   const uint8_t* p = data_;
+   const uint8_t* end = data_ + size_;
+   while (p < end)
+   {
+      uint64_t tag;
+      if (!ReadVarint64(&p, end, &tag))
+         return;
+      uint64_t number = tag >> 3;
+      uint8_t wireType = tag & 7;
+      const uint8_t* value = p;
+      switch (wireType)
+      {
+         case 0: // varint
+         {
+            uint64_t varint;
+            if (!ReadVarint64(&p, end, &varint))
+               return;
+            if ((int64_t) number == fieldNumber)
+            {
+               *bits = (uint32_t) varint;
+               *found = true;
+            }
+            break;
+         }
+         case 5: // 32 bit, little endian
+            if (end - p < 4)
+               return;
+            if ((int64_t) number == fieldNumber)
+            {
+               *bits = ReadFixed32(p);
+               *found = true;
+            }
+            p += 4;
+            break;
+         case 1: // 64 bit
+            if (end - p < 8)
+               return;
+            p += 8;
+            break;
+         case 2: // length delimited
+         {
+            uint64_t length;
+            if (!ReadVarint64(&p, end, &length) ||
+                  length > (uint64_t) (end - p))
+               return;
+            p += length;
+            break;
+         }
+         default: // groups are not used in tsf files
+            return;
+      }
+      if (fieldNumber < 0 && number < (uint64_t) MAXINDEXED &&
+            (wireType == 0 || wireType == 5))
+      {
+         stamps_[number] = generation_;
+         offsets_[number] = value - data_;
+         wireTypes_[number] = wireType;
+      }
+   }
+}
+
+/**
+ * Looks for the field in the overlays and in the spot, and returns its
+ * value as 32 raw bits (int32 and enum values are truncated to 32 bits as
+ * protocol buffers do, float values are returned as is).  When a field
+ * occurs more than once in the spot, the last value counts.
+ */
+bool TSFSpotView::Find(int fieldNumber, uint32_t* bits) const
+{
+   if (overlays_ != NULL)
+   {
+      for (unsigned int i = 0; i < overlays_->size(); i++)
+      {
+         TSFOverlay* overlay = (*overlays_)[i];
+         int32_t value;
+         if (overlay->GetFieldNumber() == fieldNumber &&
+               overlay->GetBits(ordinal_, &value))
+         {
+            *bits = (uint32_t) value;
+            return true;
+         }
+      }
+   }
+
+   if (fieldNumber < 0 || fieldNumber >= MAXINDEXED)
+   {
+      bool found = false;
+      Walk(fieldNumber, bits, &found);
+      return found;
+   }
+
+   if (!indexed_)
+   {
+      bool found = false;
+      Walk(-1, bits, &found);
+      indexed_ = true;
+   }
+   if (stamps_[fieldNumber] != generation_)
+      return false;
+   const uint8_t* p = data_ + offsets_[fieldNumber];
+   if (wireTypes_[fieldNumber] == 5)
+   {
+      *bits = ReadFixed32(p);
+      return true;
+   }
+   uint64_t varint = 0;
+   ReadVarint64(&p, data_ + size_, &varint);
+   *bits = (uint32_t) varint;
+   return true;
+}
+
+bool TSFSpotView::Has(int fieldNumber) const
+{
+   uint32_t bits;
+   return Find(fieldNumber, &bits);
+}
+
+bool TSFSpotView::GetInt32(int fieldNumber, int32_t* value) const
+{
+   uint32_t bits;
+   if (!Find(fieldNumber, &bits))
+      return false;
+   *value = (int32_t) bits;
+   return true;
+}
+
+bool TSFSpotView::GetFloat(int fieldNumber, float* value) const
+{
+   uint32_t bits;
+   if (!Find(fieldNumber, &bits))
+      return false;
+   memcpy(value, &bits, sizeof(float));
+   return true;
+}
+
+void TSFSpotView::GetRecord(std::string* buffer, const uint8_t** data,
+      uint32_t* size) const
+{
+   *data = data_;
+   *size = size_;
+   if (overlays_ == NULL)
+      return;
+   bool copied = false;
+   for (unsigned int i = 0; i < overlays_->size(); i++)
+   {
+      TSFOverlay* overlay = (*overlays_)[i];
+      int32_t bits;
+      if (!overlay->GetBits(ordinal_, &bits))
+         continue;
+      if (!copied)
+      {
+         buffer->assign((const char*) data_, size_);
+         copied = true;
+      }
+      // a tag and an int32 (sign extended to 10 bytes) or a float
+      uint8_t field[15];
+      uint8_t* end;
+      if (overlay->IsFloat())
+      {
+         float value;
+         memcpy(&value, &bits, sizeof(value));
+         end = WireFormatLite::WriteFloatToArray(overlay->GetFieldNumber(),
+               value, field);
+      }
+      else
+         end = WireFormatLite::WriteInt32ToArray(overlay->GetFieldNumber(),
+               bits, field);
+      buffer->append((const char*) field, end - field);
+   }
+   if (copied)
+   {
+      *data = (const uint8_t*) buffer->data();
+      *size = buffer->size();
+   }
+}
+
+bool TSFSpotView::ToSpot(TSF::Spot* spot) const
+{
+   if (!spot->ParseFromArray(data_, size_))
+      return false;
+   if (overlays_ != NULL)
+   {
+      for (unsigned int i = 0; i < overlays_->size(); i++)
+         (*overlays_)[i]->Apply(spot, ordinal_);
+   }
+   return true;
+}
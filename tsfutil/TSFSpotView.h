@@ -0,0 +1,129 @@
+/**
+ * Read-only view of a single spot in protobuf wire format, that decodes
+ * fields when they are accessed
+ */
+
+#ifndef TSFSPOTVIEW_H
+#define TSFSPOTVIEW_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../buildcpp/TSFProto.pb.h"
+#include "TSFOverlay.h"
+
+
+/**
+ * Wraps the raw bytes of one spot (e.g. in a memory mapped file or the
+ * buffer of a reader), without copying them and without constructing a
+ * Spot message.  The first access walks the tags of the spot once and
+ * remembers where the values of the fields of Spot are, without decoding
+ * them, and every accessor then only decodes its own field.  This is much
+ * cheaper than parsing all fields when only a few are used.  Accessors are
+ * named after
+ * those of TSF::Spot and return 0 for absent fields.  Values of overlays
+ * (see TSFOverlay) take precedence over the values in the record.
+ * The view is only valid as long as the bytes it wraps.
+ */
+class TSFSpotView
+{
+   public:
+      TSFSpotView();
+      TSFSpotView(const uint8_t* data, uint32_t size);
+
+      void Reset(const uint8_t* data, uint32_t size,
+            const std::vector<TSFOverlay*>* overlays = NULL,
+            uint64_t ordinal = 0);
+
+      const uint8_t* GetData() const { return data_; };
+      uint32_t GetSize() const { return size_; };
+      // ordinal of the spot in its file, used to look up overlay values
+      uint64_t GetOrdinal() const { return ordinal_; };
+      const std::vector<TSFOverlay*>* GetOverlays() const { return overlays_; };
+
+      /**
+       * The record with the values of the overlays appended to it (the last
+       * value of a field counts), so that it can be written as is.  Points
+       * data to the bytes of the view when no overlay has a value for this
+       * spot, and to a copy in buffer otherwise
+       */
+      void GetRecord(std::string* buffer, const uint8_t** data,
+            uint32_t* size) const;
+
+      /**
+       * Generic access by field number (including extensions).  Return
+       * false when the field is absent.  Int32 and enum fields should be
+       * read with GetInt32, float fields with GetFloat
+       */
+      bool Has(int fieldNumber) const;
+      bool GetInt32(int fieldNumber, int32_t* value) const;
+      bool GetFloat(int fieldNumber, float* value) const;
+
+      /**
+       * Parses all fields into spot (overlays applied)
+       */
+      bool ToSpot(TSF::Spot* spot) const;
+
+      int32_t molecule() const { return Int32(TSF::Spot::kMoleculeFieldNumber); };
+      int32_t channel() const { return Int32(TSF::Spot::kChannelFieldNumber); };
+      int32_t frame() const { return Int32(TSF::Spot::kFrameFieldNumber); };
+      int32_t slice() const { return Int32(TSF::Spot::kSliceFieldNumber); };
+      int32_t pos() const { return Int32(TSF::Spot::kPosFieldNumber); };
+      int32_t fluorophore_type() const { return Int32(TSF::Spot::kFluorophoreTypeFieldNumber); };
+      int32_t cluster() const { return Int32(TSF::Spot::kClusterFieldNumber); };
+      TSF::LocationUnits location_units() const
+         { return (TSF::LocationUnits) Int32(TSF::Spot::kLocationUnitsFieldNumber); };
+      float x() const { return Float(TSF::Spot::kXFieldNumber); };
+      float y() const { return Float(TSF::Spot::kYFieldNumber); };
+      float z() const { return Float(TSF::Spot::kZFieldNumber); };
+      TSF::IntensityUnits intensity_units() const
+         { return (TSF::IntensityUnits) Int32(TSF::Spot::kIntensityUnitsFieldNumber); };
+      float intensity() const { return Float(TSF::Spot::kIntensityFieldNumber); };
+      float background() const { return Float(TSF::Spot::kBackgroundFieldNumber); };
+      float width() const { return Float(TSF::Spot::kWidthFieldNumber); };
+      float a() const { return Float(TSF::Spot::kAFieldNumber); };
+      float theta() const { return Float(TSF::Spot::kThetaFieldNumber); };
+      float x_original() const { return Float(TSF::Spot::kXOriginalFieldNumber); };
+      float y_original() const { return Float(TSF::Spot::kYOriginalFieldNumber); };
+      float z_original() const { return Float(TSF::Spot::kZOriginalFieldNumber); };
+      float x_precision() const { return Float(TSF::Spot::kXPrecisionFieldNumber); };
+      float y_precision() const { return Float(TSF::Spot::kYPrecisionFieldNumber); };
+      float z_precision() const { return Float(TSF::Spot::kZPrecisionFieldNumber); };
+      int32_t x_position() const { return Int32(TSF::Spot::kXPositionFieldNumber); };
+      int32_t y_position() const { return Int32(TSF::Spot::kYPositionFieldNumber); };
+
+   private:
+      // fields with lower numbers (all fields of Spot) are indexed, others 
+      // (extensions) are looked up by walking the spot
+      static const int MAXINDEXED = 128;
+
+      bool Find(int fieldNumber, uint32_t* bits) const;
+      void Walk(int fieldNumber, uint32_t* bits, bool* found) const;
+      int32_t Int32(int fieldNumber) const
+      {
+         int32_t value = 0;
+         GetInt32(fieldNumber, &value);
+         return value;
+      };
+      float Float(int fieldNumber) const
+      {
+         float value = 0.0f;
+         GetFloat(fieldNumber, &value);
+         return value;
+      };
+
+      const uint8_t* data_;
+      uint32_t size_;
+      const std::vector<TSFOverlay*>* overlays_;
+      uint64_t ordinal_;
+
+      // offset of the value of each indexed field in data_, valid when its
+      // stamp equals generation_ (which saves clearing them for every spot)
+      mutable bool indexed_;
+      uint32_t generation_;
+      mutable uint32_t stamps_[MAXINDEXED];
+      mutable uint32_t offsets_[MAXINDEXED];
+      mutable uint8_t wireTypes_[MAXINDEXED];
+};
+
+#endif
@@ -0,0 +1,404 @@
+/**
+ * Process wide pool of worker threads, shared by all parallel operations
+ * on tsf data
+ *
+ * The tasks are expected to be coarse (e.g. decoding thousands of spots),
+ * so the queues are simply protected by a mutex each, and a single mutex
+ * protects the counts used to put idle threads to sleep and to wake them.
+ */
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "TSFThreadPool.h"
+#include "TSFTrace.h"
+
+
+static pthread_mutex_t sharedMutex = PTHREAD_MUTEX_INITIALIZER;
+static TSFThreadPool* sharedPool = NULL;
+static int configuredThreads = 0;
+static std::vector<int> configuredCpus;
+static bool configured = false;
+
+// the pool and queue of the calling thread, when it is a worker
+static __thread TSFThreadPool* currentPool = NULL;
+static __thread int currentWorker = -1;
+
+struct WorkerStart
+{
+   TSFThreadPool* pool;
+   int index;
+};
+
+
+/**
+ * Parses a list of cores such as "0,2,4-7"
+ */
+static std::vector<int> ParseCpus(const char* list)
+{
+   std::vector<int> cpus;
+   const char* p = list;
+   while (*p != '\0')
+   {
+      char* end;
+      long first = strtol(p, &end, 10);
+      if (end == p)
+         break;
+      long last = first;
+      p = end;
+      if (*p == '-')
+      {
+         last = strtol(p + 1, &end, 10);
+         if (end == p + 1)
+            break;
+         p = end;
+      }
+      for (long cpu = first; cpu <= last; cpu++)
+         cpus.push_back((int) cpu);
+      if (*p == ',')
+         p++;
+   }
+   return cpus;
+}
+
+static int DefaultNrThreads(const std::vector<int>& cpus)
+{
+   const char* env = getenv("TSF_NUM_THREADS");
+   if (env != NULL && atoi(env) > 0)
+      return atoi(env);
+   if (!cpus.empty())
+      return cpus.size();
+#ifdef __linux__
+   // cores the process may run on (e.g. limited with taskset)
+   cpu_set_t set;
+   if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+      return CPU_COUNT(&set);
+#endif
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return n > 0 ? (int) n : 1;
+}
+
+
+TSFThreadPool* TSFThreadPool::Shared()
+{
+   pthread_mutex_lock(&sharedMutex);
+   if (sharedPool == NULL)
+   {
+      std::vector<int> cpus = configuredCpus;
+      if (!configured)
+      {
+         const char* env = getenv("TSF_CPUS");
+         if (env != NULL)
+            cpus = ParseCpus(env);
+      }
+      int nrThreads = configuredThreads > 0 ? configuredThreads :
+         DefaultNrThreads(cpus);
+      sharedPool = new TSFThreadPool(nrThreads, cpus);
+   }
+   TSFThreadPool* pool = sharedPool;
+   pthread_mutex_unlock(&sharedMutex);
+   return pool;
+}
+
+void TSFThreadPool::Configure(int nrThreads, const std::vector<int>& cpus)
+{
+   pthread_mutex_lock(&sharedMutex);
+   delete sharedPool;
+   sharedPool = NULL;
+   configuredThreads = nrThreads;
+   configuredCpus = cpus;
+   configured = true;
+   pthread_mutex_unlock(&sharedMutex);
+}
+
+void TSFThreadPool::Shutdown()
+{
+   pthread_mutex_lock(&sharedMutex);
+   delete sharedPool;
+   sharedPool = NULL;
+   pthread_mutex_unlock(&sharedMutex);
+}
+
+
+TSFThreadPool::TSFThreadPool(int nrThreads, const std::vector<int>& cpus) :
+   cpus_(cpus),
+   queued_(0),
+   stop_(false),
+   nextQueue_(0)
+{
+   pthread_mutex_init(&mutex_, NULL);
+   pthread_cond_init(&work_, NULL);
+   pthread_cond_init(&done_, NULL);
+
+   int nrWorkers = nrThreads > 1 ? nrThreads - 1 : 0;
+   // without workers, tasks are queued for the waiting thread
+   for (int i = 0; i < nrWorkers || i == 0; i++)
+   {
+      Queue* queue = new Queue();
+      pthread_mutex_init(&queue->mutex, NULL);
+      queues_.push_back(queue);
+   }
+   for (int i = 0; i < nrWorkers; i++)
+   {
+      WorkerStart* start = new WorkerStart();
+      start->pool = this;
+      start->index = i;
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, WorkerThread, start) == 0)
+         workers_.push_back(thread);
+      else
+      {
+         delete start;
+         break;
+      }
+   }
+}
+
+TSFThreadPool::~TSFThreadPool()
+{
+   pthread_mutex_lock(&mutex_);
+   stop_ = true;
+   pthread_cond_broadcast(&work_);
+   pthread_mutex_unlock(&mutex_);
+   for (unsigned int i = 0; i < workers_.size(); i++)
+      pthread_join(workers_[i], NULL);
+
+   for (unsigned int i = 0; i < queues_.size(); i++)
+   {
+      pthread_mutex_destroy(&queues_[i]->mutex);
+      delete queues_[i];
+   }
+   pthread_cond_destroy(&done_);
+   pthread_cond_destroy(&work_);
+   pthread_mutex_destroy(&mutex_);
+}
+
+void* TSFThreadPool::WorkerThread(void* arg)
+{
+   WorkerStart* start = (WorkerStart*) arg;
+   TSFThreadPool* pool = start->pool;
+   int index = start->index;
+   delete start;
+   currentPool = pool;
+   currentWorker = index;
+   pool->Work(index);
+   return NULL;
+}
+
+void TSFThreadPool::Work(int index)
+{
+#ifdef __linux__
+   if (!cpus_.empty())
+   {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpus_[index % cpus_.size()], &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+   }
+#endif
+
+   while (true)
+   {
+      Entry entry;
+      if (Take(index, &entry))
+      {
+         Execute(entry);
+         continue;
+      }
+      pthread_mutex_lock(&mutex_);
+      while (!stop_ && queued_ <= 0)
+         pthread_cond_wait(&work_, &mutex_);
+      bool stop = stop_;
+      pthread_mutex_unlock(&mutex_);
+      if (stop)
+         break;
+   }
+}
+
+/**
+ * Takes the newest task of the queue of worker index (-1 for threads that
+ * are not workers), or else steals the oldest task of another queue
+ */
+bool TSFThreadPool::Take(int index, Entry* entry)
+{
+   bool found = false;
+   if (index >= 0)
+   {
+      Queue* queue = queues_[index];
+      pthread_mutex_lock(&queue->mutex);
+      if (!queue->entries.empty())
+      {
+         *entry = queue->entries.back();
+         queue->entries.pop_back();
+         found = true;
+      }
+      pthread_mutex_unlock(&queue->mutex);
+   }
+   for (unsigned int i = 1; !found && i <= queues_.size(); i++)
+   {
+      Queue* queue = queues_[(index + i) % queues_.size()];
+      pthread_mutex_lock(&queue->mutex);
+      if (!queue->entries.empty())
+      {
+         *entry = queue->entries.front();
+         queue->entries.pop_front();
+         found = true;
+      }
+      pthread_mutex_unlock(&queue->mutex);
+   }
+   if (found)
+   {
+      pthread_mutex_lock(&mutex_);
+      queued_--;
+      pthread_mutex_unlock(&mutex_);
+   }
+   return found;
+}
+
+void TSFThreadPool::Execute(const Entry& entry)
+{
+   entry.task->Run();
+   pthread_mutex_lock(&mutex_);
+   if (--entry.group->pending_ == 0)
+      pthread_cond_broadcast(&done_);
+   pthread_mutex_unlock(&mutex_);
+}
+
+void TSFThreadPool::Submit(TSFTask* task, TSFTaskGroup* group)
+{
+   pthread_mutex_lock(&mutex_);
+   group->pending_++;
+   unsigned int q = currentPool == this ? currentWorker :
+      nextQueue_++ % queues_.size();
+   pthread_mutex_unlock(&mutex_);
+
+   Entry entry;
+   entry.task = task;
+   entry.group = group;
+   Queue* queue = queues_[q];
+   pthread_mutex_lock(&queue->mutex);
+   queue->entries.push_back(entry);
+   pthread_mutex_unlock(&queue->mutex);
+
+   pthread_mutex_lock(&mutex_);
+   queued_++;
+   pthread_cond_signal(&work_);
+   pthread_mutex_unlock(&mutex_);
+}
+
+void TSFThreadPool::Wait(TSFTaskGroup* group)
+{
+   int index = currentPool == this ? currentWorker : -1;
+   while (true)
+   {
+      pthread_mutex_lock(&mutex_);
+      bool finished = group->pending_ == 0;
+      pthread_mutex_unlock(&mutex_);
+      if (finished)
+         return;
+
+      Entry entry;
+      if (Take(index, &entry))
+      {
+         Execute(entry);
+         continue;
+      }
+
+      // the remaining tasks of group are running on other threads
+      pthread_mutex_lock(&mutex_);
+      if (group->pending_ > 0 && queued_ <= 0)
+         pthread_cond_wait(&done_, &mutex_);
+      pthread_mutex_unlock(&mutex_);
+   }
+}
+
+
+/**
+ * State of one ParallelFor, shared by its runners
+ */
+class TSFLoop
+{
+   public:
+      TSFLoop(uint64_t n, TSFLoopBody* body) : n_(n), next_(0),
+         failed_(false), body_(body)
+      {
+         pthread_mutex_init(&mutex_, NULL);
+      };
+      ~TSFLoop() { pthread_mutex_destroy(&mutex_); };
+
+      bool Next(uint64_t* index)
+      {
+         pthread_mutex_lock(&mutex_);
+         bool more = !failed_ && next_ < n_;
+         if (more)
+            *index = next_++;
+         pthread_mutex_unlock(&mutex_);
+         return more;
+      };
+      void Fail()
+      {
+         pthread_mutex_lock(&mutex_);
+         failed_ = true;
+         pthread_mutex_unlock(&mutex_);
+      };
+      bool Failed() { return failed_; };
+      TSFLoopBody* GetBody() { return body_; };
+
+   private:
+      uint64_t n_;
+      uint64_t next_;
+      bool failed_;
+      TSFLoopBody* body_;
+      pthread_mutex_t mutex_;
+};
+
+/**
+ * Runs indices of a loop until they are all handed out
+ */
+class TSFLoopRunner : public TSFTask
+{
+   public:
+      TSFLoopRunner() : loop_(NULL) {};
+      void SetLoop(TSFLoop* loop) { loop_ = loop; };
+      void Run()
+      {
+         if (currentWorker >= 0 && TSFTrace::IsEnabled())
+            TSFTrace::SetThreadName("TSFThreadPool");
+         uint64_t index;
+         while (loop_->Next(&index))
+         {
+            if (!loop_->GetBody()->Run(index))
+               loop_->Fail();
+         }
+      };
+
+   private:
+      TSFLoop* loop_;
+};
+
+bool TSFThreadPool::ParallelFor(uint64_t n, TSFLoopBody* body,
+      int maxThreads)
+{
+   int nrThreads = GetNrThreads();
+   if (maxThreads > 0 && maxThreads < nrThreads)
+      nrThreads = maxThreads;
+   if ((uint64_t) nrThreads > n)
+      nrThreads = (int) n;
+   if (nrThreads < 1)
+      return true;
+
+   TSFLoop loop(n, body);
+   std::vector<TSFLoopRunner> runners(nrThreads);
+   TSFTaskGroup group;
+   for (int i = 0; i < nrThreads; i++)
+      runners[i].SetLoop(&loop);
+   for (int i = 1; i < nrThreads; i++)
+      Submit(&runners[i], &group);
+   // the calling thread does its share of the work as well
+   runners[0].Run();
+   Wait(&group);
+
+   return !loop.Failed();
+}
@@ -0,0 +1,135 @@
+/**
+ * Process wide pool of worker threads, shared by all parallel operations
+ * on tsf data, so that running several of them at once does not start more
+ * threads than there are cores
+ */
+
+#ifndef TSFTHREADPOOL_H
+#define TSFTHREADPOOL_H
+
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+
+/**
+ * Unit of work, run once by one of the threads of the pool
+ */
+class TSFTask
+{
+   public:
+      virtual ~TSFTask() {};
+      virtual void Run() = 0;
+};
+
+/**
+ * Body of TSFThreadPool::ParallelFor, called once for every index
+ * Returns false to stop the loop (e.g. on a decoding error)
+ */
+class TSFLoopBody
+{
+   public:
+      virtual ~TSFLoopBody() {};
+      virtual bool Run(uint64_t index) = 0;
+};
+
+/**
+ * Tasks that are waited for together
+ */
+class TSFTaskGroup
+{
+   public:
+      TSFTaskGroup() : pending_(0) {};
+
+   private:
+      friend class TSFThreadPool;
+      int64_t pending_;
+};
+
+/**
+ * Each worker thread has its own queue of tasks.  Tasks submitted by a
+ * worker go to the back of its own queue and are taken from there by the
+ * same worker, idle workers steal from the front of the queues of the
+ * others.  Threads that wait for a group of tasks run queued tasks while
+ * they wait, so that nested parallel operations can not deadlock.
+ *
+ * The size of the pool is set by Configure, or otherwise by the
+ * environment variable TSF_NUM_THREADS, or otherwise by the nr of cores the
+ * process may run on.  Worker threads are bound to the cores given to
+ * Configure, or listed in TSF_CPUS ("0,2,4-7"), when set (Linux only).
+ * The threads that use the pool take part in the work, so a pool of n
+ * threads starts n - 1 workers.
+ */
+class TSFThreadPool
+{
+   public:
+      /**
+       * The pool, started on first use
+       */
+      static TSFThreadPool* Shared();
+
+      /**
+       * Sets the nr of threads (0 for the default) and the cores of the
+       * shared pool (empty for no binding).  Stops the running pool, which
+       * should not be in use, the next call to Shared starts a new one
+       */
+      static void Configure(int nrThreads, const std::vector<int>& cpus);
+
+      /**
+       * Stops and joins the worker threads of the shared pool, e.g. before
+       * the code of the pool is unloaded.  The pool should not be in use
+       */
+      static void Shutdown();
+
+      // nr of threads that can work at the same time (workers and caller)
+      int GetNrThreads() { return (int) workers_.size() + 1; };
+
+      void Submit(TSFTask* task, TSFTaskGroup* group);
+      // runs queued tasks until all tasks of group have finished
+      void Wait(TSFTaskGroup* group);
+
+      /**
+       * Calls body->Run(i) for i in 0..n-1 on at most maxThreads threads
+       * at a time (0 for all threads of the pool), including the calling
+       * thread.  Indices are handed out one at a time, in increasing order.
+       * Returns false when a call returned false, in which case indices
+       * that were not handed out yet are skipped
+       */
+      bool ParallelFor(uint64_t n, TSFLoopBody* body, int maxThreads = 0);
+
+   private:
+      struct Entry
+      {
+         TSFTask* task;
+         TSFTaskGroup* group;
+      };
+
+      struct Queue
+      {
+         std::deque<Entry> entries;
+         pthread_mutex_t mutex;
+      };
+
+      TSFThreadPool(int nrThreads, const std::vector<int>& cpus);
+      ~TSFThreadPool();
+
+      static void* WorkerThread(void* arg);
+      void Work(int index);
+      bool Take(int index, Entry* entry);
+      void Execute(const Entry& entry);
+
+      std::vector<pthread_t> workers_;
+      std::vector<Queue*> queues_;
+      std::vector<int> cpus_;
+      // mutex_ protects queued_, stop_, nextQueue_ and the pending counts
+      // of the groups
+      pthread_mutex_t mutex_;
+      pthread_cond_t work_;
+      pthread_cond_t done_;
+      int64_t queued_;
+      bool stop_;
+      unsigned int nextQueue_;
+};
+
+#endif
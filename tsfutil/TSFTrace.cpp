@@ -0,0 +1,134 @@
+/**
+ * Opt-in recording of the stages of reading and writing tsf files, saved
+ * in the Chrome trace event format
+ *
+ * Events are kept in memory until Save is called.  Each thread is given a
+ * small sequential id the first time it records an event, which is used as
+ * the tid of its events.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "TSFTrace.h"
+
+
+struct TSFTraceEvent
+{
+   const char* name;
+   const char* category;
+   char phase;
+   int thread;
+   uint64_t time;
+   int64_t spots;
+};
+
+volatile bool TSFTrace::enabled_ = false;
+
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<TSFTraceEvent> traceEvents;
+static uint64_t traceStart = 0;
+static int traceThreads = 0;
+static __thread int traceThread = 0;
+
+static uint64_t TraceNow()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Adds an event, the caller should hold traceMutex
+ */
+static void AddEvent(const char* name, const char* category, char phase,
+      int64_t spots)
+{
+   if (traceThread == 0)
+      traceThread = ++traceThreads;
+   TSFTraceEvent event;
+   event.name = name;
+   event.category = category;
+   event.phase = phase;
+   event.thread = traceThread;
+   event.time = TraceNow();
+   event.spots = spots;
+   traceEvents.push_back(event);
+}
+
+
+void TSFTrace::Start()
+{
+   pthread_mutex_lock(&traceMutex);
+   traceEvents.clear();
+   traceStart = TraceNow();
+   enabled_ = true;
+   pthread_mutex_unlock(&traceMutex);
+}
+
+void TSFTrace::Stop()
+{
+   pthread_mutex_lock(&traceMutex);
+   enabled_ = false;
+   pthread_mutex_unlock(&traceMutex);
+}
+
+void TSFTrace::Begin(const char* name, const char* category)
+{
+   pthread_mutex_lock(&traceMutex);
+   if (enabled_)
+      AddEvent(name, category, 'B', -1);
+   pthread_mutex_unlock(&traceMutex);
+}
+
+void TSFTrace::End(const char* name, const char* category, int64_t spots)
+{
+   pthread_mutex_lock(&traceMutex);
+   if (enabled_)
+      AddEvent(name, category, 'E', spots);
+   pthread_mutex_unlock(&traceMutex);
+}
+
+void TSFTrace::SetThreadName(const char* name)
+{
+   pthread_mutex_lock(&traceMutex);
+   if (enabled_)
+      AddEvent(name, "", 'M', -1);
+   pthread_mutex_unlock(&traceMutex);
+}
+
+bool TSFTrace::Save(const char* fileName)
+{
+   FILE* fp = fopen(fileName, "w");
+   if (fp == NULL)
+      return false;
+
+   pthread_mutex_lock(&traceMutex);
+   int pid = getpid();
+   fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+   for (size_t i = 0; i < traceEvents.size(); i++)
+   {
+      const TSFTraceEvent& e = traceEvents[i];
+      const char* separator = i + 1 < traceEvents.size() ? "," : "";
+      if (e.phase == 'M')
+      {
+         fprintf(fp, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+               "\"tid\": %d, \"args\": {\"name\": \"%s\"}}%s\n",
+               pid, e.thread, e.name, separator);
+         continue;
+      }
+      fprintf(fp, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"%c\", "
+            "\"pid\": %d, \"tid\": %d, \"ts\": %.3f", e.name, e.category,
+            e.phase, pid, e.thread, (e.time - traceStart) / 1000.0);
+      if (e.spots >= 0)
+         fprintf(fp, ", \"args\": {\"spots\": %lld}", (long long) e.spots);
+      fprintf(fp, "}%s\n", separator);
+   }
+   fprintf(fp, "]}\n");
+   pthread_mutex_unlock(&traceMutex);
+
+   return fclose(fp) == 0;
+}
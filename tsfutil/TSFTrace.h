@@ -0,0 +1,75 @@
+/**
+ * Opt-in recording of the stages of reading and writing tsf files, saved
+ * in the Chrome trace event format (load in chrome://tracing or
+ * https://ui.perfetto.dev)
+ */
+
+#ifndef TSFTRACE_H
+#define TSFTRACE_H
+
+#include <stdint.h>
+
+
+/**
+ * Process wide recorder of begin and end events.  Nothing is recorded until
+ * Start is called, after which TSFUtils, TSFParser, TSFParallelDecoder and
+ * tsftrans record an event pair for every batch of spots that they read,
+ * decode, transform (apply overlays), serialize or write.  Events are
+ * recorded per thread, and can be recorded from multiple threads at once.
+ * Names and categories are not copied and should be string literals.
+ */
+class TSFTrace
+{
+   public:
+      static void Start();
+      static void Stop();
+      static bool IsEnabled() { return enabled_; };
+
+      static void Begin(const char* name, const char* category);
+      // spots, when not negative, is shown with the event
+      static void End(const char* name, const char* category,
+            int64_t spots = -1);
+
+      // name shown for the calling thread
+      static void SetThreadName(const char* name);
+
+      /**
+       * Writes all events recorded since Start to fileName
+       * Returns false when the file could not be written
+       */
+      static bool Save(const char* fileName);
+
+   private:
+      static volatile bool enabled_;
+};
+
+/**
+ * Records the begin event when created and the end event when it goes out
+ * of scope, if tracing is enabled
+ */
+class TSFTraceScope
+{
+   public:
+      TSFTraceScope(const char* name, const char* category) :
+         name_(name), category_(category), spots_(-1),
+         enabled_(TSFTrace::IsEnabled())
+      {
+         if (enabled_)
+            TSFTrace::Begin(name_, category_);
+      };
+      ~TSFTraceScope()
+      {
+         if (enabled_)
+            TSFTrace::End(name_, category_, spots_);
+      };
+
+      void SetSpots(int64_t spots) { spots_ = spots; };
+
+   private:
+      const char* name_;
+      const char* category_;
+      int64_t spots_;
+      bool enabled_;
+};
+
+#endif
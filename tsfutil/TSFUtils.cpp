@@ -18,10 +18,12 @@
  */
 
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <netinet/in.h>
+#include <unistd.h>
 
 #include "TSFException.h"
 #include "TSFUtils.h"
@@ -35,10 +37,24 @@
  * Instantiation of this calss is only needed for binary (tsf) files
  * Text files can be written using static methods
  */
-TSFUtils::TSFUtils(std::fstream* fs, mode mode) throw (TSFException) :
+TSFUtils::TSFUtils(std::fstream* fs, mode mode, TSFMetrics* metrics) 
+      throw (TSFException) :
    mode_ (mode),
    fs_ (fs),
-   firstWrite_(true)
+   firstWrite_(true),
+   baseOffset_(0),
+   inputBase_(0),
+   outputBase_(0),
+   spotsWritten_(0),
+   initialSpots_(0),
+   spotsRead_(0),
+   spotsSize_(0),
+   metrics_(metrics),
+   fileInput_(NULL),
+   input_(NULL),
+   codedInput_(NULL),
+   output_(NULL),
+   codedOutput_(NULL)
 {
    if (fs == NULL || !fs->is_open())
       throw TSFException("File is not open");
@@ -49,22 +65,86 @@ TSFUtils::TSFUtils(std::fstream* fs, mode mode) throw (TSFException) :
    if (mode_ == READ) 
    {
    }
-   if (mode_ == WRITE)
+   if (mode_ == WRITE || mode_ == APPEND)
    {
       output_ = new google::protobuf::io::OstreamOutputStream(fs_);
+      if (metrics_ != NULL)
+         output_ = new TSFTimedOutputStream(output_, metrics_);
       codedOutput_ = new google::protobuf::io::CodedOutputStream(output_);
    }
+   if (mode_ == APPEND)
+   {
+      // the header (magic number and offset) is already present in the file
+      firstWrite_ = false;
+   }
 }
 
 TSFUtils::~TSFUtils()
 {
-   if (mode_ == READ)
+   // the coded streams need to go before the streams they wrap
+   CloseInput();
+   delete codedOutput_;
+   delete output_;
+   for (unsigned int i = 0; i < ownOverlays_.size(); i++)
+      delete ownOverlays_[i];
+}
+
+/**
+ * Opens an existing tsf file so that more spots can be added to it
+ * Reads the trailing SpotList into sl, truncates the file at the position 
+ * of the SpotList, and returns an instance in APPEND mode that is positioned
+ * at the end of the last spot.  Spots can then be written with 
+ * WriteSpotBinary, after which WriteHeaderBinary should be called to write 
+ * the SpotList (with nr_spots updated) back to the end of the file.
+ * The existing spots are neither read nor rewritten.
+ * If the original SpotList did not contain nr_spots, it will not be set.
+ *
+ * param fileName - path to the tsf file
+ * param fs - fstream that will be opened by this function. It should not be
+ *             closed before WriteHeaderBinary has been called
+ * param sl - SpotList that will be filled with the existing header
+ * It is the responsibility of the caller to delete the returned object
+ */
+TSFUtils* TSFUtils::OpenForAppend(const char* fileName, std::fstream* fs,
+      TSF::SpotList* sl, TSFMetrics* metrics) throw (TSFException)
+{
+   if (fs == NULL || sl == NULL)
+      throw TSFException("Programming error: fstream or SpotList pointer was NULL");
+
+   fs->open(fileName, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+   if (!fs->is_open())
+      throw TSFException("Failed to open file for appending");
+
+   TSFUtils* reader = new TSFUtils(fs, READ);
+   try {
+      reader->GetHeaderBinary(sl);
+   } catch (TSFException& ex)
    {
-      delete input_;
-      delete codedInput_;
-      delete output_;
-      delete codedOutput_;
+      delete reader;
+      throw;
    }
+   delete reader;
+
+   fs->clear();
+   fs->seekg(4, std::ios_base::beg);
+   int64_t headerPos = ReadInt64(fs) + 12;
+   fs->close();
+
+   if (truncate(fileName, headerPos) != 0)
+      throw TSFException("Failed to remove the SpotList from the end of the file");
+
+   fs->open(fileName, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+   if (!fs->is_open())
+      throw TSFException("Failed to reopen file for appending");
+   fs->seekp(headerPos, std::ios_base::beg);
+   if (fs->tellp() != headerPos)
+      throw TSFException("Failed to set filepointer to the end of the spot data");
+
+   TSFUtils* appender = new TSFUtils(fs, APPEND, metrics);
+   appender->baseOffset_ = headerPos;
+   appender->initialSpots_ = sl->has_nr_spots() ? sl->nr_spots() : -1;
+
+   return appender;
 }
 
 /**
@@ -102,10 +182,14 @@ int TSFUtils::GetHeaderBinary(TSF::SpotList* sl) throw (TSFException)
       throw TSFException("Offset is 0, can not find header data in this file");
    }
 
+   // the magic number and offset did not go through a (timed) input stream
+   if (metrics_ != NULL)
+      metrics_->AddBytesRead(12);
+
    fs_->seekg(offset, std::ios_base::cur);
+   spotsSize_ = offset;
 
-   input_ = new google::protobuf::io::IstreamInputStream(fs_);
-   codedInput_ = new google::protobuf::io::CodedInputStream(input_);
+   OpenInput(-1);
 
    uint32_t mSize;
    if (!codedInput_->ReadVarint32(&mSize))
@@ -127,9 +211,10 @@ int TSFUtils::GetHeaderBinary(TSF::SpotList* sl) throw (TSFException)
    // the protobuf utilities do not seem to support this
    // Therefore, delete them, set the file pointer to 12
    // make sure this worked and recreate the codedInputStream
+   // (deleting them returns the bytes read ahead, so that only the SpotList
+   // is counted in the metrics)
 
-   delete codedInput_;
-   delete input_;
+   CloseInput();
    
    fs_->clear();
    fs_->seekg(12, std::ios_base::beg);
@@ -137,10 +222,67 @@ int TSFUtils::GetHeaderBinary(TSF::SpotList* sl) throw (TSFException)
    if (12 != fs_->tellg())
       throw TSFException ("Failed to set filepointer.  Try setting the read flag");
 
+   OpenInput(spotsSize_);
+
+   return GOOD;
+}
+
+/**
+ * Creates the input streams at the current position of the file.  When
+ * limit is not negative, no more than limit bytes are handed out, such that
+ * reading ahead does not count the bytes after the spots in the metrics
+ */
+void TSFUtils::OpenInput(int64_t limit)
+{
    input_ = new google::protobuf::io::IstreamInputStream(fs_);
+   if (limit >= 0)
+   {
+      fileInput_ = input_;
+      input_ = new google::protobuf::io::LimitingInputStream(fileInput_, limit);
+   }
+   if (metrics_ != NULL)
+      input_ = new TSFTimedInputStream(input_, metrics_);
    codedInput_ = new google::protobuf::io::CodedInputStream(input_);
+   inputBase_ = 0;
+}
 
-   return GOOD;
+/**
+ * Deletes the input streams, each before the stream it wraps
+ */
+void TSFUtils::CloseInput()
+{
+   delete codedInput_;
+   codedInput_ = NULL;
+   // also deletes the streams wrapped by a TSFTimedInputStream, but not the
+   // one wrapped by a LimitingInputStream
+   delete input_;
+   input_ = NULL;
+   delete fileInput_;
+   fileInput_ = NULL;
+}
+
+/**
+ * Position in the spot data (0 is the first spot)
+ */
+int64_t TSFUtils::InputPosition()
+{
+   return inputBase_ + codedInput_->CurrentPosition();
+}
+
+/**
+ * A CodedInputStream refuses to read more than 2 GiB, and counts its
+ * position in an int.  Before either happens, it is replaced by a new one
+ * that continues where it stopped (deleting it returns the bytes it did
+ * not use to input_).  Should only be called between spots.
+ */
+void TSFUtils::RecycleInput()
+{
+   int position = codedInput_->CurrentPosition();
+   if (position < RECYCLEBYTES)
+      return;
+   inputBase_ += position;
+   delete codedInput_;
+   codedInput_ = new google::protobuf::io::CodedInputStream(input_);
 }
 
 
@@ -203,7 +345,16 @@ void TSFUtils::WriteHeaderBinary(TSF::SpotList* spotList) throw (TSFException)
    // register the offset, write the length as a varint, then go back to the
    // beginning of the stream
    
-   int64_t offset = codedOutput_->ByteCount();
+   if (mode_ != WRITE && mode_ != APPEND)
+      throw TSFException("TSFUtils was not opened in write mode");
+
+   if (codedOutput_ == NULL)
+      throw TSFException("The header was already written");
+
+   int64_t offset = baseOffset_ + outputBase_ + codedOutput_->ByteCount();
+
+   if (mode_ == APPEND && initialSpots_ >= 0)
+      spotList->set_nr_spots(initialSpots_ + spotsWritten_);
 
    std::string data;
    spotList->SerializeToString(&data);
@@ -213,6 +364,8 @@ void TSFUtils::WriteHeaderBinary(TSF::SpotList* spotList) throw (TSFException)
    // Need to delete these objects to flush their content to disk
    delete codedOutput_;
    delete output_;
+   codedOutput_ = NULL;
+   output_ = NULL;
 
    fs_->seekp(4, std::ios_base::beg);
 
@@ -228,6 +381,35 @@ void TSFUtils::WriteHeaderBinary(TSF::SpotList* spotList) throw (TSFException)
 
 }
 
+/**
+ * Adds the description of the spots of another data set to sl, for data
+ * sets that are combined: nr_spots is added, nr_frames, nr_pos, nr_slices
+ * and nr_channels are set to their maximum, and fluorophore types of other
+ * are added when sl has none with the same id.  Other fields of sl are
+ * kept
+ */
+void TSFUtils::MergeSpotList(TSF::SpotList* sl, const TSF::SpotList& other)
+{
+   if (other.has_nr_spots())
+      sl->set_nr_spots(sl->nr_spots() + other.nr_spots());
+   if (other.has_nr_frames())
+      sl->set_nr_frames(std::max(sl->nr_frames(), other.nr_frames()));
+   if (other.has_nr_pos())
+      sl->set_nr_pos(std::max(sl->nr_pos(), other.nr_pos()));
+   if (other.has_nr_slices())
+      sl->set_nr_slices(std::max(sl->nr_slices(), other.nr_slices()));
+   if (other.has_nr_channels())
+      sl->set_nr_channels(std::max(sl->nr_channels(), other.nr_channels()));
+   for (int j = 0; j < other.fluorophore_types_size(); j++)
+   {
+      bool found = false;
+      for (int k = 0; k < sl->fluorophore_types_size() && !found; k++)
+         found = sl->fluorophore_types(k).id() == other.fluorophore_types(j).id();
+      if (!found)
+         sl->add_fluorophore_types()->CopyFrom(other.fluorophore_types(j));
+   }
+}
+
 /**
  * Writes the Header (SpotList) to a text file in key: value format
  * This is implemented using reflection
@@ -306,6 +488,7 @@ int TSFUtils::GetSpotBinary(TSF::Spot* spot) throw (TSFException)
    if (codedInput_ == NULL)
       throw TSFException("Programming error: Always first call GetHeaderBinary before this function");
 
+   RecycleInput();
    uint32_t mSize;
    if (!codedInput_->ReadVarint32(&mSize))
    {
@@ -317,7 +500,11 @@ int TSFUtils::GetSpotBinary(TSF::Spot* spot) throw (TSFException)
    try {
       if (codedInput_->ReadString(&buffer, mSize)) 
       {
-         if (!spot->ParseFromString(buffer)) 
+         uint64_t start = metrics_ != NULL ? TSFMetrics::Now() : 0;
+         bool parsed = spot->ParseFromString(buffer);
+         if (metrics_ != NULL)
+            metrics_->AddTime(TSFMetrics::PARSE, TSFMetrics::Now() - start);
+         if (!parsed) 
          {
             return NOMESSAGEFOUND;
          }
@@ -330,9 +517,202 @@ int TSFUtils::GetSpotBinary(TSF::Spot* spot) throw (TSFException)
       throw TSFException("Bad exception while reading spot data \n");
    }
 
+   for (std::vector<TSFOverlay*>::iterator it = overlays_.begin();
+         it != overlays_.end(); ++it)
+   {
+      (*it)->Apply(spot, spotsRead_);
+   }
+   spotsRead_++;
+   if (metrics_ != NULL)
+      metrics_->AddSpotDecoded();
+
    return GOOD;
 }
 
+/**
+ * Reads the next spot into spot.  Returns false when all spots were read.
+ * Unlike GetSpotBinary, the spot is decoded straight from the input 
+ * buffer, and reading stops at the end of the spot data.
+ */
+bool TSFUtils::NextSpot(TSF::Spot* spot) throw (TSFException)
+{
+   if (mode_ != READ)
+      throw TSFException("TSFUtils was opened in write-mode.");
+
+   if (codedInput_ == NULL)
+      throw TSFException("Programming error: Always first call GetHeaderBinary before this function");
+
+   RecycleInput();
+   if (InputPosition() >= spotsSize_)
+      return false;
+
+   uint32_t mSize;
+   if (!codedInput_->ReadVarint32(&mSize))
+      throw TSFException("Failed to read Spot size");
+
+   uint64_t start = metrics_ != NULL ? TSFMetrics::Now() : 0;
+   google::protobuf::io::CodedInputStream::Limit limit = 
+      codedInput_->PushLimit(mSize);
+   if (!spot->ParseFromCodedStream(codedInput_) || 
+         !codedInput_->ConsumedEntireMessage())
+      throw TSFException("Failed to decode Spot");
+   codedInput_->PopLimit(limit);
+   if (metrics_ != NULL)
+   {
+      metrics_->AddTime(TSFMetrics::PARSE, TSFMetrics::Now() - start);
+      metrics_->AddSpotDecoded();
+   }
+
+   for (std::vector<TSFOverlay*>::iterator it = overlays_.begin();
+         it != overlays_.end(); ++it)
+   {
+      (*it)->Apply(spot, spotsRead_);
+   }
+   spotsRead_++;
+
+   return true;
+}
+
+/**
+ * Points view to the raw bytes of the next spot, without decoding it (see
+ * TSFSpotView).  Returns false when all spots were read.  The bytes are
+ * used in place when they are contiguous in the input buffer, and copied
+ * otherwise.  The view is valid until the next call to any of the read
+ * functions.
+ */
+bool TSFUtils::NextSpotView(TSFSpotView* view) throw (TSFException)
+{
+   if (mode_ != READ)
+      throw TSFException("TSFUtils was opened in write-mode.");
+
+   if (codedInput_ == NULL)
+      throw TSFException("Programming error: Always first call GetHeaderBinary before this function");
+
+   RecycleInput();
+   if (InputPosition() >= spotsSize_)
+      return false;
+
+   uint32_t mSize;
+   if (!codedInput_->ReadVarint32(&mSize))
+      throw TSFException("Failed to read Spot size");
+
+   const void* data;
+   int size;
+   if (codedInput_->GetDirectBufferPointer(&data, &size) && 
+         (uint32_t) size >= mSize)
+   {
+      view->Reset((const uint8_t*) data, mSize, &overlays_, spotsRead_);
+      codedInput_->Skip(mSize);
+   }
+   else
+   {
+      if (!codedInput_->ReadString(&viewBuffer_, mSize))
+         throw TSFException("Failed to read Spot");
+      view->Reset((const uint8_t*) viewBuffer_.data(), mSize, &overlays_,
+            spotsRead_);
+   }
+   spotsRead_++;
+
+   return true;
+}
+
+/**
+ * Reads up to maxSpots spots into spots (which is grown when needed), and
+ * returns the nr of spots read, which is 0 after the last spot.  The raw
+ * spots are read first, then decoded, after which overlays are applied,
+ * so that each of these stages can be traced (see TSFTrace).
+ */
+uint32_t TSFUtils::GetSpotsBinary(std::vector<TSF::Spot>& spots, 
+      uint32_t maxSpots) throw (TSFException)
+{
+   if (mode_ != READ)
+      throw TSFException("TSFUtils was opened in write-mode.");
+
+   if (codedInput_ == NULL)
+      throw TSFException("Programming error: Always first call GetHeaderBinary before this function");
+
+   if (spots.size() < maxSpots)
+      spots.resize(maxSpots);
+   if (records_.size() < maxSpots)
+      records_.resize(maxSpots);
+
+   uint32_t n = 0;
+   {
+      TSFTraceScope scope("read", "TSFUtils");
+      while (n < maxSpots)
+      {
+         RecycleInput();
+         if (InputPosition() >= spotsSize_)
+            break;
+         uint32_t mSize;
+         if (!codedInput_->ReadVarint32(&mSize) || 
+               !codedInput_->ReadString(&records_[n], mSize))
+            throw TSFException("Failed to read Spot\n");
+         n++;
+      }
+      scope.SetSpots(n);
+   }
+
+   {
+      TSFTraceScope scope("decode", "TSFUtils");
+      scope.SetSpots(n);
+      uint64_t start = metrics_ != NULL ? TSFMetrics::Now() : 0;
+      for (uint32_t i = 0; i < n; i++)
+      {
+         if (!spots[i].ParseFromString(records_[i]))
+            throw TSFException("Failed to decode Spot\n");
+      }
+      if (metrics_ != NULL)
+      {
+         metrics_->AddTime(TSFMetrics::PARSE, TSFMetrics::Now() - start);
+         for (uint32_t i = 0; i < n; i++)
+            metrics_->AddSpotDecoded();
+      }
+   }
+
+   if (!overlays_.empty())
+   {
+      TSFTraceScope scope("transform", "TSFUtils");
+      scope.SetSpots(n);
+      for (std::vector<TSFOverlay*>::iterator it = overlays_.begin();
+            it != overlays_.end(); ++it)
+      {
+         for (uint32_t i = 0; i < n; i++)
+            (*it)->Apply(&spots[i], spotsRead_ + i);
+      }
+   }
+   spotsRead_ += n;
+
+   return n;
+}
+
+/**
+ * Registers a sidecar overlay whose values will replace the corresponding
+ * field in every spot returned by GetSpotBinary
+ * The overlay is not owned by this object and should outlive it
+ */
+void TSFUtils::AddOverlay(TSFOverlay* overlay)
+{
+   if (mode_ != READ)
+      throw TSFException("Overlays can only be used when reading");
+   if (overlay != NULL)
+      overlays_.push_back(overlay);
+}
+
+/**
+ * Registers all sidecar overlays that exist next to the tsf file, so that
+ * converting or merging the file keeps the values stored in them
+ */
+void TSFUtils::AddOverlays(const std::string& tsfFileName) throw (TSFException)
+{
+   if (mode_ != READ)
+      throw TSFException("Overlays can only be used when reading");
+   size_t first = ownOverlays_.size();
+   TSFOverlay::OpenAll(tsfFileName, &ownOverlays_);
+   overlays_.insert(overlays_.end(), ownOverlays_.begin() + first,
+         ownOverlays_.end());
+}
+
 
 /**
  * Reads a single line from a text file
@@ -342,7 +722,7 @@ int TSFUtils::GetSpotBinary(TSF::Spot* spot) throw (TSFException)
  * The text file needs to be opened and readable
  */
 int TSFUtils::GetSpotText(std::ifstream* ifs, TSF::Spot* spot, 
-      std::vector<std::string>& fields) throw (TSFException)
+      std::vector<std::string>& fields, TSFMetrics* metrics) throw (TSFException)
 {
    if (!ifs->is_open())
    {
@@ -357,8 +737,16 @@ int TSFUtils::GetSpotText(std::ifstream* ifs, TSF::Spot* spot,
    const google::protobuf::Descriptor* sDescriptor = spot->GetDescriptor();
    const google::protobuf::Reflection* sReflection = spot->GetReflection();
 
+   uint64_t start = metrics != NULL ? TSFMetrics::Now() : 0;
    std::string line;
    std::getline(*ifs, line);
+   if (metrics != NULL)
+   {
+      uint64_t now = TSFMetrics::Now();
+      metrics->AddTime(TSFMetrics::READ, now - start);
+      metrics->AddBytesRead(line.size() + 1);
+      start = now;
+   }
    if (line.size() == 0)
    {
       return EF;
@@ -381,6 +769,12 @@ int TSFUtils::GetSpotText(std::ifstream* ifs, TSF::Spot* spot,
       }
    }
 
+   if (metrics != NULL)
+   {
+      metrics->AddTime(TSFMetrics::PARSE, TSFMetrics::Now() - start);
+      metrics->AddSpotDecoded();
+   }
+
    return GOOD;
 }
 
@@ -448,22 +842,124 @@ void TSFUtils::WriteSpotFields(std::ofstream* of, std::vector<std::string>& fiel
 
 void TSFUtils::WriteSpotBinary(TSF::Spot* spot)
 {
-   if (mode_ != WRITE)
-      throw TSFException ("TSFUtils was not opened in write mode");
+   if (metrics_ == NULL)
+   {
+      std::string data;
+      spot->SerializeToString(&data);
+      WriteRecord((const uint8_t*) data.c_str(), data.length());
+      return;
+   }
 
-   if (firstWrite_)
+   uint64_t start = TSFMetrics::Now();
+   std::string data;
+   spot->SerializeToString(&data);
+   metrics_->AddTime(TSFMetrics::SERIALIZE, TSFMetrics::Now() - start);
+   WriteRecord((const uint8_t*) data.c_str(), data.length());
+   metrics_->AddWriteLatency(TSFMetrics::Now() - start);
+}
+
+/**
+ * Writes a spot that was already serialized (for instance by an encoder
+ * that works directly on columns of values), avoiding the construction
+ * of a Spot message.  data should hold a valid Spot in protobuf wire format
+ */
+void TSFUtils::WriteSpotBinary(const uint8_t* data, uint32_t size)
+{
+   if (metrics_ == NULL)
    {
-      codedOutput_->Skip(12);
-      firstWrite_ = false;
+      WriteRecord(data, size);
+      return;
    }
 
+   uint64_t start = TSFMetrics::Now();
+   WriteRecord(data, size);
+   metrics_->AddWriteLatency(TSFMetrics::Now() - start);
+}
+
+void TSFUtils::WriteRecord(const uint8_t* data, uint32_t size)
+{
+   PrepareWrite();
+   codedOutput_->WriteVarint32(size);
+   codedOutput_->WriteRaw(data, size);
+   spotsWritten_++;
+   if (metrics_ != NULL)
+      metrics_->AddSpotEncoded();
+}
+
+/**
+ * Writes nrSpots spots from the start of spots.  All spots are serialized
+ * into a single buffer first, which is then written in one go.  Per spot 
+ * write latency (see TSFMetrics) is the time needed to serialize the spot.
+ */
+void TSFUtils::WriteSpotsBinary(std::vector<TSF::Spot>& spots, 
+      uint32_t nrSpots)
+{
+   PrepareWrite();
+   if (nrSpots > spots.size())
+      nrSpots = spots.size();
+
+   {
+      TSFTraceScope scope("serialize", "TSFUtils");
+      scope.SetSpots(nrSpots);
+      batch_.clear();
+      std::string record;
+      uint8_t prefix[5];
+      for (uint32_t i = 0; i < nrSpots; i++)
+      {
+         uint64_t start = metrics_ != NULL ? TSFMetrics::Now() : 0;
+         spots[i].SerializeToString(&record);
+         uint8_t* end = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(
+               record.size(), prefix);
+         batch_.append((const char*) prefix, end - prefix);
+         batch_.append(record);
+         if (metrics_ != NULL)
+         {
+            uint64_t time = TSFMetrics::Now() - start;
+            metrics_->AddTime(TSFMetrics::SERIALIZE, time);
+            metrics_->AddWriteLatency(time);
+         }
+      }
+   }
+
+   TSFTraceScope scope("write", "TSFUtils");
+   scope.SetSpots(nrSpots);
+   codedOutput_->WriteRaw(batch_.data(), batch_.size());
+   spotsWritten_ += nrSpots;
+   if (metrics_ != NULL)
+      for (uint32_t i = 0; i < nrSpots; i++)
+         metrics_->AddSpotEncoded();
+}
+
+/**
+ * Checks that spots can be written, and writes the magic number and room
+ * for the offset of the header before the first spot.  The
+ * CodedOutputStream is replaced every RECYCLEBYTES bytes, since it counts
+ * the bytes written in an int, which would make the offset of the header
+ * wrong in files of more than 2 GiB
+ */
+void TSFUtils::PrepareWrite()
+{
+   if (mode_ != WRITE && mode_ != APPEND)
+      throw TSFException ("TSFUtils was not opened in write mode");
+
    if (codedOutput_ == NULL)
       throw TSFException ("Can not wite spot data after header was written");
 
-   std::string data;
-   spot->SerializeToString(&data);
-   codedOutput_->WriteVarint32(data.length());
-   codedOutput_->WriteRaw(data.c_str(), data.length());
+   if (firstWrite_)
+   {
+      // magic number (0) and room for the offset of the header.  Skip()
+      // would leave whatever happens to be in the buffer of the stream
+      const char header[12] = {0};
+      codedOutput_->WriteRaw(header, 12);
+      firstWrite_ = false;
+   }
+
+   if (codedOutput_->ByteCount() >= RECYCLEBYTES)
+   {
+      outputBase_ += codedOutput_->ByteCount();
+      delete codedOutput_;
+      codedOutput_ = new google::protobuf::io::CodedOutputStream(output_);
+   }
 }
 
 
@@ -471,9 +967,13 @@ void TSFUtils::WriteSpotBinary(TSF::Spot* spot)
  * Write a single spot to a line in a text file
  * The fields being output and their order is determined
  * by the vector "fields" that should contain fieldnames
+ * Formatting and writing to the stream can not be told apart, metrics
+ * accounts the time of both as serialization
  */
-void TSFUtils::WriteSpotText(std::ofstream* of, TSF::Spot* spot, std::vector<std::string>& fields)
+void TSFUtils::WriteSpotText(std::ostream* of, TSF::Spot* spot, 
+      std::vector<std::string>& fields, TSFMetrics* metrics)
 {
+   uint64_t start = metrics != NULL ? TSFMetrics::Now() : 0;
    const google::protobuf::Descriptor* sd = spot->GetDescriptor();
    const google::protobuf::Reflection* sr = spot->GetReflection();
 
@@ -513,6 +1013,14 @@ void TSFUtils::WriteSpotText(std::ofstream* of, TSF::Spot* spot, std::vector<std
       }
    }
    *of << "\n";
+
+   if (metrics != NULL)
+   {
+      uint64_t time = TSFMetrics::Now() - start;
+      metrics->AddTime(TSFMetrics::SERIALIZE, time);
+      metrics->AddWriteLatency(time);
+      metrics->AddSpotEncoded();
+   }
 }
 
 int32_t TSFUtils::SwapInt32(int32_t val)
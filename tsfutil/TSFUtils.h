@@ -16,6 +16,11 @@
 #include <vector>
 #include "../buildcpp/TSFProto.pb.h"
 #include "TSFException.h"
+#include "TSFOverlay.h"
+#include "TSFMetrics.h"
+#include "TSFTrace.h"
+#include "TSFSpotIterator.h"
+#include "TSFSpotView.h"
 
 
 class TSFUtils
@@ -23,17 +28,35 @@ class TSFUtils
    public:
       enum mode {
          READ = 0,
-         WRITE = 1
+         WRITE = 1,
+         APPEND = 2
       };
 
 
-      TSFUtils(std::fstream* fs, mode mode) throw (TSFException);
+      TSFUtils(std::fstream* fs, mode mode, TSFMetrics* metrics = NULL)
+         throw (TSFException);
       ~TSFUtils();
 
+      static TSFUtils* OpenForAppend(const char* fileName, std::fstream* fs,
+            TSF::SpotList* sl, TSFMetrics* metrics = NULL) throw (TSFException);
+
       int GetHeaderBinary(TSF::SpotList* sl) throw (TSFException);
       int GetSpotBinary(TSF::Spot* spot) throw (TSFException);
+      uint32_t GetSpotsBinary(std::vector<TSF::Spot>& spots, uint32_t maxSpots)
+         throw (TSFException);
+      bool NextSpot(TSF::Spot* spot) throw (TSFException);
+      /**
+       * The spots that have not been read yet, see TSFSpotIterator.h
+       * GetHeaderBinary should be called first
+       */
+      TSFSpotRange<TSFUtils> Spots() { return TSFSpotRange<TSFUtils>(this); };
+      bool NextSpotView(TSFSpotView* view) throw (TSFException);
+      void AddOverlay(TSFOverlay* overlay);
+      void AddOverlays(const std::string& tsfFileName) throw (TSFException);
 
       void WriteSpotBinary(TSF::Spot* spot);
+      void WriteSpotBinary(const uint8_t* data, uint32_t size);
+      void WriteSpotsBinary(std::vector<TSF::Spot>& spots, uint32_t nrSpots);
       void WriteHeaderBinary(TSF::SpotList* sl) throw (TSFException);
 
 
@@ -41,13 +64,14 @@ class TSFUtils
       static void GetSpotFields(std::ifstream* ifs, std::vector<std::string>& fields) 
          throw (TSFException);
       static int GetSpotText(std::ifstream* ifs, TSF::Spot* spot, 
-            std::vector<std::string>& fields) throw (TSFException);
+            std::vector<std::string>& fields, TSFMetrics* metrics = NULL) 
+         throw (TSFException);
 
       static void WriteHeaderText(std::ofstream* ofs, TSF::SpotList* sl) throw (TSFException);
       static void WriteSpotFields(std::ofstream* of, std::vector<std::string>& fields) 
          throw (TSFException);
-      static void WriteSpotText(std::ofstream* of, TSF::Spot* spot, 
-            std::vector<std::string>& fields);
+      static void WriteSpotText(std::ostream* of, TSF::Spot* spot, 
+            std::vector<std::string>& fields, TSFMetrics* metrics = NULL);
 
       static void ExtractSpotFields(TSF::Spot* spot, std::vector<std::string>& fields) 
          throw (TSFException);
@@ -64,6 +88,7 @@ class TSFUtils
       static void InsertByReflection(const google::protobuf::Reflection* sr,
          google::protobuf::Message* m, const google::protobuf::FieldDescriptor* fd, 
          std::string val);
+      static void MergeSpotList(TSF::SpotList* sl, const TSF::SpotList& other);
 
       union int32char {
          char ch[4];
@@ -97,13 +122,41 @@ class TSFUtils
       static std::vector<std::string> split(const std::string &s, char delim);
 
    private:
+      // the coded streams count bytes in an int, so they are replaced by
+      // new ones (at the boundary of a spot) after this many bytes
+      static const int RECYCLEBYTES = 1 << 30;
+
+      void OpenInput(int64_t limit);
+      void CloseInput();
+      int64_t InputPosition();
+      void RecycleInput();
+      void PrepareWrite();
+      void WriteRecord(const uint8_t* data, uint32_t size);
+
       mode mode_;
       std::fstream* fs_;
       bool firstWrite_;
-      google::protobuf::io::IstreamInputStream* input_;
+      int64_t baseOffset_;
+      // bytes read or written through earlier coded streams
+      int64_t inputBase_;
+      int64_t outputBase_;
+      int64_t spotsWritten_;
+      int64_t initialSpots_;
+      uint64_t spotsRead_;
+      int64_t spotsSize_;
+      std::vector<std::string> records_;
+      std::string batch_;
+      std::string viewBuffer_;
+      TSFMetrics* metrics_;
+      // the file when it is read through a LimitingInputStream
+      google::protobuf::io::ZeroCopyInputStream* fileInput_;
+      google::protobuf::io::ZeroCopyInputStream* input_;
       google::protobuf::io::CodedInputStream* codedInput_;
       google::protobuf::io::ZeroCopyOutputStream* output_;
       google::protobuf::io::CodedOutputStream* codedOutput_;
+      std::vector<TSFOverlay*> overlays_;
+      // the overlays opened by AddOverlays
+      std::vector<TSFOverlay*> ownOverlays_;
 };
 
 #endif
@@ -0,0 +1,880 @@
+/**
+ * tsfbench
+ *
+ * Measures the throughput (spots/s and MB/s) of the read and write paths
+ * of the TSF code, so that the effect of changes can be compared between
+ * commits:
+ *
+ *    WriteSpotBinary     TSFUtils, binary file, Spot messages
+ *    GetSpotBinary       TSFUtils, binary file, Spot messages
+ *    NextSpotView        TSFUtils, binary file, reads x, y and frame of
+ *                        each spot with TSFSpotView
+ *    GetSpotsPrefetch    TSFBatchReader, binary file, reads x, y and frame
+ *                        of each spot while the next batch is decoded
+ *    WriteSpotText       TSFUtils, tab delimited text
+ *    GetSpotText         TSFUtils, tab delimited text
+ *    GetNextSpot         TSFParser, Spot messages
+ *    MexFillMatrix       TSFParser::GetNextSpot(double*) into a fields x
+ *                        spots matrix, as done by mextsf ('matrix' output)
+ *    MexFillColumns      TSFParser::GetNextSpots into typed columns, as
+ *                        done by mextsf ('struct' output)
+ *
+ * Every benchmark is run for each of the given nr of spots, with only the
+ * required Spot fields ("minimal") and with all optional scalar fields
+ * ("full") set.  Input files are written to a scratch directory and are
+ * read back from the page cache, i.e. the numbers reflect the cost of
+ * parsing, not of the disk.  MB/s are based on the size of the file that
+ * is read or written.  The best of a number of repeats is reported, as
+ * JSON on stdout (or in the given file).
+ *
+ * On Linux, the hardware performance counters for cycles, instructions,
+ * cache misses and branch misses of the fastest run are reported per spot
+ * as well (user space only).  They include the threads started by a
+ * benchmark (e.g. the prefetch thread of GetSpotsPrefetch), as these are
+ * joined before the benchmark ends.  Counters that can not be opened (e.g.
+ * in virtual machines, or when /proc/sys/kernel/perf_event_paranoid is too
+ * restrictive) are reported as null.
+ *
+ * With -c, the results are compared with those in a JSON file written
+ * earlier by tsfbench (on the same machine), and tsfbench fails when the
+ * spots/s of any benchmark dropped by more than a given percentage.
+ */
+
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "TSFUtils.cpp"
+#include "TSFOverlay.cpp"
+#include "TSFMetrics.cpp"
+#include "TSFTrace.cpp"
+#include "TSFSpotView.cpp"
+#include "TSFBatchReader.cpp"
+#include "../matlab/mex/TSFParser.cpp"
+
+
+/**
+ * Hardware performance counters of the calling thread, and of the threads
+ * it starts after the counters were opened (their counts are added when
+ * they exit)
+ */
+class PerfCounters
+{
+   public:
+      enum Counter {
+         CYCLES = 0,
+         INSTRUCTIONS = 1,
+         CACHEMISSES = 2,
+         BRANCHMISSES = 3,
+         NRCOUNTERS = 4
+      };
+
+      PerfCounters();
+      ~PerfCounters();
+
+      bool IsAvailable(Counter c) const { return fds_[c] >= 0; };
+      void Start();
+      void Stop();
+      // value between the last Start and Stop, scaled when the kernel 
+      // had to multiplex the counters
+      double Get(Counter c) const { return values_[c]; };
+
+      static const char* Name(Counter c);
+
+   private:
+      int fds_[NRCOUNTERS];
+      double values_[NRCOUNTERS];
+};
+
+PerfCounters::PerfCounters()
+{
+   for (int c = 0; c < NRCOUNTERS; c++)
+   {
+      fds_[c] = -1;
+      values_[c] = 0.0;
+#ifdef __linux__
+      const uint64_t configs[NRCOUNTERS] = {PERF_COUNT_HW_CPU_CYCLES,
+         PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+         PERF_COUNT_HW_BRANCH_MISSES};
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[c];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.inherit = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | 
+         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fds_[c] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+   }
+}
+
+PerfCounters::~PerfCounters()
+{
+   for (int c = 0; c < NRCOUNTERS; c++)
+      if (fds_[c] >= 0)
+         close(fds_[c]);
+}
+
+void PerfCounters::Start()
+{
+#ifdef __linux__
+   for (int c = 0; c < NRCOUNTERS; c++)
+   {
+      if (fds_[c] < 0)
+         continue;
+      ioctl(fds_[c], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fds_[c], PERF_EVENT_IOC_ENABLE, 0);
+   }
+#endif
+}
+
+void PerfCounters::Stop()
+{
+#ifdef __linux__
+   for (int c = 0; c < NRCOUNTERS; c++)
+   {
+      values_[c] = 0.0;
+      if (fds_[c] < 0)
+         continue;
+      ioctl(fds_[c], PERF_EVENT_IOC_DISABLE, 0);
+      // value, time enabled, time running
+      uint64_t data[3];
+      if (read(fds_[c], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+         continue;
+      values_[c] = data[0];
+      if (data[2] < data[1])
+         values_[c] *= (double) data[1] / data[2];
+   }
+#endif
+}
+
+const char* PerfCounters::Name(Counter c)
+{
+   switch (c)
+   {
+      case CYCLES: return "cycles";
+      case INSTRUCTIONS: return "instructions";
+      case CACHEMISSES: return "cache_misses";
+      case BRANCHMISSES: return "branch_misses";
+      default: return "unknown";
+   }
+}
+
+
+struct Result
+{
+   std::string benchmark;
+   std::string density;
+   int nrFields;
+   uint64_t spots;
+   uint64_t bytes;
+   double seconds;
+   // per spot, negative when not available
+   double counters[PerfCounters::NRCOUNTERS];
+};
+
+struct Options
+{
+   std::vector<uint64_t> sizes;
+   std::string dir;
+   std::string label;
+   int repeats;
+   std::string host;
+};
+
+struct Baseline
+{
+   std::string benchmark;
+   std::string density;
+   uint64_t spots;
+   double spotsPerS;
+};
+
+
+static double Now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static uint64_t FileSize(const std::string& fileName)
+{
+   struct stat st;
+   if (stat(fileName.c_str(), &st) != 0)
+      return 0;
+   return st.st_size;
+}
+
+/**
+ * Sets the fields of spot i to values that are similar to those found in
+ * real data (growing molecule and frame numbers, positions in nm)
+ */
+static void FillSpot(TSF::Spot* spot, uint64_t i, bool full, uint64_t* state)
+{
+   *state ^= *state >> 12;
+   *state ^= *state << 25;
+   *state ^= *state >> 27;
+   float r = ((*state * 0x2545F4914F6CDD1DULL) >> 40) * (1.0f / 16777216.0f);
+
+   spot->set_molecule(i);
+   spot->set_channel(1);
+   spot->set_frame(1 + i / 100);
+   spot->set_x(25600.0f * r);
+   spot->set_y(25600.0f * (1.0f - r));
+   spot->set_intensity(500.0f + 2000.0f * r);
+   if (full)
+   {
+      spot->set_slice(1);
+      spot->set_pos(1);
+      spot->set_z(800.0f * (r - 0.5f));
+      spot->set_background(10.0f + 5.0f * r);
+      spot->set_width(130.0f + 20.0f * r);
+      spot->set_a(0.8f + 0.4f * r);
+      spot->set_theta(0.0f);
+      spot->set_x_original(spot->x());
+      spot->set_y_original(spot->y());
+      spot->set_x_precision(5.0f + 10.0f * r);
+      spot->set_y_precision(5.0f + 10.0f * r);
+   }
+}
+
+static void FillHeader(TSF::SpotList* sl, uint64_t nrSpots)
+{
+   sl->set_application_id(1);
+   sl->set_name("tsfbench");
+   sl->set_nr_pixels_x(256);
+   sl->set_nr_pixels_y(256);
+   sl->set_pixel_size(100.0);
+   sl->set_nr_spots(nrSpots);
+   sl->set_location_units(TSF::NM);
+   sl->set_intensity_units(TSF::PHOTONS);
+}
+
+
+static void WriteSpotBinary(const std::string& fileName, uint64_t n, bool full)
+{
+   std::fstream fs;
+   fs.open(fileName.c_str(), std::ios_base::in | std::ios_base::out |
+         std::ios_base::trunc | std::ios_base::binary);
+   TSFUtils* tsfOut = new TSFUtils(&fs, TSFUtils::WRITE);
+   TSF::Spot spot;
+   uint64_t state = 88172645463325252ULL;
+   for (uint64_t i = 0; i < n; i++)
+   {
+      FillSpot(&spot, i, full, &state);
+      tsfOut->WriteSpotBinary(&spot);
+   }
+   TSF::SpotList sl;
+   FillHeader(&sl, n);
+   tsfOut->WriteHeaderBinary(&sl);
+   delete tsfOut;
+   fs.close();
+}
+
+static void GetSpotBinary(const std::string& fileName, uint64_t n)
+{
+   std::fstream fs;
+   fs.open(fileName.c_str(), std::ios_base::in | std::ios_base::binary);
+   TSFUtils* tsfIn = new TSFUtils(&fs, TSFUtils::READ);
+   TSF::SpotList sl;
+   tsfIn->GetHeaderBinary(&sl);
+   TSF::Spot spot;
+   for (uint64_t i = 0; i < n; i++)
+   {
+      if (tsfIn->GetSpotBinary(&spot) != TSFUtils::GOOD)
+         throw TSFException("Failed to read spot in GetSpotBinary benchmark");
+   }
+   delete tsfIn;
+   fs.close();
+}
+
+static void NextSpotView(const std::string& fileName, uint64_t n)
+{
+   std::fstream fs;
+   fs.open(fileName.c_str(), std::ios_base::in | std::ios_base::binary);
+   TSFUtils* tsfIn = new TSFUtils(&fs, TSFUtils::READ);
+   TSF::SpotList sl;
+   tsfIn->GetHeaderBinary(&sl);
+   TSFSpotView view;
+   // the sum keeps the compiler from dropping the accessors
+   volatile double sum = 0.0;
+   for (uint64_t i = 0; i < n; i++)
+   {
+      if (!tsfIn->NextSpotView(&view))
+         throw TSFException("Failed to read spot in NextSpotView benchmark");
+      sum += view.x() + view.y() + view.frame();
+   }
+   delete tsfIn;
+   fs.close();
+}
+
+static void GetSpotsPrefetch(const std::string& fileName, uint64_t n)
+{
+   std::fstream fs;
+   fs.open(fileName.c_str(), std::ios_base::in | std::ios_base::binary);
+   TSFUtils* tsfIn = new TSFUtils(&fs, TSFUtils::READ);
+   TSF::SpotList sl;
+   tsfIn->GetHeaderBinary(&sl);
+   uint64_t counter = 0;
+   volatile double sum = 0.0;
+   {
+      TSFBatchReader reader(tsfIn, 10000);
+      const std::vector<TSF::Spot>* spots;
+      uint32_t nr;
+      while ((nr = reader.Next(&spots)) > 0)
+      {
+         for (uint32_t i = 0; i < nr; i++)
+            sum += (*spots)[i].x() + (*spots)[i].y() + (*spots)[i].frame();
+         counter += nr;
+      }
+   }
+   delete tsfIn;
+   fs.close();
+   if (counter != n)
+      throw TSFException("Failed to read spot in GetSpotsPrefetch benchmark");
+}
+
+/**
+ * The header is not written, WriteHeaderText is not part of the per spot
+ * cost and GetHeaderText has to parse its output
+ */
+static void WriteSpotText(const std::string& fileName, uint64_t n, bool full)
+{
+   std::ofstream ofs(fileName.c_str());
+   TSF::Spot spot;
+   uint64_t state = 88172645463325252ULL;
+   FillSpot(&spot, 0, full, &state);
+   std::vector<std::string> fields;
+   TSFUtils::ExtractSpotFields(&spot, fields);
+   TSFUtils::WriteSpotFields(&ofs, fields);
+   state = 88172645463325252ULL;
+   for (uint64_t i = 0; i < n; i++)
+   {
+      FillSpot(&spot, i, full, &state);
+      TSFUtils::WriteSpotText(&ofs, &spot, fields);
+   }
+   ofs.close();
+}
+
+static void GetSpotText(const std::string& fileName, uint64_t n)
+{
+   std::ifstream ifs(fileName.c_str());
+   std::vector<std::string> fields;
+   TSFUtils::GetSpotFields(&ifs, fields);
+   TSF::Spot spot;
+   for (uint64_t i = 0; i < n; i++)
+   {
+      if (TSFUtils::GetSpotText(&ifs, &spot, fields) != TSFUtils::GOOD)
+         throw TSFException("Failed to read spot in GetSpotText benchmark");
+   }
+   ifs.close();
+}
+
+/**
+ * TSFParser reads files that start with the SpotList (the layout written
+ * by older versions of the Micro-Manager localization plugin)
+ */
+static void WriteParserFile(const std::string& fileName, uint64_t n, bool full)
+{
+   std::ofstream ofs(fileName.c_str(), std::ios_base::binary);
+   google::protobuf::io::OstreamOutputStream* output =
+      new google::protobuf::io::OstreamOutputStream(&ofs);
+   google::protobuf::io::CodedOutputStream* codedOutput =
+      new google::protobuf::io::CodedOutputStream(output);
+   TSF::SpotList sl;
+   FillHeader(&sl, n);
+   std::string data;
+   sl.SerializeToString(&data);
+   codedOutput->WriteVarint32(data.size());
+   codedOutput->WriteRaw(data.data(), data.size());
+   TSF::Spot spot;
+   uint64_t state = 88172645463325252ULL;
+   for (uint64_t i = 0; i < n; i++)
+   {
+      FillSpot(&spot, i, full, &state);
+      spot.SerializeToString(&data);
+      codedOutput->WriteVarint32(data.size());
+      codedOutput->WriteRaw(data.data(), data.size());
+   }
+   delete codedOutput;
+   delete output;
+   ofs.close();
+}
+
+static std::vector<std::string> ParserFields(bool full)
+{
+   TSF::Spot spot;
+   uint64_t state = 1;
+   FillSpot(&spot, 0, full, &state);
+   std::vector<std::string> fields;
+   TSFUtils::ExtractSpotFields(&spot, fields);
+   return fields;
+}
+
+static void GetNextSpot(const std::string& fileName, uint64_t n, bool full)
+{
+   std::ifstream ifs(fileName.c_str(), std::ios_base::binary);
+   TSFParser parser(&ifs, ParserFields(full));
+   for (uint64_t i = 0; i < n; i++)
+      parser.GetNextSpot();
+   ifs.close();
+}
+
+static void MexFillMatrix(const std::string& fileName, uint64_t n, bool full)
+{
+   std::ifstream ifs(fileName.c_str(), std::ios_base::binary);
+   TSFParser parser(&ifs, ParserFields(full));
+   size_t nrFields = parser.GetFieldNumbers().size();
+   double* matrix = (double*) malloc(nrFields * n * sizeof(double));
+   uint64_t counter = 0;
+   while (counter < n && parser.GetNextSpot(&matrix[counter * nrFields]))
+      counter++;
+   free(matrix);
+   ifs.close();
+   if (counter != n)
+      throw TSFException("Failed to read spot in MexFillMatrix benchmark");
+}
+
+static void MexFillColumns(const std::string& fileName, uint64_t n, bool full)
+{
+   std::ifstream ifs(fileName.c_str(), std::ios_base::binary);
+   TSFParser parser(&ifs, ParserFields(full));
+   std::vector<int> numbers = parser.GetFieldNumbers();
+   std::vector<TSFParser::Column> columns(numbers.size());
+   for (unsigned int i = 0; i < numbers.size(); i++)
+   {
+      columns[i].fieldNumber = numbers[i];
+      columns[i].isFloat = TSFParser::IsFloatField(numbers[i]);
+      columns[i].asDouble = false;
+      columns[i].stride = 1;
+      columns[i].data = calloc(n, sizeof(int32_t));
+   }
+   uint64_t counter = parser.GetNextSpots(columns, n);
+   for (unsigned int i = 0; i < columns.size(); i++)
+      free(columns[i].data);
+   ifs.close();
+   if (counter != n)
+      throw TSFException("Failed to read spot in MexFillColumns benchmark");
+}
+
+
+/**
+ * Runs a single benchmark (identified by name) repeats times and keeps the
+ * fastest run
+ */
+static Result Run(const std::string& name, const std::string& dir,
+      uint64_t n, bool full, int repeats, PerfCounters* perf)
+{
+   std::string binFile = dir + "/tsfbench.tsf";
+   std::string txtFile = dir + "/tsfbench.txt";
+   std::string parserFile = dir + "/tsfbench.parser.tsf";
+
+   // input files for the read benchmarks
+   if (name == "GetSpotBinary" || name == "NextSpotView" ||
+         name == "GetSpotsPrefetch")
+      WriteSpotBinary(binFile, n, full);
+   else if (name == "GetSpotText")
+      WriteSpotText(txtFile, n, full);
+   else if (name == "GetNextSpot" || name == "MexFillMatrix" ||
+         name == "MexFillColumns")
+      WriteParserFile(parserFile, n, full);
+
+   Result result;
+   result.benchmark = name;
+   result.density = full ? "full" : "minimal";
+   result.nrFields = ParserFields(full).size();
+   result.spots = n;
+   result.seconds = 0.0;
+   for (int c = 0; c < PerfCounters::NRCOUNTERS; c++)
+      result.counters[c] = -1.0;
+   for (int r = 0; r < repeats; r++)
+   {
+      if (perf != NULL)
+         perf->Start();
+      double start = Now();
+      if (name == "WriteSpotBinary")
+         WriteSpotBinary(binFile, n, full);
+      else if (name == "GetSpotBinary")
+         GetSpotBinary(binFile, n);
+      else if (name == "NextSpotView")
+         NextSpotView(binFile, n);
+      else if (name == "GetSpotsPrefetch")
+         GetSpotsPrefetch(binFile, n);
+      else if (name == "WriteSpotText")
+         WriteSpotText(txtFile, n, full);
+      else if (name == "GetSpotText")
+         GetSpotText(txtFile, n);
+      else if (name == "GetNextSpot")
+         GetNextSpot(parserFile, n, full);
+      else if (name == "MexFillMatrix")
+         MexFillMatrix(parserFile, n, full);
+      else if (name == "MexFillColumns")
+         MexFillColumns(parserFile, n, full);
+      double seconds = Now() - start;
+      if (perf != NULL)
+         perf->Stop();
+      if (r == 0 || seconds < result.seconds)
+      {
+         result.seconds = seconds;
+         for (int c = 0; c < PerfCounters::NRCOUNTERS; c++)
+         {
+            PerfCounters::Counter counter = (PerfCounters::Counter) c;
+            if (perf != NULL && perf->IsAvailable(counter) && n > 0)
+               result.counters[c] = perf->Get(counter) / n;
+         }
+      }
+   }
+
+   if (name == "WriteSpotBinary" || name == "GetSpotBinary" ||
+         name == "NextSpotView" || name == "GetSpotsPrefetch")
+      result.bytes = FileSize(binFile);
+   else if (name == "WriteSpotText" || name == "GetSpotText")
+      result.bytes = FileSize(txtFile);
+   else
+      result.bytes = FileSize(parserFile);
+
+   unlink(binFile.c_str());
+   unlink(txtFile.c_str());
+   unlink(parserFile.c_str());
+
+   return result;
+}
+
+static void WriteJSON(FILE* out, const Options& opt,
+      const std::vector<Result>& results)
+{
+   fprintf(out, "{\n");
+   fprintf(out, "  \"label\": \"%s\",\n", opt.label.c_str());
+   fprintf(out, "  \"host\": \"%s\",\n", opt.host.c_str());
+   fprintf(out, "  \"repeats\": %d,\n", opt.repeats);
+   fprintf(out, "  \"results\": [\n");
+   for (unsigned int i = 0; i < results.size(); i++)
+   {
+      const Result& r = results[i];
+      double seconds = r.seconds > 0.0 ? r.seconds : 1.0e-9;
+      fprintf(out, "    {\"benchmark\": \"%s\", \"density\": \"%s\", "
+            "\"fields\": %d, \"spots\": %llu, \"bytes\": %llu, "
+            "\"seconds\": %.6f, \"spots_per_s\": %.0f, \"mb_per_s\": %.2f",
+            r.benchmark.c_str(), r.density.c_str(), r.nrFields,
+            (unsigned long long) r.spots, (unsigned long long) r.bytes,
+            r.seconds, r.spots / seconds, r.bytes / seconds / 1.0e6);
+      for (int c = 0; c < PerfCounters::NRCOUNTERS; c++)
+      {
+         const char* name = PerfCounters::Name((PerfCounters::Counter) c);
+         if (r.counters[c] >= 0.0)
+            fprintf(out, ", \"%s_per_spot\": %.3f", name, r.counters[c]);
+         else
+            fprintf(out, ", \"%s_per_spot\": null", name);
+      }
+      fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+   }
+   fprintf(out, "  ]\n");
+   fprintf(out, "}\n");
+}
+
+/**
+ * Finds the value of "key" in a line of JSON as written by WriteJSON (this
+ * is not a general JSON parser).  String values are returned without quotes
+ */
+static bool JSONValue(const std::string& line, const std::string& key,
+      std::string* value)
+{
+   size_t pos = line.find("\"" + key + "\":");
+   if (pos == std::string::npos)
+      return false;
+   pos = line.find_first_not_of(" ", pos + key.size() + 3);
+   if (pos == std::string::npos)
+      return false;
+   if (line[pos] == '"')
+   {
+      size_t end = line.find('"', pos + 1);
+      if (end == std::string::npos)
+         return false;
+      *value = line.substr(pos + 1, end - pos - 1);
+   } else
+   {
+      size_t end = line.find_first_of(",}", pos);
+      *value = line.substr(pos, end == std::string::npos ? end : end - pos);
+   }
+   return true;
+}
+
+static bool ReadBaseline(const std::string& fileName, std::string* host,
+      std::vector<Baseline>& baselines)
+{
+   std::ifstream ifs(fileName.c_str());
+   if (!ifs.is_open())
+      return false;
+   std::string line;
+   while (std::getline(ifs, line))
+   {
+      std::string value;
+      if (JSONValue(line, "host", &value) && 
+            line.find("\"benchmark\"") == std::string::npos)
+         *host = value;
+      Baseline b;
+      std::string spots, spotsPerS;
+      if (JSONValue(line, "benchmark", &b.benchmark) &&
+            JSONValue(line, "density", &b.density) &&
+            JSONValue(line, "spots", &spots) &&
+            JSONValue(line, "spots_per_s", &spotsPerS))
+      {
+         b.spots = strtoull(spots.c_str(), NULL, 10);
+         b.spotsPerS = atof(spotsPerS.c_str());
+         baselines.push_back(b);
+      }
+   }
+   return true;
+}
+
+/**
+ * Prints a table comparing results with baselines, and returns the nr of
+ * benchmarks whose spots/s dropped by more than maxDrop percent
+ */
+static int Compare(const std::vector<Result>& results,
+      const std::vector<Baseline>& baselines, double maxDrop)
+{
+   int nrRegressions = 0;
+   printf("%-16s %-8s %10s %12s %12s %8s\n", "benchmark", "density", "spots",
+         "baseline/s", "spots/s", "change");
+   for (unsigned int i = 0; i < results.size(); i++)
+   {
+      const Result& r = results[i];
+      double spotsPerS = r.spots / (r.seconds > 0.0 ? r.seconds : 1.0e-9);
+      const Baseline* b = NULL;
+      for (unsigned int j = 0; j < baselines.size() && b == NULL; j++)
+      {
+         if (baselines[j].benchmark == r.benchmark &&
+               baselines[j].density == r.density && 
+               baselines[j].spots == r.spots)
+            b = &baselines[j];
+      }
+      if (b == NULL || b->spotsPerS <= 0.0)
+      {
+         printf("%-16s %-8s %10llu %12s %12.0f %8s\n", r.benchmark.c_str(),
+               r.density.c_str(), (unsigned long long) r.spots, "-",
+               spotsPerS, "-");
+         continue;
+      }
+      double change = 100.0 * (spotsPerS - b->spotsPerS) / b->spotsPerS;
+      bool regression = change < -maxDrop;
+      printf("%-16s %-8s %10llu %12.0f %12.0f %+7.1f%%%s\n", 
+            r.benchmark.c_str(), r.density.c_str(), 
+            (unsigned long long) r.spots, b->spotsPerS, spotsPerS, change,
+            regression ? "  REGRESSION" : "");
+      if (regression)
+         nrRegressions++;
+   }
+   return nrRegressions;
+}
+
+
+void usage (const char* name)
+{
+   printf("Usage: %s [options]\n", name);
+   printf("Options:\n");
+   printf("  -n sizes      comma separated nr of spots to benchmark with\n");
+   printf("                (default 100000,1000000)\n");
+   printf("  -b names      comma separated benchmarks to run (default all):\n");
+   printf("                WriteSpotBinary, GetSpotBinary, NextSpotView,\n");
+   printf("                GetSpotsPrefetch, WriteSpotText, GetSpotText,\n");
+   printf("                GetNextSpot, MexFillMatrix, MexFillColumns\n");
+   printf("  -r repeats    run each benchmark this many times and report the\n");
+   printf("                fastest (default 3)\n");
+   printf("  -d directory  scratch directory for the data files (default /tmp)\n");
+   printf("  -l label      label stored in the output, e.g. a commit id\n");
+   printf("  -o file       write the JSON output to file instead of stdout\n");
+   printf("  -P            do not read the hardware performance counters\n");
+   printf("  -c baseline   compare with the results in this file (written by\n");
+   printf("                tsfbench -o) and fail when spots/s dropped.  Unless\n");
+   printf("                given, the benchmarks and sizes are those of the\n");
+   printf("                baseline\n");
+   printf("  -t percent    largest drop in spots/s accepted by -c (default 10)\n");
+}
+
+
+int main (int argc, char* argv[])
+{
+   Options opt;
+   opt.dir = "/tmp";
+   opt.repeats = 3;
+   bool useCounters = true;
+   std::string outputFile;
+   std::string baselineFile;
+   double maxDrop = 10.0;
+   std::vector<std::string> names;
+
+   int c;
+   while ((c = getopt(argc, argv, "n:b:r:d:l:o:Pc:t:")) != -1)
+   {
+      switch (c)
+      {
+         case 'n':
+         {
+            std::vector<std::string> sizes = TSFUtils::split(optarg, ',');
+            for (unsigned int i = 0; i < sizes.size(); i++)
+               opt.sizes.push_back(strtoull(sizes[i].c_str(), NULL, 10));
+            break;
+         }
+         case 'b': names = TSFUtils::split(optarg, ','); break;
+         case 'r': opt.repeats = atoi(optarg); break;
+         case 'd': opt.dir = optarg; break;
+         case 'l': opt.label = optarg; break;
+         case 'o': outputFile = optarg; break;
+         case 'P': useCounters = false; break;
+         case 'c': baselineFile = optarg; break;
+         case 't': maxDrop = atof(optarg); break;
+         default:
+            usage(argv[0]);
+            return 1;
+      }
+   }
+   if (optind != argc || opt.repeats < 1 || maxDrop < 0.0)
+   {
+      usage(argv[0]);
+      return 1;
+   }
+
+   char host[256];
+   if (gethostname(host, sizeof(host)) == 0)
+   {
+      host[sizeof(host) - 1] = 0;
+      opt.host = host;
+   }
+
+   std::vector<Baseline> baselines;
+   if (baselineFile != "")
+   {
+      std::string baselineHost;
+      if (!ReadBaseline(baselineFile, &baselineHost, baselines) || 
+            baselines.empty())
+      {
+         printf("Failed to read benchmark results from %s\n", 
+               baselineFile.c_str());
+         return 1;
+      }
+      if (baselineHost != opt.host)
+         fprintf(stderr, "Warning: the baseline was measured on %s, this is %s\n",
+               baselineHost.c_str(), opt.host.c_str());
+      bool sizesGiven = !opt.sizes.empty();
+      bool namesGiven = !names.empty();
+      for (unsigned int i = 0; i < baselines.size(); i++)
+      {
+         if (!sizesGiven && std::find(opt.sizes.begin(), opt.sizes.end(),
+                  baselines[i].spots) == opt.sizes.end())
+            opt.sizes.push_back(baselines[i].spots);
+         if (!namesGiven && std::find(names.begin(), names.end(),
+                  baselines[i].benchmark) == names.end())
+            names.push_back(baselines[i].benchmark);
+      }
+   }
+   if (opt.sizes.empty())
+   {
+      opt.sizes.push_back(100000);
+      opt.sizes.push_back(1000000);
+   }
+   const char* all[] = {"WriteSpotBinary", "GetSpotBinary", "NextSpotView",
+      "GetSpotsPrefetch", "WriteSpotText", "GetSpotText", "GetNextSpot",
+      "MexFillMatrix", "MexFillColumns"};
+   const int nrAll = sizeof(all) / sizeof(all[0]);
+   if (names.empty())
+      names.assign(all, all + nrAll);
+   for (unsigned int b = 0; b < names.size(); b++)
+   {
+      if (std::find(all, all + nrAll, names[b]) == all + nrAll)
+      {
+         printf("Unknown benchmark: %s\n", names[b].c_str());
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   // Silence Protocol Buffer warnings
+   google::protobuf::LogSilencer* ls = new google::protobuf::LogSilencer();
+
+   PerfCounters* perf = NULL;
+   if (useCounters)
+   {
+      perf = new PerfCounters();
+      for (int c = 0; c < PerfCounters::NRCOUNTERS; c++)
+      {
+         PerfCounters::Counter counter = (PerfCounters::Counter) c;
+         if (!perf->IsAvailable(counter))
+            fprintf(stderr, "Performance counter %s is not available\n",
+                  PerfCounters::Name(counter));
+      }
+   }
+
+   std::vector<Result> results;
+   try {
+      for (unsigned int s = 0; s < opt.sizes.size(); s++)
+      {
+         for (int full = 0; full < 2; full++)
+         {
+            for (unsigned int b = 0; b < names.size(); b++)
+            {
+               Result r = Run(names[b], opt.dir, opt.sizes[s], full == 1,
+                     opt.repeats, perf);
+               fprintf(stderr, "%-16s %-8s %10llu spots %8.3f s\n",
+                     r.benchmark.c_str(), r.density.c_str(),
+                     (unsigned long long) r.spots, r.seconds);
+               results.push_back(r);
+            }
+         }
+      }
+   } catch (TSFException& ex)
+   {
+      std::cout << ex.getMessage().c_str() << std::endl;
+      return 1;
+   }
+
+   delete perf;
+
+   FILE* out = stdout;
+   if (outputFile != "")
+   {
+      out = fopen(outputFile.c_str(), "w");
+      if (out == NULL)
+      {
+         printf("Failed to open %s\n", outputFile.c_str());
+         return 1;
+      }
+   }
+   // in compare mode stdout is used for the report
+   if (out != stdout || baselineFile == "")
+      WriteJSON(out, opt, results);
+   if (out != stdout)
+      fclose(out);
+
+   delete ls;
+
+   if (baselineFile != "")
+   {
+      int nrRegressions = Compare(results, baselines, maxDrop);
+      if (nrRegressions > 0)
+      {
+         printf("%d benchmark(s) are more than %.1f%% slower than in %s\n",
+               nrRegressions, maxDrop, baselineFile.c_str());
+         return 1;
+      }
+      printf("No benchmark is more than %.1f%% slower than in %s\n",
+            maxDrop, baselineFile.c_str());
+   }
+
+   return 0;
+}
@@ -0,0 +1,429 @@
+/**
+ * Plain C interface to Tagged Spot Format files, see tsfc.h
+ *
+ * Reading memory maps the file and decodes spots with the columnar decoder
+ * of TSFParser, writing encodes spots from columns and writes them with
+ * TSFUtils.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "tsfc.h"
+#include "TSFUtils.h"
+#include "TSFOverlay.h"
+#include "TSFRecords.h"
+#include "../matlab/mex/TSFParser.h"
+
+static __thread char lastError[256];
+
+
+struct tsf_reader
+{
+   TSFMappedFile* file;
+   const uint8_t* begin;
+   const uint8_t* end;
+   const uint8_t* p;
+   uint64_t ordinal;
+   // counted on first use when the SpotList does not have nr_spots
+   bool nrSpotsKnown;
+   uint64_t nrSpots;
+   TSF::SpotList spotList;
+   TSF::Spot firstSpot;
+   std::vector<TSFOverlay*> overlays;
+};
+
+struct tsf_writer
+{
+   std::fstream fs;
+   TSFUtils* tsf;
+   TSF::SpotList spotList;
+   uint64_t nrSpots;
+};
+
+
+static int SetError(const std::string& msg)
+{
+   snprintf(lastError, sizeof(lastError), "%s", msg.c_str());
+   return TSF_ERROR;
+}
+
+static uint64_t GetNrSpots(tsf_reader* reader)
+{
+   if (!reader->nrSpotsKnown)
+   {
+      reader->nrSpots = TSFRecords::CountRecords(reader->begin, reader->end);
+      reader->nrSpotsKnown = true;
+   }
+   return reader->nrSpots;
+}
+
+
+const char* tsf_last_error(void)
+{
+   return lastError;
+}
+
+int tsf_nr_fields(void)
+{
+   return TSFParser::GetFieldTable().size();
+}
+
+const char* tsf_field_name(int index)
+{
+   const std::vector<TSFParser::FieldInfo>& table = TSFParser::GetFieldTable();
+   if (index < 0 || index >= (int) table.size())
+      return NULL;
+   return table[index].name.c_str();
+}
+
+int tsf_field_number(const char* name)
+{
+   const TSFParser::FieldInfo* info = TSFParser::FindField(name);
+   return info != NULL ? info->number : -1;
+}
+
+int tsf_field_is_float(int fieldNumber)
+{
+   return TSFParser::IsFloatField(fieldNumber) ? 1 : 0;
+}
+
+
+tsf_reader* tsf_open(const char* fileName)
+{
+   tsf_reader* reader = new tsf_reader();
+   reader->file = NULL;
+
+   uint64_t offset;
+   try {
+      offset = TSFRecords::ReadHeader(fileName, &reader->spotList);
+
+      const std::vector<TSFParser::FieldInfo>& table = TSFParser::GetFieldTable();
+      for (unsigned int i = 0; i < table.size(); i++)
+      {
+         if (TSFOverlay::Exists(fileName, table[i].name))
+            reader->overlays.push_back(new TSFOverlay(fileName, table[i].name));
+      }
+   } catch (TSFException& ex) {
+      SetError(ex.getMessage());
+      tsf_close(reader);
+      return NULL;
+   }
+
+   reader->file = new TSFMappedFile(fileName);
+   if (!reader->file->IsOpen() ||
+         reader->file->GetSize() < TSFRecords::SPOTSSTART + offset)
+   {
+      SetError("Failed to map the spot data of the file");
+      tsf_close(reader);
+      return NULL;
+   }
+
+   reader->begin = reader->file->GetData() + TSFRecords::SPOTSSTART;
+   reader->end = reader->begin + offset;
+   reader->p = reader->begin;
+   reader->ordinal = 0;
+
+   // walking all spots of a large file takes a while, which is only
+   // needed when the writer did not record their nr
+   reader->nrSpotsKnown = reader->spotList.has_nr_spots();
+   reader->nrSpots = reader->spotList.nr_spots();
+
+   const uint8_t* p = reader->begin;
+   const uint8_t* record;
+   uint32_t size;
+   if (TSFRecords::NextRecord(&p, reader->end, &record, &size))
+      reader->firstSpot.ParseFromArray(record, size);
+
+   return reader;
+}
+
+void tsf_close(tsf_reader* reader)
+{
+   if (reader == NULL)
+      return;
+   for (unsigned int i = 0; i < reader->overlays.size(); i++)
+      delete reader->overlays[i];
+   delete reader->file;
+   delete reader;
+}
+
+static const google::protobuf::FieldDescriptor* GetHeaderField(
+      tsf_reader* reader, const char* name)
+{
+   if (reader == NULL || name == NULL)
+   {
+      SetError("Programming error: reader or name is NULL");
+      return NULL;
+   }
+   const google::protobuf::FieldDescriptor* fd =
+      reader->spotList.GetDescriptor()->FindFieldByName(name);
+   if (fd == NULL || fd->is_repeated())
+   {
+      SetError(std::string("Unknown or unsupported header field: ") + name);
+      return NULL;
+   }
+   if (!reader->spotList.GetReflection()->HasField(reader->spotList, fd))
+   {
+      SetError(std::string("Header field is not set: ") + name);
+      return NULL;
+   }
+   return fd;
+}
+
+int tsf_header_int(tsf_reader* reader, const char* name, int64_t* value)
+{
+   const google::protobuf::FieldDescriptor* fd = GetHeaderField(reader, name);
+   if (fd == NULL)
+      return TSF_ERROR;
+   const google::protobuf::Reflection* slr = reader->spotList.GetReflection();
+   switch (fd->cpp_type())
+   {
+      case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+         *value = slr->GetInt32(reader->spotList, fd);
+         break;
+      case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
+         *value = slr->GetInt64(reader->spotList, fd);
+         break;
+      case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
+         *value = slr->GetUInt32(reader->spotList, fd);
+         break;
+      case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+         *value = (int64_t) slr->GetUInt64(reader->spotList, fd);
+         break;
+      case google::protobuf::FieldDescriptor::CPPTYPE_BOOL:
+         *value = slr->GetBool(reader->spotList, fd) ? 1 : 0;
+         break;
+      case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+         *value = slr->GetEnum(reader->spotList, fd)->number();
+         break;
+      default:
+         return SetError(std::string("Header field is not an integer: ") + name);
+   }
+   return TSF_OK;
+}
+
+int tsf_header_double(tsf_reader* reader, const char* name, double* value)
+{
+   const google::protobuf::FieldDescriptor* fd = GetHeaderField(reader, name);
+   if (fd == NULL)
+      return TSF_ERROR;
+   const google::protobuf::Reflection* slr = reader->spotList.GetReflection();
+   switch (fd->cpp_type())
+   {
+      case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+         *value = slr->GetFloat(reader->spotList, fd);
+         break;
+      case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+         *value = slr->GetDouble(reader->spotList, fd);
+         break;
+      default:
+         {
+            int64_t val;
+            if (tsf_header_int(reader, name, &val) != TSF_OK)
+               return TSF_ERROR;
+            *value = (double) val;
+         }
+   }
+   return TSF_OK;
+}
+
+int tsf_header_string(tsf_reader* reader, const char* name, char* buf,
+      size_t bufSize)
+{
+   const google::protobuf::FieldDescriptor* fd = GetHeaderField(reader, name);
+   if (fd == NULL)
+      return TSF_ERROR;
+   const google::protobuf::Reflection* slr = reader->spotList.GetReflection();
+   std::string val;
+   switch (fd->cpp_type())
+   {
+      case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+         val = slr->GetString(reader->spotList, fd);
+         break;
+      case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+         val = slr->GetEnum(reader->spotList, fd)->name();
+         break;
+      default:
+         return SetError(std::string("Header field is not a string: ") + name);
+   }
+   if (buf == NULL || val.size() >= bufSize)
+      return SetError("Buffer is too small");
+   memcpy(buf, val.c_str(), val.size() + 1);
+   return TSF_OK;
+}
+
+uint64_t tsf_nr_spots(tsf_reader* reader)
+{
+   return reader != NULL ? GetNrSpots(reader) : 0;
+}
+
+int tsf_has_field(tsf_reader* reader, int fieldNumber)
+{
+   if (reader == NULL)
+      return 0;
+   const std::vector<TSFParser::FieldInfo>& table = TSFParser::GetFieldTable();
+   for (unsigned int i = 0; i < table.size(); i++)
+   {
+      if (table[i].number == fieldNumber)
+         return reader->firstSpot.GetReflection()->HasField(reader->firstSpot,
+               table[i].fd) ? 1 : 0;
+   }
+   return 0;
+}
+
+int tsf_read(tsf_reader* reader, int nrFields, const int* fieldNumbers,
+      void* const* buffers, uint64_t maxSpots, uint64_t* nrRead)
+{
+   if (reader == NULL || nrRead == NULL || (nrFields > 0 &&
+            (fieldNumbers == NULL || buffers == NULL)))
+      return SetError("Programming error: NULL argument");
+   *nrRead = 0;
+
+   std::vector<TSFParser::Column> columns(nrFields);
+   for (int i = 0; i < nrFields; i++)
+   {
+      columns[i].fieldNumber = fieldNumbers[i];
+      columns[i].isFloat = TSFParser::IsFloatField(fieldNumbers[i]);
+      columns[i].asDouble = false;
+      columns[i].stride = 1;
+      columns[i].data = buffers[i];
+      memset(buffers[i], 0, maxSpots * sizeof(int32_t));
+   }
+   std::vector<int> lookup = TSFParser::BuildLookup(columns);
+
+   uint64_t n = 0;
+   while (n < maxSpots && reader->p < reader->end)
+   {
+      const uint8_t* q = reader->p;
+      const uint8_t* record;
+      uint32_t size;
+      if (!TSFRecords::NextRecord(&q, reader->end, &record, &size))
+         break;
+      if (!TSFParser::DecodeSpot(record, size, columns, lookup, n,
+               reader->overlays, reader->ordinal))
+         return SetError("Failed to decode spot data");
+      reader->p = q;
+      reader->ordinal++;
+      n++;
+   }
+   *nrRead = n;
+   return TSF_OK;
+}
+
+int tsf_seek(tsf_reader* reader, uint64_t spot)
+{
+   if (reader == NULL)
+      return SetError("Programming error: reader is NULL");
+   if (spot > GetNrSpots(reader))
+      return SetError("Spot is beyond the end of the file");
+   if (spot < reader->ordinal)
+   {
+      reader->p = reader->begin;
+      reader->ordinal = 0;
+   }
+   const uint8_t* record;
+   uint32_t size;
+   while (reader->ordinal < spot &&
+         TSFRecords::NextRecord(&reader->p, reader->end, &record, &size))
+      reader->ordinal++;
+   return TSF_OK;
+}
+
+
+tsf_writer* tsf_create(const char* fileName)
+{
+   tsf_writer* writer = new tsf_writer();
+   writer->tsf = NULL;
+   writer->nrSpots = 0;
+   writer->fs.open(fileName, std::ios_base::in | std::ios_base::out |
+         std::ios_base::trunc | std::ios_base::binary);
+   try {
+      writer->tsf = new TSFUtils(&writer->fs, TSFUtils::WRITE);
+   } catch (TSFException& ex) {
+      SetError(ex.getMessage());
+      delete writer;
+      return NULL;
+   }
+   writer->spotList.set_application_id(1);
+   return writer;
+}
+
+int tsf_set_header(tsf_writer* writer, const char* name, const char* value)
+{
+   if (writer == NULL || name == NULL || value == NULL)
+      return SetError("Programming error: NULL argument");
+   const google::protobuf::FieldDescriptor* fd =
+      writer->spotList.GetDescriptor()->FindFieldByName(name);
+   if (fd == NULL || fd->is_repeated() ||
+         fd->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE)
+      return SetError(std::string("Unknown or unsupported header field: ") + name);
+   try {
+      TSFUtils::InsertByReflection(writer->spotList.GetReflection(),
+            &writer->spotList, fd, value);
+   } catch (TSFException& ex) {
+      return SetError(ex.getMessage());
+   }
+   return TSF_OK;
+}
+
+int tsf_write(tsf_writer* writer, int nrFields, const int* fieldNumbers,
+      const void* const* buffers, uint64_t nrSpots)
+{
+   if (writer == NULL || writer->tsf == NULL || (nrFields > 0 &&
+            (fieldNumbers == NULL || buffers == NULL)))
+      return SetError("Programming error: NULL argument");
+
+   std::vector<TSFRecords::Column> columns;
+   for (int i = 0; i < nrFields; i++)
+   {
+      bool known = false;
+      const std::vector<TSFParser::FieldInfo>& table = TSFParser::GetFieldTable();
+      for (unsigned int t = 0; t < table.size() && !known; t++)
+         known = table[t].number == fieldNumbers[i];
+      if (!known)
+         return SetError("Unknown or unsupported field number");
+      TSFRecords::Column column;
+      column.number = fieldNumbers[i];
+      column.isFloat = TSFParser::IsFloatField(fieldNumbers[i]);
+      column.data = buffers[i];
+      columns.push_back(column);
+   }
+   std::string missing;
+   if (!TSFRecords::CompleteColumns(columns, &missing))
+      return SetError("Required field " + missing + " is missing");
+
+   std::vector<uint8_t> buf(columns.size() * TSFRecords::MAXFIELDBYTES + 1);
+   try {
+      for (uint64_t i = 0; i < nrSpots; i++)
+      {
+         uint32_t size = TSFRecords::EncodeSpot(columns, i,
+               writer->nrSpots + i, &buf[0]);
+         writer->tsf->WriteSpotBinary(&buf[0], size);
+      }
+   } catch (TSFException& ex) {
+      return SetError(ex.getMessage());
+   }
+   writer->nrSpots += nrSpots;
+   return TSF_OK;
+}
+
+int tsf_finish(tsf_writer* writer)
+{
+   if (writer == NULL)
+      return SetError("Programming error: writer is NULL");
+   int result = TSF_OK;
+   writer->spotList.set_nr_spots(writer->nrSpots);
+   try {
+      writer->tsf->WriteHeaderBinary(&writer->spotList);
+   } catch (TSFException& ex) {
+      result = SetError(ex.getMessage());
+   }
+   delete writer->tsf;
+   writer->fs.close();
+   delete writer;
+   return result;
+}
@@ -0,0 +1,102 @@
+/**
+ * Plain C interface to Tagged Spot Format files
+ *
+ * Meant to be loaded as a shared library (libtsf) from languages that can
+ * call C functions (Matlab, Python ctypes, Julia ccall, Java JNI, etc..).
+ * Spots are read and written in batches of columns: one caller-provided
+ * buffer per field holding int32_t values (integer and enum fields) or float
+ * values (all others).  Use tsf_field_is_float to find out which.
+ *
+ * Functions returning int return TSF_OK on success and TSF_ERROR on failure,
+ * in which case tsf_last_error returns a description of the problem.
+ */
+
+#ifndef TSFC_H
+#define TSFC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TSF_OK 0
+#define TSF_ERROR -1
+
+typedef struct tsf_reader tsf_reader;
+typedef struct tsf_writer tsf_writer;
+
+/**
+ * Message describing the last error that occurred in the calling thread
+ */
+const char* tsf_last_error(void);
+
+/**
+ * Fields of the Spot message (including linked in extensions) that can be
+ * read and written.  Names are as in TSFProto.proto, e.g. "x" or "frame".
+ * tsf_field_number returns -1 for unknown names.
+ */
+int tsf_nr_fields(void);
+const char* tsf_field_name(int index);
+int tsf_field_number(const char* name);
+int tsf_field_is_float(int fieldNumber);
+
+/**
+ * Reading.  tsf_open returns NULL when the file can not be opened
+ */
+tsf_reader* tsf_open(const char* fileName);
+void tsf_close(tsf_reader* reader);
+
+/**
+ * Header (SpotList) fields, by name.  Enums are returned by number by
+ * tsf_header_int and by name by tsf_header_string.  Fails when the field
+ * is not set.
+ */
+int tsf_header_int(tsf_reader* reader, const char* name, int64_t* value);
+int tsf_header_double(tsf_reader* reader, const char* name, double* value);
+int tsf_header_string(tsf_reader* reader, const char* name, char* buf,
+      size_t bufSize);
+
+/**
+ * Nr of spots in the file (nr_spots of the header, or counted on the first
+ * call when the header does not have it) and whether the first spot
+ * contains the given field
+ */
+uint64_t tsf_nr_spots(tsf_reader* reader);
+int tsf_has_field(tsf_reader* reader, int fieldNumber);
+
+/**
+ * Decodes up to maxSpots spots, starting at the current position, into
+ * buffers[i] (one per entry in fieldNumbers, each with room for maxSpots
+ * values).  Absent fields are stored as 0.  Sidecar overlays next to the
+ * file are applied.  nrRead is set to the nr of spots decoded, which is
+ * 0 at the end of the file.
+ */
+int tsf_read(tsf_reader* reader, int nrFields, const int* fieldNumbers,
+      void* const* buffers, uint64_t maxSpots, uint64_t* nrRead);
+
+/**
+ * Positions the reader such that the next tsf_read starts at spot
+ * (0-based)
+ */
+int tsf_seek(tsf_reader* reader, uint64_t spot);
+
+/**
+ * Writing.  Spots are written with (repeated calls to) tsf_write.
+ * All required Spot fields need to be given, except for molecule, which
+ * defaults to the ordinal of the spot.  Header fields can be set at any
+ * time before tsf_finish, which writes the header (with nr_spots set),
+ * closes the file and frees the writer.
+ */
+tsf_writer* tsf_create(const char* fileName);
+int tsf_set_header(tsf_writer* writer, const char* name, const char* value);
+int tsf_write(tsf_writer* writer, int nrFields, const int* fieldNumbers,
+      const void* const* buffers, uint64_t nrSpots);
+int tsf_finish(tsf_writer* writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
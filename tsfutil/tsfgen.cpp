@@ -0,0 +1,348 @@
+/**
+ * tsfgen
+ *
+ * Generates synthetic localization microscopy data sets in Tagged Spot
+ * Format, for benchmarking and regression testing of the read and write
+ * paths.  Output is fully determined by the options and the seed.
+ *
+ * Fluorophores are switched on at random positions at a rate that gives on
+ * average "density" spots per frame per channel.  Each fluorophore stays on
+ * for a geometrically distributed nr of frames (blinking), and produces a
+ * localization with a random photon count and localization error in every
+ * frame that it is on.  All spots of a fluorophore share its molecule id.
+ *
+ * Spots are encoded directly from their values (no Spot messages are
+ * created), fast enough to generate billions of spots.
+ */
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "TSFUtils.cpp"
+#include "TSFOverlay.cpp"
+#include "TSFMetrics.cpp"
+#include "TSFTrace.cpp"
+#include "TSFSpotView.cpp"
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/wire_format_lite.h>
+
+using google::protobuf::internal::WireFormatLite;
+
+
+/**
+ * Small, fast and deterministic random number generator (xorshift64*),
+ * seeded with splitmix64 so that nearby seeds give unrelated sequences
+ */
+class Random
+{
+   public:
+      Random(uint64_t seed)
+      {
+         uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+         z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+         z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+         state_ = z ^ (z >> 31);
+         if (state_ == 0)
+            state_ = 1;
+      };
+
+      uint64_t Next()
+      {
+         state_ ^= state_ >> 12;
+         state_ ^= state_ << 25;
+         state_ ^= state_ >> 27;
+         return state_ * 0x2545F4914F6CDD1DULL;
+      };
+
+      // uniform in [0, 1)
+      double Uniform() { return (Next() >> 11) * (1.0 / 9007199254740992.0); };
+
+      double Normal()
+      {
+         double u1 = Uniform();
+         double u2 = Uniform();
+         return sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * M_PI * u2);
+      };
+
+      uint32_t Poisson(double mean)
+      {
+         if (mean > 30.0)
+         {
+            double val = mean + sqrt(mean) * Normal() + 0.5;
+            return val > 0.0 ? (uint32_t) val : 0;
+         }
+         double limit = exp(-mean);
+         double product = Uniform();
+         uint32_t n = 0;
+         while (product > limit)
+         {
+            product *= Uniform();
+            n++;
+         }
+         return n;
+      };
+
+      // nr of frames a fluorophore stays on, at least 1
+      uint32_t Geometric(double mean)
+      {
+         if (mean <= 1.0)
+            return 1;
+         return 1 + (uint32_t) (log(1.0 - Uniform()) / log(1.0 - 1.0 / mean));
+      };
+
+   private:
+      uint64_t state_;
+};
+
+
+struct Fluorophore
+{
+   int32_t molecule;
+   float x, y, z;
+   float photons;
+   uint32_t framesLeft;
+};
+
+struct Options
+{
+   int32_t nrFrames;
+   double density;
+   int32_t nrChannels;
+   double onTime;
+   int32_t nrPixels;
+   float pixelSize;
+   uint64_t seed;
+   uint64_t maxSpots;
+   bool allFields;
+   bool extensions;
+};
+
+
+void usage (const char* name)
+{
+   printf("Usage: %s [options] outputfile.tsf\n", name);
+   printf("Options:\n");
+   printf("  -f frames     nr of frames (default 1000)\n");
+   printf("  -d density    mean nr of spots per frame per channel (default 100)\n");
+   printf("  -c channels   nr of channels (default 1)\n");
+   printf("  -b frames     mean nr of frames a fluorophore stays on (default 3)\n");
+   printf("  -x pixels     width and height of the image in pixels (default 256)\n");
+   printf("  -p nm         pixel size in nm (default 100)\n");
+   printf("  -s seed       seed of the random number generator (default 1)\n");
+   printf("  -n spots      stop after this many spots\n");
+   printf("  -a            also fill the optional fields (z, background, width, etc..)\n");
+   printf("  -e            also fill the Spot extensions linked into this program\n");
+   printf("                (those of MMLocM.proto, see the Makefile)\n");
+}
+
+
+int main (int argc, char* argv[])
+{
+   Options opt;
+   opt.nrFrames = 1000;
+   opt.density = 100.0;
+   opt.nrChannels = 1;
+   opt.onTime = 3.0;
+   opt.nrPixels = 256;
+   opt.pixelSize = 100.0;
+   opt.seed = 1;
+   opt.maxSpots = 0;
+   opt.allFields = false;
+   opt.extensions = false;
+
+   int c;
+   while ((c = getopt(argc, argv, "f:d:c:b:x:p:s:n:ae")) != -1)
+   {
+      switch (c)
+      {
+         case 'f': opt.nrFrames = atoi(optarg); break;
+         case 'd': opt.density = atof(optarg); break;
+         case 'c': opt.nrChannels = atoi(optarg); break;
+         case 'b': opt.onTime = atof(optarg); break;
+         case 'x': opt.nrPixels = atoi(optarg); break;
+         case 'p': opt.pixelSize = atof(optarg); break;
+         case 's': opt.seed = strtoull(optarg, NULL, 10); break;
+         case 'n': opt.maxSpots = strtoull(optarg, NULL, 10); break;
+         case 'a': opt.allFields = true; break;
+         case 'e': opt.extensions = true; break;
+         default:
+            usage(argv[0]);
+            return 1;
+      }
+   }
+   if (optind != argc - 1 || opt.nrFrames < 1 || opt.nrChannels < 1 ||
+         opt.density < 0.0 || opt.nrPixels < 1)
+   {
+      usage(argv[0]);
+      return 1;
+   }
+   const char* outputFile = argv[optind];
+
+   // extension fields (int32 or float) that were linked in
+   std::vector<const google::protobuf::FieldDescriptor*> extensions;
+   if (opt.extensions)
+   {
+      std::vector<const google::protobuf::FieldDescriptor*> fds;
+      google::protobuf::DescriptorPool::generated_pool()->FindAllExtensions(
+            TSF::Spot::descriptor(), &fds);
+      for (unsigned int i = 0; i < fds.size(); i++)
+      {
+         if (!fds[i]->is_repeated() && (fds[i]->cpp_type() ==
+                  google::protobuf::FieldDescriptor::CPPTYPE_FLOAT ||
+                  fds[i]->cpp_type() ==
+                  google::protobuf::FieldDescriptor::CPPTYPE_INT32))
+            extensions.push_back(fds[i]);
+      }
+      if (extensions.empty())
+         printf("No Spot extensions were linked into this program\n");
+   }
+
+   Random random(opt.seed);
+   float size = opt.nrPixels * opt.pixelSize;
+   // precision of a localization with 1 photon (nm)
+   const float sigma = 1.3 * opt.pixelSize;
+   std::vector<std::vector<Fluorophore> > active(opt.nrChannels);
+   int32_t nextMolecule = 0;
+   uint64_t counter = 0;
+
+   std::fstream fs;
+   fs.open(outputFile, std::ios_base::in | std::ios_base::out |
+         std::ios_base::trunc | std::ios_base::binary);
+   if (!fs.is_open())
+   {
+      printf("Failed to open %s\n", outputFile);
+      return 1;
+   }
+
+   // Silence Protocol Buffer warnings
+   google::protobuf::LogSilencer* ls = new google::protobuf::LogSilencer();
+
+   try {
+      TSFUtils* tsfOut = new TSFUtils(&fs, TSFUtils::WRITE);
+      uint8_t buffer[1024];
+
+      for (int32_t frame = 1; frame <= opt.nrFrames; frame++)
+      {
+         for (int32_t channel = 1; channel <= opt.nrChannels; channel++)
+         {
+            std::vector<Fluorophore>& on = active[channel - 1];
+
+            // switch on new fluorophores
+            uint32_t nrNew = random.Poisson(opt.density /
+                  (opt.onTime > 1.0 ? opt.onTime : 1.0));
+            for (uint32_t i = 0; i < nrNew; i++)
+            {
+               Fluorophore f;
+               f.molecule = nextMolecule++;
+               f.x = random.Uniform() * size;
+               f.y = random.Uniform() * size;
+               f.z = (random.Uniform() - 0.5) * 800.0;
+               f.photons = 500.0 + 2000.0 * random.Uniform();
+               f.framesLeft = random.Geometric(opt.onTime);
+               on.push_back(f);
+            }
+
+            for (unsigned int i = 0; i < on.size(); )
+            {
+               Fluorophore& f = on[i];
+               float photons = f.photons * (0.5 + random.Uniform());
+               float precision = sigma / sqrt(photons);
+               float x = f.x + precision * random.Normal();
+               float y = f.y + precision * random.Normal();
+
+               uint8_t* p = buffer;
+               p = WireFormatLite::WriteInt32ToArray(TSF::Spot::kMoleculeFieldNumber, f.molecule, p);
+               p = WireFormatLite::WriteInt32ToArray(TSF::Spot::kChannelFieldNumber, channel, p);
+               p = WireFormatLite::WriteInt32ToArray(TSF::Spot::kFrameFieldNumber, frame, p);
+               if (opt.allFields)
+               {
+                  p = WireFormatLite::WriteInt32ToArray(TSF::Spot::kSliceFieldNumber, 1, p);
+                  p = WireFormatLite::WriteInt32ToArray(TSF::Spot::kPosFieldNumber, 1, p);
+               }
+               p = WireFormatLite::WriteFloatToArray(TSF::Spot::kXFieldNumber, x, p);
+               p = WireFormatLite::WriteFloatToArray(TSF::Spot::kYFieldNumber, y, p);
+               if (opt.allFields)
+                  p = WireFormatLite::WriteFloatToArray(TSF::Spot::kZFieldNumber,
+                        f.z + 2.5 * precision * random.Normal(), p);
+               p = WireFormatLite::WriteFloatToArray(TSF::Spot::kIntensityFieldNumber, photons, p);
+               if (opt.allFields)
+               {
+                  p = WireFormatLite::WriteFloatToArray(TSF::Spot::kBackgroundFieldNumber,
+                        10.0 + 5.0 * random.Uniform(), p);
+                  p = WireFormatLite::WriteFloatToArray(TSF::Spot::kWidthFieldNumber,
+                        sigma * (0.9 + 0.2 * random.Uniform()), p);
+                  p = WireFormatLite::WriteFloatToArray(TSF::Spot::kAFieldNumber,
+                        0.8 + 0.4 * random.Uniform(), p);
+                  p = WireFormatLite::WriteFloatToArray(TSF::Spot::kThetaFieldNumber, 0.0, p);
+                  p = WireFormatLite::WriteFloatToArray(TSF::Spot::kXOriginalFieldNumber, x, p);
+                  p = WireFormatLite::WriteFloatToArray(TSF::Spot::kYOriginalFieldNumber, y, p);
+                  p = WireFormatLite::WriteFloatToArray(TSF::Spot::kXPrecisionFieldNumber, precision, p);
+                  p = WireFormatLite::WriteFloatToArray(TSF::Spot::kYPrecisionFieldNumber, precision, p);
+               }
+               for (unsigned int e = 0; e < extensions.size(); e++)
+               {
+                  if (extensions[e]->cpp_type() ==
+                        google::protobuf::FieldDescriptor::CPPTYPE_FLOAT)
+                     p = WireFormatLite::WriteFloatToArray(extensions[e]->number(),
+                           photons * random.Uniform(), p);
+                  else
+                     p = WireFormatLite::WriteInt32ToArray(extensions[e]->number(),
+                           (int32_t) (random.Next() >> 56), p);
+               }
+               tsfOut->WriteSpotBinary(buffer, p - buffer);
+
+               counter++;
+               if (counter % 10000000 == 0)
+               {
+                  std::cout << ".";
+                  std::cout.flush();
+               }
+               if (opt.maxSpots > 0 && counter >= opt.maxSpots)
+               {
+                  opt.nrFrames = frame;
+                  break;
+               }
+
+               if (--f.framesLeft == 0)
+               {
+                  on[i] = on.back();
+                  on.pop_back();
+               } else
+                  i++;
+            }
+            if (opt.maxSpots > 0 && counter >= opt.maxSpots)
+               break;
+         }
+      }
+
+      TSF::SpotList sl;
+      sl.set_application_id(1);
+      sl.set_name("synthetic");
+      sl.set_nr_pixels_x(opt.nrPixels);
+      sl.set_nr_pixels_y(opt.nrPixels);
+      sl.set_pixel_size(opt.pixelSize);
+      sl.set_nr_spots(counter);
+      sl.set_nr_channels(opt.nrChannels);
+      sl.set_nr_frames(opt.nrFrames);
+      sl.set_nr_slices(1);
+      sl.set_nr_pos(1);
+      sl.set_location_units(TSF::NM);
+      sl.set_intensity_units(TSF::PHOTONS);
+      tsfOut->WriteHeaderBinary(&sl);
+
+      delete tsfOut;
+      fs.close();
+      std::cout << "Wrote " << counter << " spots\n";
+   } catch (TSFException& ex)
+   {
+      std::cout << ex.getMessage().c_str() << std::endl;
+      return 1;
+   }
+
+   delete ls;
+
+   return 0;
+}
@@ -14,26 +14,218 @@
 
 
 #include "TSFUtils.cpp"
+#include "TSFOverlay.cpp"
+#include "TSFMetrics.cpp"
+#include "TSFTrace.cpp"
+#include "TSFSpotView.cpp"
+#include "TSFThreadPool.cpp"
+#include "TSFRollingWriter.cpp"
+#include "TSFMerger.cpp"
+#include "TSFSplitter.cpp"
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 
+// Nr of spots converted at a time
+static const uint32_t BATCHSIZE = 10000;
+// Nr of spots formatted as text by one thread at a time
+static const uint32_t TEXTCHUNK = 1000;
+
 
 void usage (int argc, const char* argv[])
 {
-   printf("Usage: %s inputfile outputfile\n", argv[0]);
+   printf("Usage: %s [--stats] [--trace tracefile.json] [--threads n]\n", argv[0]);
+   printf("       [--roll-bytes n] [--roll-frames n] inputfile outputfile\n");
+   printf("       %s [options] --merge inputfile inputfile ... outputfile\n", argv[0]);
+   printf("       %s [options] --split fields inputfile outputfile\n", argv[0]);
    printf("Output and input must have .txt or .tsf extension\n");
+   printf("Values in the sidecar overlays (.ovl files) of .tsf input files are\n");
+   printf("written to the output\n");
+   printf("--stats prints bytes and spots processed, and the time spent\n");
+   printf("        reading, parsing, serializing and writing\n");
+   printf("--trace writes the stages of the conversion of each batch of spots\n");
+   printf("        in Chrome trace format (open in https://ui.perfetto.dev)\n");
+   printf("--threads sets the nr of threads used to format text output (default\n");
+   printf("        TSF_NUM_THREADS or the nr of processors)\n");
+   printf("--roll-bytes and --roll-frames split tsf output into parts of about\n");
+   printf("        n bytes or at most n frames, listed in a .manifest file\n");
+   printf("--merge merges .tsf files that are sorted by frame into a single\n");
+   printf("        .tsf file sorted by frame\n");
+   printf("--split writes the spots to one .tsf file per value of the given\n");
+   printf("        fields, a comma separated list of channel, pos, slice and\n");
+   printf("        frames=n (ranges of n frames), e.g. --split channel,pos\n");
+}
+
+/**
+ * Parses the fields of --split into TSFSplitter keys, returns 0 when they
+ * are not valid
+ */
+int parseSplit(const char* fields, int32_t* framesPerShard)
+{
+   int keys = 0;
+   std::vector<std::string> names = TSFUtils::split(fields, ',');
+   for (unsigned int i = 0; i < names.size(); i++)
+   {
+      if (names[i] == "channel")
+         keys |= TSFSplitter::CHANNEL;
+      else if (names[i] == "pos")
+         keys |= TSFSplitter::POS;
+      else if (names[i] == "slice")
+         keys |= TSFSplitter::SLICE;
+      else if (names[i].compare(0, 7, "frames=") == 0 &&
+            atoi(names[i].c_str() + 7) > 0)
+      {
+         keys |= TSFSplitter::FRAMES;
+         *framesPerShard = atoi(names[i].c_str() + 7);
+      }
+      else
+         return 0;
+   }
+   return keys;
+}
+
+void progress(unsigned long counter)
+{
+   if (counter % 100000 == 0)
+   {
+      std::cout << ".";
+      std::cout.flush();
+   }
+}
+
+uint32_t readTextBatch(std::ifstream* ifs, std::vector<TSF::Spot>& spots,
+      std::vector<std::string>& fields, TSFMetrics* metrics)
+{
+   TSFTraceScope scope("read", "tsftrans");
+   if (spots.size() < BATCHSIZE)
+      spots.resize(BATCHSIZE);
+   uint32_t n = 0;
+   while (n < BATCHSIZE && 
+         TSFUtils::GetSpotText(ifs, &spots[n], fields, metrics) == TSFUtils::GOOD)
+      n++;
+   scope.SetSpots(n);
+   return n;
+}
+
+/**
+ * Formats chunks of TEXTCHUNK spots of a batch as text, so that the chunks
+ * can be formatted by the threads of the TSFThreadPool
+ */
+class TextFormatter : public TSFLoopBody
+{
+   public:
+      TextFormatter(std::vector<TSF::Spot>& spots, uint32_t n,
+            std::vector<std::string>& fields, bool collectMetrics) :
+         spots_(spots),
+         n_(n),
+         fields_(fields),
+         text_((n + TEXTCHUNK - 1) / TEXTCHUNK),
+         errors_(text_.size()),
+         metrics_(collectMetrics ? text_.size() : 0)
+      {};
+
+      uint64_t GetNrChunks() { return text_.size(); };
+      const std::string& GetText(uint64_t chunk) { return text_[chunk]; };
+      const TSFMetrics* GetMetrics(uint64_t chunk) 
+      { 
+         return metrics_.empty() ? NULL : &metrics_[chunk]; 
+      };
+      // message of the first chunk that failed
+      const std::string& GetError()
+      {
+         for (uint64_t chunk = 0; chunk < errors_.size(); chunk++)
+         {
+            if (!errors_[chunk].empty())
+               return errors_[chunk];
+         }
+         return errors_.front();
+      };
+
+      bool Run(uint64_t chunk)
+      {
+         uint32_t first = chunk * TEXTCHUNK;
+         uint32_t last = first + TEXTCHUNK < n_ ? first + TEXTCHUNK : n_;
+         TSFMetrics* metrics = metrics_.empty() ? NULL : &metrics_[chunk];
+         std::ostringstream os;
+         try {
+            for (uint32_t i = first; i < last; i++)
+               TSFUtils::WriteSpotText(&os, &spots_[i], fields_, metrics);
+         } catch (TSFException& ex) {
+            // chunks run concurrently, so each has its own message
+            errors_[chunk] = ex.getMessage();
+            return false;
+         }
+         text_[chunk] = os.str();
+         return true;
+      };
+
+   private:
+      std::vector<TSF::Spot>& spots_;
+      uint32_t n_;
+      std::vector<std::string>& fields_;
+      std::vector<std::string> text_;
+      std::vector<std::string> errors_;
+      std::vector<TSFMetrics> metrics_;
+};
+
+void writeTextBatch(std::ofstream* ofs, std::vector<TSF::Spot>& spots,
+      uint32_t n, std::vector<std::string>& fields, TSFMetrics* metrics)
+{
+   TextFormatter formatter(spots, n, fields, metrics != NULL);
+   {
+      TSFTraceScope scope("serialize", "tsftrans");
+      scope.SetSpots(n);
+      if (!TSFThreadPool::Shared()->ParallelFor(formatter.GetNrChunks(), 
+               &formatter))
+         throw TSFException(formatter.GetError());
+   }
+
+   TSFTraceScope scope("write", "tsftrans");
+   scope.SetSpots(n);
+   for (uint64_t chunk = 0; chunk < formatter.GetNrChunks(); chunk++)
+   {
+      const std::string& text = formatter.GetText(chunk);
+      ofs->write(text.data(), text.size());
+      if (metrics != NULL)
+         metrics->Add(*formatter.GetMetrics(chunk));
+   }
 }
 
 
 int main (int argc, const char*  argv[])
 {
-   if (argc != 3) 
+   bool stats = false;
+   const char* traceFile = NULL;
+   uint64_t rollBytes = 0;
+   int32_t rollFrames = 0;
+   bool merge = false;
+   const char* splitFields = NULL;
+   std::vector<const char*> files;
+   for (int i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--stats") == 0)
+         stats = true;
+      else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+         traceFile = argv[++i];
+      else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+         TSFThreadPool::Configure(atoi(argv[++i]), std::vector<int>());
+      else if (strcmp(argv[i], "--roll-bytes") == 0 && i + 1 < argc)
+         rollBytes = strtoull(argv[++i], NULL, 10);
+      else if (strcmp(argv[i], "--roll-frames") == 0 && i + 1 < argc)
+         rollFrames = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--merge") == 0)
+         merge = true;
+      else if (strcmp(argv[i], "--split") == 0 && i + 1 < argc)
+         splitFields = argv[++i];
+      else
+         files.push_back(argv[i]);
+   }
+   if (files.size() < 2 || (files.size() > 2 && !merge))
    {
       usage(argc, argv);
       return 1;
    }
 
-   const char* inputFile = argv[1];
-   const char* outputFile = argv[2];
+   const char* inputFile = files[0];
+   const char* outputFile = files.back();
 
    const char* textExt = ".txt";
    const char* binaryExt = ".tsf";
@@ -69,22 +261,158 @@ int main (int argc, const char*  argv[])
       return 1;
    }
 
+   bool rolling = rollBytes > 0 || rollFrames > 0;
+   if (rolling && !outputBinary)
+   {
+      printf("--roll-bytes and --roll-frames need a .tsf output file\n");
+      return 1;
+   }
+
+   if (merge && !(inputBinary && outputBinary))
+   {
+      printf("--merge needs .tsf input and output files\n");
+      return 1;
+   }
+
+   int splitKeys = 0;
+   int32_t framesPerShard = 0;
+   if (splitFields != NULL)
+   {
+      splitKeys = parseSplit(splitFields, &framesPerShard);
+      if (splitKeys == 0)
+      {
+         printf("--split expects channel, pos, slice and/or frames=n\n");
+         return 1;
+      }
+      if (!outputBinary || rolling || merge)
+      {
+         printf("--split needs a .tsf output file, and can not be combined with\n");
+         printf("        --merge, --roll-bytes or --roll-frames\n");
+         return 1;
+      }
+   }
+
 
    TSF::SpotList* sl = new TSF::SpotList();
-   TSF::Spot* spot = new TSF::Spot;
+   std::vector<TSF::Spot> spots;
 
    // Silence Protocol Buffer warnings
    google::protobuf::LogSilencer* ls = new google::protobuf::LogSilencer();
+
+   TSFMetrics* metrics = stats ? new TSFMetrics() : NULL;
+   uint64_t start = TSFMetrics::Now();
+   if (traceFile != NULL)
+   {
+      TSFTrace::Start();
+      TSFTrace::SetThreadName("tsftrans");
+   }
          
    try {
-      if (inputBinary)
+      if (merge)
+      {
+         std::vector<std::string> inputFiles(files.begin(), files.end() - 1);
+         TSFMerger merger(inputFiles, metrics);
+         merger.GetSpotList(sl);
+
+         unsigned long counter = 0;
+         TSFSpotView view;
+         // records with the values of sidecar overlays
+         std::string record;
+         const uint8_t* data;
+         uint32_t size;
+         if (rolling)
+         {
+            TSFRollingWriter tsfOut(outputFile, *sl, rollBytes, rollFrames,
+                  metrics);
+            while (merger.NextSpotView(&view))
+            {
+               view.GetRecord(&record, &data, &size);
+               tsfOut.WriteSpotBinary(data, size);
+               progress(++counter);
+            }
+            merger.GetSpotList(sl);
+            tsfOut.SetSpotList(*sl);
+            tsfOut.Close();
+            std::cout << "Merged " << counter << " spots into " << 
+               tsfOut.GetParts().size() << " parts, listed in " << 
+               tsfOut.GetManifestName() << "\n";
+         } else
+         {
+            std::fstream fs; 
+            fs.open(outputFile, std::ios_base::in | std::ios_base::out | 
+                  std::ios_base::trunc | std::ios_base::binary);
+            TSFUtils tsfOut(&fs, TSFUtils::WRITE, metrics);
+            while (merger.NextSpotView(&view))
+            {
+               view.GetRecord(&record, &data, &size);
+               tsfOut.WriteSpotBinary(data, size);
+               progress(++counter);
+            }
+            merger.GetSpotList(sl);
+            tsfOut.WriteHeaderBinary(sl);
+            fs.close();
+            std::cout << "Merged " << counter << " spots\n";
+         }
+      } else if (splitKeys != 0)
+      {
+         unsigned long counter = 0;
+         if (inputBinary)
+         {
+            std::fstream ifs;
+            ifs.open(inputFile, std::ios_base::in | std::ios_base::binary);
+            TSFUtils tsfIn(&ifs, TSFUtils::READ, metrics);
+            tsfIn.GetHeaderBinary(sl);
+            tsfIn.AddOverlays(inputFile);
+
+            // spots are routed without decoding them (the values of sidecar
+            // overlays are appended to their records)
+            TSFSplitter splitter(outputFile, *sl, splitKeys, framesPerShard,
+                  metrics);
+            TSFSpotView view;
+            std::string record;
+            const uint8_t* data;
+            uint32_t size;
+            while (tsfIn.NextSpotView(&view))
+            {
+               view.GetRecord(&record, &data, &size);
+               splitter.WriteSpotBinary(data, size);
+               progress(++counter);
+            }
+            splitter.Close();
+            std::cout << "Wrote " << counter << " spots to " << 
+               splitter.GetShards().size() << " files\n";
+            ifs.close();
+         } else
+         {
+            std::ifstream ifs;
+            ifs.open(inputFile, std::ios_base::in);
+            TSFUtils::GetHeaderText(&ifs, sl);
+            std::vector<std::string> fields;
+            TSFUtils::GetSpotFields(&ifs, fields);
+
+            TSFSplitter splitter(outputFile, *sl, splitKeys, framesPerShard,
+                  metrics);
+            uint32_t n;
+            while ((n = readTextBatch(&ifs, spots, fields, metrics)) > 0)
+            {
+               splitter.WriteSpotsBinary(spots, n);
+               counter += n;
+               progress(counter);
+            }
+            splitter.Close();
+            std::cout << "Wrote " << counter << " spots to " << 
+               splitter.GetShards().size() << " files\n";
+            ifs.close();
+         }
+      } else if (inputBinary)
       {
          std::fstream ifs;
          ifs.open(inputFile, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 
-         TSFUtils* tsfIn = new TSFUtils(&ifs, TSFUtils::READ);
+         TSFUtils* tsfIn = new TSFUtils(&ifs, TSFUtils::READ, metrics);
          
          tsfIn->GetHeaderBinary(sl);
+         tsfIn->AddOverlays(inputFile);
 
          if (outputText)
          {
@@ -94,45 +422,57 @@ int main (int argc, const char*  argv[])
             ofs.open(outputFile, std::ios_base::out | std::ios_base::trunc);
             TSFUtils::WriteHeaderText(&ofs, sl);
 
-            int ret = tsfIn->GetSpotBinary(spot);
+            uint32_t n = tsfIn->GetSpotsBinary(spots, BATCHSIZE);
             std::vector<std::string> fields;
 
-            TSFUtils::ExtractSpotFields(spot, fields);
+            if (n > 0)
+               TSFUtils::ExtractSpotFields(&spots[0], fields);
             TSFUtils::WriteSpotFields(&ofs, fields);
-            TSFUtils::WriteSpotText(&ofs, spot, fields);
 
             unsigned long counter = 0;
-            while (ret == TSFUtils::GOOD)
+            while (n > 0)
             {
-               ret = tsfIn->GetSpotBinary(spot);
-               if (ret == TSFUtils::GOOD)
-                  TSFUtils::WriteSpotText(&ofs, spot, fields);
-               counter++;
-               if (counter % 100000 == 0)
-               {
-                  std::cout << ".";
-                  std::cout.flush();
-               }
+               writeTextBatch(&ofs, spots, n, fields, metrics);
+               counter += n;
+               progress(counter);
+               n = tsfIn->GetSpotsBinary(spots, BATCHSIZE);
             }
             std::cout << "Wrote " << counter << " spots\n";
+            if (metrics != NULL)
+               metrics->AddBytesWritten(ofs.tellp());
             ofs.close();
+         } else if (outputBinary && rolling)
+         {
+            TSFRollingWriter tsfOut(outputFile, *sl, rollBytes, rollFrames,
+                  metrics);
+
+            unsigned long counter = 0;
+            uint32_t n;
+            while ((n = tsfIn->GetSpotsBinary(spots, BATCHSIZE)) > 0)
+            {
+               tsfOut.WriteSpotsBinary(spots, n);
+               counter += n;
+               progress(counter);
+            }
+            tsfOut.Close();
+
+            std::cout << "Wrote " << counter << " spots to " << 
+               tsfOut.GetParts().size() << " parts, listed in " << 
+               tsfOut.GetManifestName() << "\n";
          } else if (outputBinary)
          {
             std::fstream fs; 
             fs.open(outputFile, std::ios_base::out | std::ios_base::trunc | 
                   std::ios_base::binary);
-            TSFUtils* tsfOut = new TSFUtils(&fs, TSFUtils::WRITE);
+            TSFUtils* tsfOut = new TSFUtils(&fs, TSFUtils::WRITE, metrics);
 
             unsigned long counter = 0;
-            while (tsfIn->GetSpotBinary(spot) == TSFUtils::GOOD)
+            uint32_t n;
+            while ((n = tsfIn->GetSpotsBinary(spots, BATCHSIZE)) > 0)
             {
-               tsfOut->WriteSpotBinary(spot);
-               counter++;
-               if (counter % 100000 == 0)
-               {
-                  std::cout << ".";
-                  std::cout.flush();
-               }
+               tsfOut->WriteSpotsBinary(spots, n);
+               counter += n;
+               progress(counter);
             }
 
             std::cout << "Wrote " << counter << " spots\n";
@@ -159,40 +499,55 @@ int main (int argc, const char*  argv[])
             TSFUtils::WriteHeaderText(&ofs, sl);
             TSFUtils::WriteSpotFields(&ofs, fields);
 
-            int counter = 0;
-            while (TSFUtils::GetSpotText(&ifs, spot, fields) == TSFUtils::GOOD)
+            unsigned long counter = 0;
+            uint32_t n;
+            while ((n = readTextBatch(&ifs, spots, fields, metrics)) > 0)
             {
                // write the spots out
-               TSFUtils::WriteSpotText(&ofs, spot, fields);
-               counter++;
-               if (counter % 100000 == 0)
-               {
-                  std::cout << ".";
-                  std::cout.flush();
-               }
+               writeTextBatch(&ofs, spots, n, fields, metrics);
+               counter += n;
+               progress(counter);
             }
             std::cout << "Found " << counter << " spots\n";
+            if (metrics != NULL)
+               metrics->AddBytesWritten(ofs.tellp());
 
             ifs.close();
             ofs.close();
+         } else if (outputBinary && rolling)
+         {
+            TSFRollingWriter tsfOut(outputFile, *sl, rollBytes, rollFrames,
+                  metrics);
+
+            unsigned long counter = 0;
+            uint32_t n;
+            while ((n = readTextBatch(&ifs, spots, fields, metrics)) > 0)
+            {
+               tsfOut.WriteSpotsBinary(spots, n);
+               counter += n;
+               progress(counter);
+            }
+            tsfOut.Close();
+
+            std::cout << "Wrote " << counter << " spots to " << 
+               tsfOut.GetParts().size() << " parts, listed in " << 
+               tsfOut.GetManifestName() << "\n";
+            ifs.close();
          } else if (outputBinary)
          {
             std::fstream fs; 
             fs.open(outputFile, std::ios_base::out | std::ios_base::trunc | 
                   std::ios_base::binary);
 
-            TSFUtils* tsfOut = new TSFUtils(&fs, TSFUtils::WRITE);
+            TSFUtils* tsfOut = new TSFUtils(&fs, TSFUtils::WRITE, metrics);
 
             unsigned long counter = 0;
-            while (TSFUtils::GetSpotText(&ifs, spot, fields) == TSFUtils::GOOD)
+            uint32_t n;
+            while ((n = readTextBatch(&ifs, spots, fields, metrics)) > 0)
             {
-               tsfOut->WriteSpotBinary(spot);
-               counter++;
-               if (counter % 100000 == 0)
-               {
-                  std::cout << ".";
-                  std::cout.flush();
-               }
+               tsfOut->WriteSpotsBinary(spots, n);
+               counter += n;
+               progress(counter);
             }
 
             std::cout << "Wrote " << counter << " spots\n";
@@ -212,8 +567,22 @@ int main (int argc, const char*  argv[])
       std::cout << "Some exceptions occurred.  Exciting now...\n";
    }
 
+   if (traceFile != NULL)
+   {
+      TSFTrace::Stop();
+      if (TSFTrace::Save(traceFile))
+         std::cout << "Wrote trace to " << traceFile << "\n";
+      else
+         std::cout << "Failed to write trace to " << traceFile << "\n";
+   }
+
+   if (metrics != NULL)
+   {
+      metrics->Print(std::cout, TSFMetrics::Now() - start);
+      delete metrics;
+   }
+
    delete sl;
-   delete spot;
 
    delete ls;
 